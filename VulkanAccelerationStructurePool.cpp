@@ -0,0 +1,151 @@
+/******************************************************************************
+This file is part of the Newcastle Vulkan Tutorial Series
+
+Author:Rich Davison
+Contact:richgdavison@gmail.com
+License: MIT (see LICENSE file at the top of the source tree)
+*//////////////////////////////////////////////////////////////////////////////
+#include "VulkanAccelerationStructurePool.h"
+#include "VulkanBufferBuilder.h"
+#include <algorithm>
+
+using namespace NCL;
+using namespace Rendering;
+using namespace Vulkan;
+
+AccelerationStructurePool::AccelerationStructurePool(vk::Device device, VmaAllocator allocator, vk::DeviceSize inBlockSize, const std::string& inDebugName) {
+	sourceDevice	= device;
+	sourceAllocator	= allocator;
+	blockSize		= inBlockSize;
+	debugName		= inDebugName;
+}
+
+uint32_t AccelerationStructurePool::AddBlock(vk::DeviceSize size) {
+	std::unique_ptr<Block> block = std::make_unique<Block>();
+	block->buffer = BufferBuilder(sourceDevice, sourceAllocator)
+		.WithBufferUsage(vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR)
+		.WithDeviceAddress()
+		.Build(size, debugName + " Block " + std::to_string(blocks.size()));
+	block->ranges.Reset(size);
+	block->size = size;
+
+	stats.blockCount++;
+	stats.reservedBytes += size;
+
+	//Reuse a released block's index if there is one
+	for (uint32_t i = 0; i < blocks.size(); ++i) {
+		if (!blocks[i]) {
+			blocks[i] = std::move(block);
+			return i;
+		}
+	}
+	blocks.push_back(std::move(block));
+	return (uint32_t)blocks.size() - 1;
+}
+
+AccelerationStructureAllocation AccelerationStructurePool::Allocate(vk::DeviceSize size, const std::vector<uint32_t>& avoidBlocks) {
+	AccelerationStructureAllocation allocation;
+	size = (size + AS_ALIGNMENT - 1) & ~(AS_ALIGNMENT - 1);
+
+	size_t offset = 0;
+	uint32_t blockIndex = ~0u;
+	for (uint32_t i = 0; i < blocks.size(); ++i) {
+		if (!blocks[i] || std::find(avoidBlocks.begin(), avoidBlocks.end(), i) != avoidBlocks.end()) {
+			continue;
+		}
+		if (blocks[i]->ranges.Allocate(size, AS_ALIGNMENT, offset)) {
+			blockIndex = i;
+			break;
+		}
+	}
+	if (blockIndex == ~0u) {
+		blockIndex = AddBlock(std::max(size, blockSize));
+		if (!blocks[blockIndex]->ranges.Allocate(size, AS_ALIGNMENT, offset)) {
+			std::cout << __FUNCTION__ << " pool " << debugName << " can't allocate " << size << " bytes!\n";
+			return allocation;
+		}
+	}
+	Block& block = *blocks[blockIndex];
+	block.usedBytes += size;
+	block.allocationCount++;
+
+	allocation.buffer	= block.buffer.buffer;
+	allocation.offset	= offset;
+	allocation.size		= size;
+	allocation.block	= blockIndex;
+
+	stats.allocationCount++;
+	stats.usedBytes += size;
+	return allocation;
+}
+
+void AccelerationStructurePool::Free(AccelerationStructureAllocation& allocation) {
+	if (!allocation) {
+		return;
+	}
+	assert(allocation.block < blocks.size() && blocks[allocation.block]);
+	Block& block = *blocks[allocation.block];
+	block.ranges.Free(allocation.offset, allocation.size);
+	block.usedBytes -= allocation.size;
+	block.allocationCount--;
+
+	stats.allocationCount--;
+	stats.usedBytes -= allocation.size;
+	allocation = {};
+}
+
+vk::UniqueAccelerationStructureKHR AccelerationStructurePool::CreateAccelerationStructure(const AccelerationStructureAllocation& allocation, vk::AccelerationStructureTypeKHR type) const {
+	return sourceDevice.createAccelerationStructureKHRUnique(
+		{
+			.buffer = allocation.buffer,
+			.offset = allocation.offset,
+			.size	= allocation.size,
+			.type	= type
+		}
+	);
+}
+
+vk::DeviceAddress AccelerationStructurePool::GetScratch(vk::DeviceSize size, vk::DeviceSize alignment) {
+	alignment = std::max<vk::DeviceSize>(alignment, 1);
+	vk::DeviceSize neededSize = size + alignment;
+	if (!scratchBuffer.buffer || scratchBuffer.size < neededSize) {
+		//Grow by at least half again, so a run of slightly bigger builds doesn't reallocate every time
+		vk::DeviceSize newSize = std::max(neededSize, scratchBuffer.buffer ? scratchBuffer.size + scratchBuffer.size / 2 : 0);
+		scratchBuffer = BufferBuilder(sourceDevice, sourceAllocator)
+			.WithBufferUsage(vk::BufferUsageFlagBits::eStorageBuffer)
+			.WithDeviceAddress()
+			.Build(newSize, debugName + " Scratch");
+		stats.scratchBytes = newSize;
+	}
+	return (scratchBuffer.deviceAddress + alignment - 1) & ~(alignment - 1);
+}
+
+float AccelerationStructurePool::GetBlockOccupancy(uint32_t block) const {
+	if (block >= blocks.size() || !blocks[block]) {
+		return 0.0f;
+	}
+	return blocks[block]->usedBytes / (float)blocks[block]->size;
+}
+
+std::vector<uint32_t> AccelerationStructurePool::GetSparseBlocks(float maxOccupancy) const {
+	std::vector<uint32_t> sparseBlocks;
+	for (uint32_t i = 0; i < blocks.size(); ++i) {
+		if (blocks[i] && blocks[i]->allocationCount > 0 && GetBlockOccupancy(i) <= maxOccupancy) {
+			sparseBlocks.push_back(i);
+		}
+	}
+	return sparseBlocks;
+}
+
+uint32_t AccelerationStructurePool::ReleaseEmptyBlocks() {
+	uint32_t released = 0;
+	for (std::unique_ptr<Block>& block : blocks) {
+		if (block && block->allocationCount == 0) {
+			stats.blockCount--;
+			stats.reservedBytes -= block->size;
+			block.reset();
+			released++;
+		}
+	}
+	return released;
+}
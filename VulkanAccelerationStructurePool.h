@@ -0,0 +1,93 @@
+/******************************************************************************
+This file is part of the Newcastle Vulkan Tutorial Series
+
+Author:Rich Davison
+Contact:richgdavison@gmail.com
+License: MIT (see LICENSE file at the top of the source tree)
+*//////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "VulkanBuffers.h"
+#include "VulkanRangeAllocator.h"
+
+namespace NCL::Rendering::Vulkan {
+	struct AccelerationStructureAllocation {
+		vk::Buffer		buffer;
+		vk::DeviceSize	offset	= 0;
+		vk::DeviceSize	size	= 0;
+		uint32_t		block	= ~0u;
+
+		operator bool() const {
+			return block != ~0u;
+		}
+	};
+
+	/*
+	AccelerationStructurePool: Carves BLAS and TLAS storage out of large
+	device-local buffers, so that thousands of acceleration structures don't
+	each need their own allocation, and none of them end up in host visible
+	memory. Every range is aligned to the 256 bytes that acceleration
+	structures must start on. Anything bigger than a block gets a block of
+	its own.
+
+	It also holds a scratch arena - a single scratch buffer that grows to
+	fit the biggest build asked for, and is otherwise reused. Only one set
+	of builds can use it at a time, so the GPU must be done with the last
+	builds before GetScratch is called again.
+
+	For defragmenting, GetSparseBlocks finds blocks that are mostly empty.
+	Whatever is in them can be moved out with Allocate(size, avoidBlocks) and
+	a clone copy, after which ReleaseEmptyBlocks frees their memory. Block
+	indices stay the same for as long as the pool exists. Not thread safe.
+	*/
+	class AccelerationStructurePool	{
+	public:
+		static const vk::DeviceSize AS_ALIGNMENT = 256;
+
+		struct Stats {
+			uint32_t		blockCount		= 0;
+			uint32_t		allocationCount = 0;
+			vk::DeviceSize	reservedBytes	= 0;	//Total size of all blocks
+			vk::DeviceSize	usedBytes		= 0;
+			vk::DeviceSize	scratchBytes	= 0;
+		};
+
+		AccelerationStructurePool(vk::Device device, VmaAllocator allocator, vk::DeviceSize blockSize = 64 * 1024 * 1024, const std::string& debugName = "AS Pool");
+		~AccelerationStructurePool() {}
+
+		AccelerationStructureAllocation Allocate(vk::DeviceSize size, const std::vector<uint32_t>& avoidBlocks = {});
+		void							Free(AccelerationStructureAllocation& allocation);
+
+		//Creates an acceleration structure using the allocation as its storage
+		vk::UniqueAccelerationStructureKHR CreateAccelerationStructure(const AccelerationStructureAllocation& allocation, vk::AccelerationStructureTypeKHR type) const;
+
+		//Returns the address of at least size bytes of scratch memory, at the given alignment
+		vk::DeviceAddress GetScratch(vk::DeviceSize size, vk::DeviceSize alignment = AS_ALIGNMENT);
+
+		float					GetBlockOccupancy(uint32_t block) const;
+		std::vector<uint32_t>	GetSparseBlocks(float maxOccupancy) const;
+		uint32_t				ReleaseEmptyBlocks();
+
+		const Stats& GetStats() const {
+			return stats;
+		}
+
+	protected:
+		struct Block {
+			VulkanBuffer	buffer;
+			RangeAllocator	ranges;
+			vk::DeviceSize	size			= 0;
+			vk::DeviceSize	usedBytes		= 0;
+			uint32_t		allocationCount = 0;
+		};
+		uint32_t AddBlock(vk::DeviceSize size);
+
+		vk::Device		sourceDevice;
+		VmaAllocator	sourceAllocator;
+		vk::DeviceSize	blockSize;
+		std::string		debugName;
+
+		std::vector<std::unique_ptr<Block>> blocks;	//Released blocks leave a null entry, so indices don't change
+		VulkanBuffer	scratchBuffer;
+		Stats			stats;
+	};
+}
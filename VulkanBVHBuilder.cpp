@@ -10,15 +10,31 @@ License: MIT (see LICENSE file at the top of the source tree)
 #include "VulkanBufferBuilder.h"
 #include "VulkanMesh.h"
 #include "VulkanUtils.h"
+#include <algorithm>
 
 using namespace NCL;
 using namespace Rendering;
 using namespace Vulkan;
 
 VulkanBVHBuilder::VulkanBVHBuilder() {
+	scratchBudget		= 64 * 1024 * 1024;
+	scratchAlignment	= 256;
+	compaction			= false;
+	storagePool			= nullptr;
 }
 
 VulkanBVHBuilder::~VulkanBVHBuilder() {
+	//Everything lives in the pool, which may outlive us
+	for (BLASEntry& i : blasBuildInfo) {
+		i.accelStructure.reset();
+	}
+	tlas.reset();
+	if (storagePool) {
+		for (BLASEntry& i : blasBuildInfo) {
+			storagePool->Free(i.storage);
+		}
+		storagePool->Free(tlasStorage);
+	}
 }
 
 VulkanBVHBuilder& VulkanBVHBuilder::WithObject(VulkanMesh* m, const Matrix4& transform, uint32_t mask, uint32_t hitID) {
@@ -66,6 +82,54 @@ VulkanBVHBuilder& VulkanBVHBuilder::WithAllocator(VmaAllocator inAllocator) {
 	return *this;
 }
 
+VulkanBVHBuilder& VulkanBVHBuilder::WithCompaction(AccelerationStructurePool* inPool) {
+	compaction = true;
+	if (inPool) {
+		WithPool(inPool);
+	}
+	return *this;
+}
+
+VulkanBVHBuilder& VulkanBVHBuilder::WithPool(AccelerationStructurePool* inPool) {
+	assert(blasBuildInfo.empty() && !tlas);	//Can't move what's already been built to another pool
+	storagePool = inPool;
+	return *this;
+}
+
+AccelerationStructurePool& VulkanBVHBuilder::GetPool() {
+	if (!storagePool) {
+		ownedPool	= std::make_unique<AccelerationStructurePool>(sourceDevice, sourceAllocator, 64 * 1024 * 1024, "BVH Builder Pool");
+		storagePool = ownedPool.get();
+	}
+	return *storagePool;
+}
+
+VulkanBVHBuilder& VulkanBVHBuilder::WithScratchBudget(vk::DeviceSize bytes) {
+	scratchBudget = bytes;
+	return *this;
+}
+
+VulkanBVHBuilder& VulkanBVHBuilder::WithRenderer(VulkanRenderer& renderer) {
+	sourceDevice	= renderer.GetDevice();
+	sourceAllocator = renderer.GetMemoryAllocator();
+	//Mesh buffers and pool blocks are exclusive to the graphics family, so async
+	//compute can only be used if it's the same family, otherwise the builds
+	//would read buffers that were never transferred over to it
+	CommandType::Type buildType = CommandType::Graphics;
+	if (renderer.GetQueueFamily(CommandType::AsyncCompute) == renderer.GetQueueFamily(CommandType::Graphics)) {
+		buildType = CommandType::AsyncCompute;
+	}
+	queue			= renderer.GetQueue(buildType);
+	pool			= renderer.GetCommandPool(buildType);
+
+	vk::PhysicalDeviceAccelerationStructurePropertiesKHR asProps;
+	vk::PhysicalDeviceProperties2 props;
+	props.pNext = &asProps;
+	renderer.GetPhysicalDevice().getProperties2(&props);
+	scratchAlignment = std::max<vk::DeviceSize>(asProps.minAccelerationStructureScratchOffsetAlignment, 1);
+	return *this;
+}
+
 vk::UniqueAccelerationStructureKHR VulkanBVHBuilder::Build(vk::BuildAccelerationStructureFlagsKHR inFlags, const std::string& debugName) {
 	BuildBLAS(sourceDevice, sourceAllocator, inFlags);
 	BuildTLAS(sourceDevice, sourceAllocator, inFlags);
@@ -77,9 +141,42 @@ vk::UniqueAccelerationStructureKHR VulkanBVHBuilder::Build(vk::BuildAcceleration
 	return std::move(tlas);
 }
 
+std::unique_ptr<SceneAccelerationStructure> VulkanBVHBuilder::BuildScene(uint32_t maxInstances, uint32_t framesInFlight, vk::BuildAccelerationStructureFlagsKHR inFlags, const std::string& debugName) {
+	BuildBLAS(sourceDevice, sourceAllocator, inFlags);
+
+	std::unique_ptr<SceneAccelerationStructure> scene = std::make_unique<SceneAccelerationStructure>(sourceDevice, sourceAllocator,
+		std::max(maxInstances, (uint32_t)entries.size()), framesInFlight, inFlags, debugName);
+
+	//Instance IDs match the order the objects were added in
+	for (const VulkanBVHEntry& e : entries) {
+		scene->AddInstance(GetBLASAddress(e.meshID), e.modelMat, e.meshID, e.mask, e.hitID);
+	}
+	return scene;
+}
+
+vk::DeviceAddress VulkanBVHBuilder::GetBLASAddress(VulkanMesh* m) const {
+	auto savedMesh = uniqueMeshes.find(m);
+	if (savedMesh == uniqueMeshes.end()) {
+		return 0;
+	}
+	return GetBLASAddress(savedMesh->second);
+}
+
+vk::DeviceAddress VulkanBVHBuilder::GetBLASAddress(uint32_t meshID) const {
+	if (meshID >= blasBuildInfo.size()) {
+		return 0;
+	}
+	return sourceDevice.getAccelerationStructureAddressKHR({ .accelerationStructure = *blasBuildInfo[meshID].accelStructure });
+}
+
 void VulkanBVHBuilder::BuildBLAS(vk::Device device, VmaAllocator allocator, vk::BuildAccelerationStructureFlagsKHR inFlags) {
-	//We need to first create the BLAS entries for the unique meshes
-	for (const auto& i : meshes) {
+	//We need to first create the BLAS entries for the unique meshes, skipping any built by an earlier call
+	size_t firstNewBLAS = blasBuildInfo.size();
+	if (firstNewBLAS == meshes.size()) {
+		return;
+	}
+	for (size_t m = firstNewBLAS; m < meshes.size(); ++m) {
+		VulkanMesh* i = meshes[m];
 		vk::Buffer	vBuffer;
 		uint32_t	vOffset;
 		uint32_t	vRange;
@@ -89,7 +186,7 @@ void VulkanBVHBuilder::BuildBLAS(vk::Device device, VmaAllocator allocator, vk::
 		vk::Buffer		iBuffer;
 		uint32_t		iOffset;
 		uint32_t		iRange;
-		vk::IndexType	iFormat;
+		vk::IndexType	iFormat = vk::IndexType::eNoneKHR;
 		bool hasIndices = i->GetIndexInformation(iBuffer, iOffset, iRange, iFormat);
 
 		//vk::AccelerationStructureGeometryTrianglesDataKHR triData;
@@ -100,7 +197,7 @@ void VulkanBVHBuilder::BuildBLAS(vk::Device device, VmaAllocator allocator, vk::
 		vk::AccelerationStructureGeometryTrianglesDataKHR triData;
 		triData.vertexFormat = vFormat;
 		triData.vertexData.deviceAddress = device.getBufferAddress({.buffer = vBuffer }) + vOffset;
-		triData.vertexStride = sizeof(Vector3);
+		triData.vertexStride = i->GetAttributeStride(NCL::VertexAttribute::Positions);
 
 		if (hasIndices) {
 			triData.indexType = iFormat;
@@ -131,128 +228,224 @@ void VulkanBVHBuilder::BuildBLAS(vk::Device device, VmaAllocator allocator, vk::
 			blasEntry.geometries[j].geometry.triangles.maxVertex = m->count;
 
 			blasEntry.ranges[j].primitiveCount	= i->GetPrimitiveCount(j);
-			blasEntry.ranges[j].firstVertex		= m->base;
-			blasEntry.ranges[j].primitiveOffset = m->start *(iFormat == vk::IndexType::eUint32 ? 4 : 2);
+			if (hasIndices) {
+				blasEntry.ranges[j].firstVertex		= m->base;
+				blasEntry.ranges[j].primitiveOffset = m->start * VulkanMesh::GetIndexSize(iFormat);
+			}
+			else { //Without indices, the vertices are read from primitiveOffset + (firstVertex * stride)
+				blasEntry.ranges[j].firstVertex		= m->start;
+				blasEntry.ranges[j].primitiveOffset = 0;
+			}
 			blasEntry.maxPrims[j] = i->GetPrimitiveCount(j); 
 		}
 	}
 
-	vk::DeviceSize totalSize	= 0;
-	vk::DeviceSize scratchSize	= 0;
+	vk::DeviceSize largestScratch = 0;
 
-	for (auto& i : blasBuildInfo) {	//Go through each of the added entries to build up data...
+	for (size_t b = firstNewBLAS; b < blasBuildInfo.size(); ++b) {	//Go through each of the added entries to build up data...
+		BLASEntry& i = blasBuildInfo[b];
 		i.buildInfo.type = vk::AccelerationStructureTypeKHR::eBottomLevel;
 		i.buildInfo.mode = vk::BuildAccelerationStructureModeKHR::eBuild;
 		i.buildInfo.geometryCount	= i.geometries.size(); //TODO
 		i.buildInfo.pGeometries		= i.geometries.data();
 		i.buildInfo.flags |= inFlags;
+		if (compaction) {
+			i.buildInfo.flags |= vk::BuildAccelerationStructureFlagBitsKHR::eAllowCompaction;
+		}
 
 		device.getAccelerationStructureBuildSizesKHR(vk::AccelerationStructureBuildTypeKHR::eDevice,
 			&i.buildInfo, i.maxPrims.data(), &i.sizeInfo);
 
-		totalSize	+= i.sizeInfo.accelerationStructureSize;
-		scratchSize  = std::max(scratchSize, i.sizeInfo.buildScratchSize);
+		largestScratch = std::max(largestScratch, AlignScratch(i.sizeInfo.buildScratchSize));
 	}
 
-	VulkanBuffer scratchBuff = BufferBuilder(device, allocator)
-		.WithBufferUsage(	vk::BufferUsageFlagBits::eShaderDeviceAddress | 
-							vk::BufferUsageFlagBits::eStorageBuffer)
-		.Build(scratchSize, "Scratch Buffer");
+	AccelerationStructurePool& asPool = GetPool();
 
-	vk::DeviceAddress scratchAddr = device.getBufferAddress({ .buffer = scratchBuff.buffer });
+	for (size_t b = firstNewBLAS; b < blasBuildInfo.size(); ++b) {		//Make the storage for each blas entry...
+		BLASEntry& i = blasBuildInfo[b];
+		i.storage			= asPool.Allocate(i.sizeInfo.accelerationStructureSize);
+		i.accelStructure	= asPool.CreateAccelerationStructure(i.storage, vk::AccelerationStructureTypeKHR::eBottomLevel);
+		i.buildInfo.dstAccelerationStructure = *i.accelStructure;
+	}
 
-	vk::UniqueCommandBuffer buffer = CmdBufferCreateBegin(device, pool, "Making BLAS");
+	//Each build in a batch gets its own slice of the scratch buffer, so they can all run at once.
+	//A BLAS too big for the budget on its own still gets built, in a batch by itself
+	vk::DeviceSize scratchSize = std::max(scratchBudget, largestScratch);
+	vk::DeviceAddress scratchAddr = asPool.GetScratch(scratchSize, scratchAlignment);
 
-	for (auto& i : blasBuildInfo) {		//Make the buffer for each blas entry...
-		vk::AccelerationStructureCreateInfoKHR createInfo;
-		createInfo.type = vk::AccelerationStructureTypeKHR::eBottomLevel;
-		createInfo.size = i.sizeInfo.accelerationStructureSize;
+	vk::UniqueCommandBuffer buffer = CmdBufferCreateBegin(device, pool, "Making BLAS");
 
-		i.buffer = BufferBuilder(device, allocator)
-			.WithBufferUsage(	vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR | 
-								vk::BufferUsageFlagBits::eShaderDeviceAddress)
-			.WithHostVisibility()
-			.Build(createInfo.size);
-
-		createInfo.buffer = i.buffer;
-
-		i.accelStructure = device.createAccelerationStructureKHRUnique(createInfo);
-
-		i.buildInfo.dstAccelerationStructure	= *i.accelStructure;
-		i.buildInfo.scratchData.deviceAddress	= scratchAddr;
-
-		const vk::AccelerationStructureBuildRangeInfoKHR* rangeInfo = i.ranges.data();
-
-		buffer->buildAccelerationStructuresKHR(1, &i.buildInfo, &rangeInfo);
-					
-		buffer->pipelineBarrier(
-			vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, //Source
-			vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, //Dest
-			{}, //Dependency Flags
-			{//MemoryBarriers
-				{
-					.srcAccessMask = vk::AccessFlagBits::eAccelerationStructureWriteKHR,
-					.dstAccessMask = vk::AccessFlagBits::eAccelerationStructureWriteKHR
-				}
-				},
-			{}, //bufferMemoryBarriers
-			{} //imageMemoryBarriers
-		);
+	uint32_t newBLASCount = (uint32_t)(blasBuildInfo.size() - firstNewBLAS);
+	vk::UniqueQueryPool compactedSizeQueries;
+	if (compaction) {
+		compactedSizeQueries = device.createQueryPoolUnique({
+			.queryType	= vk::QueryType::eAccelerationStructureCompactedSizeKHR,
+			.queryCount = newBLASCount
+		});
+		buffer->resetQueryPool(*compactedSizeQueries, 0, newBLASCount);
 	}
-	CmdBufferEndSubmitWait(*buffer, device, queue);
-}
 
-void VulkanBVHBuilder::BuildTLAS(vk::Device device, VmaAllocator allocator, vk::BuildAccelerationStructureFlagsKHR flags) {
-	std::vector<vk::AccelerationStructureInstanceKHR> tlasEntries;
+	std::vector<vk::AccelerationStructureBuildGeometryInfoKHR>	batchInfos;
+	std::vector<const vk::AccelerationStructureBuildRangeInfoKHR*> batchRanges;
+	vk::DeviceSize batchScratch = 0;
 
-	const uint32_t instanceCount = entries.size();
+	auto RecordBatch = [&]() {
+		if (batchInfos.empty()) {
+			return;
+		}
+		buffer->buildAccelerationStructuresKHR((uint32_t)batchInfos.size(), batchInfos.data(), batchRanges.data());
+
+		//The next batch reuses the scratch memory, so has to wait for this one
+		vk::MemoryBarrier2 scratchBarrier = {
+			.srcStageMask	= vk::PipelineStageFlagBits2::eAccelerationStructureBuildKHR,
+			.srcAccessMask	= vk::AccessFlagBits2::eAccelerationStructureWriteKHR,
+			.dstStageMask	= vk::PipelineStageFlagBits2::eAccelerationStructureBuildKHR,
+			.dstAccessMask	= vk::AccessFlagBits2::eAccelerationStructureReadKHR | vk::AccessFlagBits2::eAccelerationStructureWriteKHR
+		};
+		buffer->pipelineBarrier2({ .memoryBarrierCount = 1, .pMemoryBarriers = &scratchBarrier });
+
+		batchInfos.clear();
+		batchRanges.clear();
+		batchScratch = 0;
+	};
+
+	for (size_t b = firstNewBLAS; b < blasBuildInfo.size(); ++b) {
+		BLASEntry& i = blasBuildInfo[b];
+		vk::DeviceSize buildScratch = AlignScratch(i.sizeInfo.buildScratchSize);
+		if (batchScratch + buildScratch > scratchSize) {
+			RecordBatch();
+		}
+		i.buildInfo.scratchData.deviceAddress = scratchAddr + batchScratch;
+		batchScratch += buildScratch;
 
-	tlasEntries.resize(instanceCount);
+		batchInfos.push_back(i.buildInfo);
+		batchRanges.push_back(i.ranges.data());
+	}
+	RecordBatch();
 
-	for (int i = 0; i < instanceCount; ++i) {
-		//VkTransformMatrixKHR has 3 rows of 4 columns each. upper 3x3 remains rotation
-		//Row major memory layout! Matrix class is column major...
-		tlasEntries[i].transform.matrix[0][0] = entries[i].modelMat.array[0][0];
-		tlasEntries[i].transform.matrix[0][1] = entries[i].modelMat.array[1][0];
-		tlasEntries[i].transform.matrix[0][2] = entries[i].modelMat.array[2][0];
-		tlasEntries[i].transform.matrix[0][3] = entries[i].modelMat.array[3][0];
+	if (compaction) {	//The last batch's barrier has already made the builds visible to the queries
+		std::vector<vk::AccelerationStructureKHR> newBLAS;
+		for (size_t b = firstNewBLAS; b < blasBuildInfo.size(); ++b) {
+			newBLAS.push_back(*blasBuildInfo[b].accelStructure);
+		}
+		buffer->writeAccelerationStructuresPropertiesKHR(newBLASCount, newBLAS.data(),
+			vk::QueryType::eAccelerationStructureCompactedSizeKHR, *compactedSizeQueries, 0);
+	}
 
-		tlasEntries[i].transform.matrix[1][0] = entries[i].modelMat.array[0][1];
-		tlasEntries[i].transform.matrix[1][1] = entries[i].modelMat.array[1][1];
-		tlasEntries[i].transform.matrix[1][2] = entries[i].modelMat.array[2][1];
-		tlasEntries[i].transform.matrix[1][3] = entries[i].modelMat.array[3][1];
+	CmdBufferEndSubmitWait(*buffer, device, queue);
 
-		tlasEntries[i].transform.matrix[2][0] = entries[i].modelMat.array[0][2];
-		tlasEntries[i].transform.matrix[2][1] = entries[i].modelMat.array[1][2];
-		tlasEntries[i].transform.matrix[2][2] = entries[i].modelMat.array[2][2];
-		tlasEntries[i].transform.matrix[2][3] = entries[i].modelMat.array[3][2];
+	vk::DeviceSize newBytes = 0;
+	for (size_t b = firstNewBLAS; b < blasBuildInfo.size(); ++b) {
+		newBytes += blasBuildInfo[b].sizeInfo.accelerationStructureSize;
+	}
+	blasMemory.uncompactedBytes += newBytes;
 
-		uint32_t meshID = entries[i].meshID;
+	if (compaction) {
+		CompactBLAS(device, allocator, firstNewBLAS, *compactedSizeQueries);
+	}
+	else {
+		blasMemory.currentBytes += newBytes;
+	}
+}
+
+void VulkanBVHBuilder::CompactBLAS(vk::Device device, VmaAllocator allocator, size_t firstNewBLAS, vk::QueryPool compactedSizeQueries) {
+	uint32_t newBLASCount = (uint32_t)(blasBuildInfo.size() - firstNewBLAS);
+
+	std::vector<vk::DeviceSize> compactedSizes(newBLASCount);
+	vk::Result result = device.getQueryPoolResults(compactedSizeQueries, 0, newBLASCount,
+		compactedSizes.size() * sizeof(vk::DeviceSize), compactedSizes.data(), sizeof(vk::DeviceSize),
+		vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait);
+	if (result != vk::Result::eSuccess) {
+		std::cout << __FUNCTION__ << " couldn't get compacted BLAS sizes, leaving them uncompacted: " << vk::to_string(result) << "\n";
+		for (size_t b = firstNewBLAS; b < blasBuildInfo.size(); ++b) {
+			blasMemory.currentBytes += blasBuildInfo[b].sizeInfo.accelerationStructureSize;
+		}
+		return;
+	}
+	AccelerationStructurePool& asPool = GetPool();
 
-		tlasEntries[i].instanceCustomIndex = meshID;
+	std::vector<vk::UniqueAccelerationStructureKHR> originals;
+	std::vector<AccelerationStructureAllocation>	originalStorage;
 
-		tlasEntries[i].accelerationStructureReference = device.getBufferAddress({ .buffer = blasBuildInfo[meshID].buffer.buffer });
+	vk::UniqueCommandBuffer buffer = CmdBufferCreateBegin(device, pool, "Compacting BLAS");
+	for (uint32_t c = 0; c < newBLASCount; ++c) {
+		BLASEntry& i = blasBuildInfo[firstNewBLAS + c];
 
+		AccelerationStructureAllocation compacted = asPool.Allocate(compactedSizes[c]);
+		if (!compacted) {	//Just keep the original
+			blasMemory.currentBytes += i.sizeInfo.accelerationStructureSize;
+			continue;
+		}
+		vk::UniqueAccelerationStructureKHR compactedBLAS = asPool.CreateAccelerationStructure(compacted, vk::AccelerationStructureTypeKHR::eBottomLevel);
+
+		buffer->copyAccelerationStructureKHR({
+			.src	= *i.accelStructure,
+			.dst	= *compactedBLAS,
+			.mode	= vk::CopyAccelerationStructureModeKHR::eCompact
+		});
+		//The originals have to stay alive until the copies are done
+		originals.push_back(std::move(i.accelStructure));
+		originalStorage.push_back(i.storage);
+		i.accelStructure	= std::move(compactedBLAS);
+		i.storage			= compacted;
+
+		blasMemory.currentBytes += compacted.size;
+	}
+	CmdBufferEndSubmitWait(*buffer, device, queue);
 
-		tlasEntries[i].flags = (VkGeometryInstanceFlagBitsKHR)vk::GeometryInstanceFlagBitsKHR::eTriangleFacingCullDisable;
-		tlasEntries[i].mask = entries[i].mask;
-		tlasEntries[i].instanceShaderBindingTableRecordOffset = entries[i].hitID;
+	originals.clear();
+	for (AccelerationStructureAllocation& a : originalStorage) {
+		asPool.Free(a);
 	}
+}
+
+vk::DeviceSize VulkanBVHBuilder::AlignScratch(vk::DeviceSize size) const {
+	return (size + scratchAlignment - 1) & ~(scratchAlignment - 1);
+}
+
+void VulkanBVHBuilder::BuildTLAS(vk::Device device, VmaAllocator allocator, vk::BuildAccelerationStructureFlagsKHR flags) {
+	const uint32_t instanceCount = entries.size();
 
 	size_t dataSize = instanceCount * sizeof(vk::AccelerationStructureInstanceKHR);
 
-	VulkanBuffer instanceBuffer = BufferBuilder(device, allocator)
-		.WithBufferUsage(	vk::BufferUsageFlagBits::eShaderDeviceAddress | 
-							vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR)
-		.WithHostVisibility()
-		.Build(dataSize, "Instance Buffer");
+	//The instance buffer is kept between builds, and only replaced if it's too small
+	if (!instanceBuffer.buffer || instanceBuffer.size < dataSize) {
+		instanceBuffer = BufferBuilder(device, allocator)
+			.WithBufferUsage(vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR)
+			.WithDeviceAddress()
+			.WithHostVisibility()
+			.WithPersistentMapping()
+			.Build(dataSize, "Instance Buffer");
+	}
 
-	instanceBuffer.CopyData(tlasEntries.data(), dataSize);
+	//Look up each BLAS address once, rather than once per instance
+	std::vector<vk::DeviceAddress> blasAddresses(blasBuildInfo.size());
+	for (uint32_t i = 0; i < blasBuildInfo.size(); ++i) {
+		blasAddresses[i] = GetBLASAddress(i);
+	}
+
+	//Instances are packed straight into the mapped buffer
+	vk::AccelerationStructureInstanceKHR* tlasEntries = (vk::AccelerationStructureInstanceKHR*)instanceBuffer.Data();
+	ParallelPackInstances(instanceCount, [&](size_t first, size_t last) {
+		for (size_t i = first; i < last; ++i) {
+			const VulkanBVHEntry& e = entries[i];
+			vk::AccelerationStructureInstanceKHR instance;
+			PackInstanceTransform(e.modelMat, instance.transform);
+
+			instance.instanceCustomIndex					= e.meshID;
+			instance.mask									= e.mask;
+			instance.instanceShaderBindingTableRecordOffset = e.hitID;
+			instance.flags									= (VkGeometryInstanceFlagsKHR)vk::GeometryInstanceFlagBitsKHR::eTriangleFacingCullDisable;
+			instance.accelerationStructureReference			= blasAddresses[e.meshID];
+
+			tlasEntries[i] = instance;
+		}
+	});
 
 	vk::AccelerationStructureGeometryKHR tlasGeometry;
 	tlasGeometry.geometryType = vk::GeometryTypeKHR::eInstances;
 	tlasGeometry.geometry = vk::AccelerationStructureGeometryInstancesDataKHR();
-	tlasGeometry.geometry.instances.data = device.getBufferAddress({ .buffer = instanceBuffer.buffer });
+	tlasGeometry.geometry.instances.data = instanceBuffer.deviceAddress;
 
 	vk::AccelerationStructureBuildGeometryInfoKHR geomInfo;
 	geomInfo.flags			= flags;
@@ -260,35 +453,20 @@ void VulkanBVHBuilder::BuildTLAS(vk::Device device, VmaAllocator allocator, vk::
 	geomInfo.pGeometries	= &tlasGeometry;
 	geomInfo.mode = vk::BuildAccelerationStructureModeKHR::eBuild;
 	geomInfo.type = vk::AccelerationStructureTypeKHR::eTopLevel;
-	geomInfo.srcAccelerationStructure = nullptr; //??
 
 	vk::AccelerationStructureBuildSizesInfoKHR sizesInfo;
 	device.getAccelerationStructureBuildSizesKHR(vk::AccelerationStructureBuildTypeKHR::eDevice, &geomInfo, &instanceCount, &sizesInfo);
 
-	tlasBuffer = BufferBuilder(device, allocator)
-		.WithDeviceAddress()
-		.WithBufferUsage(vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR)
-		.Build(sizesInfo.accelerationStructureSize, "TLAS Buffer");
+	AccelerationStructurePool& asPool = GetPool();
 
-	vk::AccelerationStructureCreateInfoKHR tlasCreateInfo;
-	tlasCreateInfo.buffer = tlasBuffer.buffer;
-	tlasCreateInfo.size = sizesInfo.accelerationStructureSize;
-	tlasCreateInfo.type = vk::AccelerationStructureTypeKHR::eTopLevel;
-	
-	tlas = device.createAccelerationStructureKHRUnique(tlasCreateInfo);
-
-	VulkanBuffer scratchBuffer = BufferBuilder(device, allocator)
-		.WithBufferUsage(	vk::BufferUsageFlagBits::eShaderDeviceAddress | 
-							vk::BufferUsageFlagBits::eStorageBuffer)
-		.WithHostVisibility()
-		.WithDeviceAddress()
-		.Build(sizesInfo.buildScratchSize, "Scratch Buffer");
-
-	vk::DeviceAddress scratchAddr = device.getBufferAddress({ .buffer = scratchBuffer.buffer });
+	//The last TLAS handed out by Build is only valid until the next one
+	asPool.Free(tlasStorage);
+	tlasStorage = asPool.Allocate(sizesInfo.accelerationStructureSize);
+	tlas		= asPool.CreateAccelerationStructure(tlasStorage, vk::AccelerationStructureTypeKHR::eTopLevel);
 
 	geomInfo.srcAccelerationStructure = nullptr;
 	geomInfo.dstAccelerationStructure = *tlas;
-	geomInfo.scratchData.deviceAddress = scratchAddr;
+	geomInfo.scratchData.deviceAddress = asPool.GetScratch(sizesInfo.buildScratchSize, scratchAlignment);
 
 	vk::AccelerationStructureBuildRangeInfoKHR rangeInfo;
 	rangeInfo.primitiveCount = instanceCount;
@@ -298,4 +476,55 @@ void VulkanBVHBuilder::BuildTLAS(vk::Device device, VmaAllocator allocator, vk::
 	vk::UniqueCommandBuffer cmdBuffer = CmdBufferCreateBegin(device, pool, "Making TLAS");
 	cmdBuffer->buildAccelerationStructuresKHR(1, &geomInfo, &rangeInfoPtr);
 	CmdBufferEndSubmitWait(*cmdBuffer, device, queue);
-}
\ No newline at end of file
+}
+
+uint32_t VulkanBVHBuilder::DefragmentBLAS(float maxOccupancy, BLASAddressRemap* remap) {
+	if (!storagePool) {
+		return 0;
+	}
+	uint32_t moved = 0;
+	std::vector<vk::UniqueAccelerationStructureKHR> originals;
+	std::vector<AccelerationStructureAllocation>	originalStorage;
+
+	//None of the sparse blocks can be a destination, so no copy ever reads
+	//what another copy in this batch writes, and they don't need ordering
+	std::vector<uint32_t> sparseBlocks = storagePool->GetSparseBlocks(maxOccupancy);
+
+	vk::UniqueCommandBuffer buffer = CmdBufferCreateBegin(sourceDevice, pool, "Defragmenting BLAS");
+	for (uint32_t block : sparseBlocks) {
+		for (BLASEntry& i : blasBuildInfo) {
+			if (i.storage.block != block) {
+				continue;
+			}
+			AccelerationStructureAllocation newStorage = storagePool->Allocate(i.storage.size, sparseBlocks);
+			if (!newStorage) {
+				continue;
+			}
+			vk::UniqueAccelerationStructureKHR newBLAS = storagePool->CreateAccelerationStructure(newStorage, vk::AccelerationStructureTypeKHR::eBottomLevel);
+			buffer->copyAccelerationStructureKHR({
+				.src	= *i.accelStructure,
+				.dst	= *newBLAS,
+				.mode	= vk::CopyAccelerationStructureModeKHR::eClone
+			});
+			if (remap) {
+				(*remap)[sourceDevice.getAccelerationStructureAddressKHR({ .accelerationStructure = *i.accelStructure })] =
+					sourceDevice.getAccelerationStructureAddressKHR({ .accelerationStructure = *newBLAS });
+			}
+			originals.push_back(std::move(i.accelStructure));
+			originalStorage.push_back(i.storage);
+			i.accelStructure	= std::move(newBLAS);
+			i.storage			= newStorage;
+			moved++;
+		}
+	}
+	CmdBufferEndSubmitWait(*buffer, sourceDevice, queue);
+	//Frames still in flight may be tracing TLASes that point at the originals
+	sourceDevice.waitIdle();
+
+	originals.clear();
+	for (AccelerationStructureAllocation& a : originalStorage) {
+		storagePool->Free(a);
+	}
+	storagePool->ReleaseEmptyBlocks();
+	return moved;
+}
@@ -8,7 +8,8 @@ License: MIT (see LICENSE file at the top of the source tree)
 #pragma once
 #include "../VulkanRendering/VulkanRenderer.h"
 #include "../VulkanRendering/VulkanBuffers.h"
-#include "VulkanBVHBuilder.h"
+#include "VulkanSceneAccelerationStructure.h"
+#include "VulkanAccelerationStructurePool.h"
 
 namespace NCL::Rendering::Vulkan {
 	struct VulkanBVHEntry {
@@ -19,7 +20,7 @@ namespace NCL::Rendering::Vulkan {
 	};
 					
 	struct BLASEntry {
-		VulkanBuffer buffer;
+		AccelerationStructureAllocation					storage;
 		vk::AccelerationStructureBuildGeometryInfoKHR	buildInfo;
 		vk::AccelerationStructureBuildSizesInfoKHR		sizeInfo;
 		vk::UniqueAccelerationStructureKHR				accelStructure;
@@ -29,6 +30,29 @@ namespace NCL::Rendering::Vulkan {
 		std::vector<uint32_t> maxPrims;
 	};
 
+	struct BLASMemoryStats {
+		vk::DeviceSize uncompactedBytes	= 0;	//What every BLAS would have taken at its full build size
+		vk::DeviceSize currentBytes		= 0;	//What they actually take up now
+	};
+
+	/*
+	VulkanBVHBuilder: Builds a BLAS for each unique mesh added, and a TLAS
+	holding every object. BLAS builds are recorded in batches, each a single
+	buildAccelerationStructuresKHR call with every build given its own slice
+	of scratch memory, so they run in parallel on the GPU; the scratch budget
+	decides how many fit in a batch. WithRenderer records them on the async
+	compute queue if it shares the graphics queue family, and on the graphics
+	queue otherwise, as the buffers it reads are exclusive to that family.
+
+	Every BLAS and TLAS is stored in an AccelerationStructurePool, which
+	also provides the scratch memory. If no pool is given, the builder makes
+	one of its own. A TLAS returned by Build is only valid until the next
+	call to Build.
+
+	WithCompaction adds a compaction pass after the builds: the compacted
+	size of each BLAS is queried, and it is copied into a tightly sized range
+	of the pool, after which the original is freed.
+	*/
 	class VulkanBVHBuilder	{
 	public:
 		VulkanBVHBuilder();
@@ -40,12 +64,39 @@ namespace NCL::Rendering::Vulkan {
 		VulkanBVHBuilder& WithAllocator(VmaAllocator inAllocator);
 		VulkanBVHBuilder& WithCommandQueue(vk::Queue inQueue);
 		VulkanBVHBuilder& WithCommandPool(vk::CommandPool inPool);
+		//Max scratch memory used at once. BLAS builds are batched into as few calls as fit within it
+		VulkanBVHBuilder& WithScratchBudget(vk::DeviceSize bytes);
+		//Uses the renderer's device, allocator, build queue, and the device's scratch alignment
+		VulkanBVHBuilder& WithRenderer(VulkanRenderer& renderer);
+		//The pool must outlive the builder
+		VulkanBVHBuilder& WithPool(AccelerationStructurePool* pool);
+		VulkanBVHBuilder& WithCompaction(AccelerationStructurePool* pool = nullptr);
 
 		vk::UniqueAccelerationStructureKHR Build(vk::BuildAccelerationStructureFlagsKHR flags, const std::string& debugName = "");
+
+		//Builds any new BLASes, and a persistent TLAS holding every object added, which can then be refit as objects move.
+		//The builder owns the BLASes, so must outlive the scene
+		std::unique_ptr<SceneAccelerationStructure> BuildScene(uint32_t maxInstances, uint32_t framesInFlight,
+			vk::BuildAccelerationStructureFlagsKHR flags = vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace, const std::string& debugName = "Scene TLAS");
+
+		vk::DeviceAddress GetBLASAddress(VulkanMesh* m) const;
+
+		const BLASMemoryStats& GetBLASMemoryStats() const {
+			return blasMemory;
+		}
+
+		//Moves BLASes out of pool blocks that are at most maxOccupancy full, and frees the emptied blocks.
+		//BLAS addresses change, so scenes from BuildScene must be given the remap via RemapBLAS, and
+		//updated, before they are traced again. Waits for the device to go idle. Returns how many moved
+		uint32_t DefragmentBLAS(float maxOccupancy = 0.25f, BLASAddressRemap* remap = nullptr);
 	protected:
 
 		void BuildBLAS(vk::Device device, VmaAllocator allocator, vk::BuildAccelerationStructureFlagsKHR flags);
 		void BuildTLAS(vk::Device device, VmaAllocator allocator, vk::BuildAccelerationStructureFlagsKHR flags);
+		vk::DeviceAddress GetBLASAddress(uint32_t meshID) const;
+		vk::DeviceSize AlignScratch(vk::DeviceSize size) const;
+		AccelerationStructurePool& GetPool();
+		void CompactBLAS(vk::Device device, VmaAllocator allocator, size_t firstNewBLAS, vk::QueryPool compactedSizeQueries);
 
 		vk::BuildAccelerationStructureFlagsKHR flags;
 
@@ -54,6 +105,7 @@ namespace NCL::Rendering::Vulkan {
 		std::vector<VulkanBVHEntry> entries;
 		std::vector<VulkanMesh*>	meshes;
 		std::vector<Matrix4>		transforms;
+		std::unique_ptr<AccelerationStructurePool> ownedPool; //Before the BLAS entries, so it is destroyed after them
 		std::vector< BLASEntry>		blasBuildInfo;
 
 		vk::Queue		queue;
@@ -61,7 +113,15 @@ namespace NCL::Rendering::Vulkan {
 		vk::Device		sourceDevice;
 		VmaAllocator	sourceAllocator;
 
+		vk::DeviceSize	scratchBudget;
+		vk::DeviceSize	scratchAlignment;
+
+		bool						compaction;
+		AccelerationStructurePool*	storagePool;
+		BLASMemoryStats				blasMemory;
+
 		vk::UniqueAccelerationStructureKHR	tlas;
-		VulkanBuffer						tlasBuffer;
+		AccelerationStructureAllocation		tlasStorage;
+		VulkanBuffer						instanceBuffer;
 	};
 }
\ No newline at end of file
@@ -0,0 +1,203 @@
+/******************************************************************************
+This file is part of the Newcastle Vulkan Tutorial Series
+
+Author:Rich Davison
+Contact:richgdavison@gmail.com
+License: MIT (see LICENSE file at the top of the source tree)
+*//////////////////////////////////////////////////////////////////////////////
+#include "VulkanBindlessHeap.h"
+#include "VulkanDescriptorSetLayoutBuilder.h"
+#include "VulkanTexture.h"
+#include "VulkanBuffers.h"
+#include "VulkanUtils.h"
+
+using namespace NCL;
+using namespace Rendering;
+using namespace Vulkan;
+
+BindlessHeap::BindlessHeap(vk::Device device, uint32_t maxImages, uint32_t maxBuffers, uint32_t maxSamplers, uint32_t inRetireFrames, const std::string& debugName) {
+	sourceDevice	= device;
+	retireFrames	= inRetireFrames;
+	currentFrame	= 0;
+
+	slots[BindlessBinding::SampledImages].capacity	= maxImages;
+	slots[BindlessBinding::StorageBuffers].capacity	= maxBuffers;
+	slots[BindlessBinding::Samplers].capacity		= maxSamplers;
+
+	//UpdateUnusedWhilePending lets slots be written while the set is in use by pending command buffers
+	vk::DescriptorBindingFlags bindingFlags =	vk::DescriptorBindingFlagBits::ePartiallyBound |
+												vk::DescriptorBindingFlagBits::eUpdateAfterBind |
+												vk::DescriptorBindingFlagBits::eUpdateUnusedWhilePending;
+
+	layout = DescriptorSetLayoutBuilder(device)
+		.WithSampledImages(BindlessBinding::SampledImages, maxImages, vk::ShaderStageFlagBits::eAll, bindingFlags)
+		.WithStorageBuffers(BindlessBinding::StorageBuffers, maxBuffers, vk::ShaderStageFlagBits::eAll, bindingFlags)
+		.WithSamplers(BindlessBinding::Samplers, maxSamplers, vk::ShaderStageFlagBits::eAll, bindingFlags)
+		.WithCreationFlags(vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPool)
+		.Build(debugName);
+
+	vk::DescriptorPoolSize poolSizes[] = {
+		{ .type = vk::DescriptorType::eSampledImage,	.descriptorCount = maxImages	},
+		{ .type = vk::DescriptorType::eStorageBuffer,	.descriptorCount = maxBuffers	},
+		{ .type = vk::DescriptorType::eSampler,			.descriptorCount = maxSamplers	},
+	};
+	pool = device.createDescriptorPoolUnique(
+		{
+			.flags			= vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind,
+			.maxSets		= 1,
+			.poolSizeCount	= BindlessBinding::MAX_SIZE,
+			.pPoolSizes		= poolSizes
+		}
+	);
+	vk::DescriptorSetLayout setLayout = *layout;
+	set = device.allocateDescriptorSets(
+		{
+			.descriptorPool		= *pool,
+			.descriptorSetCount = 1,
+			.pSetLayouts		= &setLayout
+		}
+	)[0];
+	if (!debugName.empty()) {
+		SetDebugName(device, vk::ObjectType::eDescriptorSet, GetVulkanHandle(set), debugName);
+	}
+}
+
+BindlessHeap::~BindlessHeap() {
+	//The set is freed along with the pool
+}
+
+uint32_t BindlessHeap::AllocateSlot(BindlessBinding::Type type) {
+	SlotList& list = slots[type];
+	uint32_t index = INVALID_INDEX;
+	if (!list.freeSlots.empty()) {
+		index = list.freeSlots.back();
+		list.freeSlots.pop_back();
+	}
+	else if (list.highWater < list.capacity) {
+		index = list.highWater++;
+	}
+	else {
+		std::cout << __FUNCTION__ << " bindless heap is out of slots for binding " << type << "!\n";
+		return INVALID_INDEX;
+	}
+	list.used++;
+	return index;
+}
+
+uint32_t BindlessHeap::AddTexture(const VulkanTexture& texture, vk::ImageLayout imageLayout) {
+	return AddImage(texture.GetDefaultView(), imageLayout);
+}
+
+uint32_t BindlessHeap::AddImage(vk::ImageView view, vk::ImageLayout imageLayout) {
+	uint32_t index = AllocateSlot(BindlessBinding::SampledImages);
+	if (index != INVALID_INDEX) {
+		WriteImage(index, view, imageLayout);
+	}
+	return index;
+}
+
+uint32_t BindlessHeap::AddBuffer(const VulkanBuffer& buffer, vk::DeviceSize offset, vk::DeviceSize range) {
+	return AddBuffer(buffer.buffer, offset, range);
+}
+
+uint32_t BindlessHeap::AddBuffer(vk::Buffer buffer, vk::DeviceSize offset, vk::DeviceSize range) {
+	uint32_t index = AllocateSlot(BindlessBinding::StorageBuffers);
+	if (index != INVALID_INDEX) {
+		WriteBuffer(index, buffer, offset, range);
+	}
+	return index;
+}
+
+uint32_t BindlessHeap::AddSampler(vk::Sampler sampler) {
+	uint32_t index = AllocateSlot(BindlessBinding::Samplers);
+	if (index != INVALID_INDEX) {
+		WriteSampler(index, sampler);
+	}
+	return index;
+}
+
+void BindlessHeap::UpdateImage(uint32_t index, vk::ImageView view, vk::ImageLayout imageLayout) {
+	assert(index < slots[BindlessBinding::SampledImages].highWater);
+	WriteImage(index, view, imageLayout);
+}
+
+void BindlessHeap::UpdateBuffer(uint32_t index, vk::Buffer buffer, vk::DeviceSize offset, vk::DeviceSize range) {
+	assert(index < slots[BindlessBinding::StorageBuffers].highWater);
+	WriteBuffer(index, buffer, offset, range);
+}
+
+void BindlessHeap::UpdateSampler(uint32_t index, vk::Sampler sampler) {
+	assert(index < slots[BindlessBinding::Samplers].highWater);
+	WriteSampler(index, sampler);
+}
+
+void BindlessHeap::Remove(BindlessBinding::Type type, uint32_t index) {
+	if (index == INVALID_INDEX) {
+		return;
+	}
+	assert(index < slots[type].highWater);
+	//The descriptor is left as it is, as partially bound sets don't need it cleared
+	retiredSlots.push_back({ type, index, currentFrame });
+	slots[type].used--;
+}
+
+void BindlessHeap::NextFrame() {
+	currentFrame++;
+	while (!retiredSlots.empty() && currentFrame - retiredSlots.front().frame >= retireFrames) {
+		const RetiredSlot& slot = retiredSlots.front();
+		slots[slot.type].freeSlots.push_back(slot.index);
+		retiredSlots.pop_front();
+	}
+}
+
+void BindlessHeap::Bind(vk::CommandBuffer cmdBuffer, vk::PipelineBindPoint bindPoint, vk::PipelineLayout pipeLayout, uint32_t setIndex) const {
+	cmdBuffer.bindDescriptorSets(bindPoint, pipeLayout, setIndex, 1, &set, 0, nullptr);
+}
+
+void BindlessHeap::WriteImage(uint32_t index, vk::ImageView view, vk::ImageLayout imageLayout) {
+	vk::DescriptorImageInfo imageInfo = {
+		.imageView		= view,
+		.imageLayout	= imageLayout
+	};
+	vk::WriteDescriptorSet descriptorWrite = {
+		.dstSet				= set,
+		.dstBinding			= BindlessBinding::SampledImages,
+		.dstArrayElement	= index,
+		.descriptorCount	= 1,
+		.descriptorType		= vk::DescriptorType::eSampledImage,
+		.pImageInfo			= &imageInfo
+	};
+	sourceDevice.updateDescriptorSets(1, &descriptorWrite, 0, nullptr);
+}
+
+void BindlessHeap::WriteBuffer(uint32_t index, vk::Buffer buffer, vk::DeviceSize offset, vk::DeviceSize range) {
+	vk::DescriptorBufferInfo bufferInfo = {
+		.buffer = buffer,
+		.offset = offset,
+		.range	= range
+	};
+	vk::WriteDescriptorSet descriptorWrite = {
+		.dstSet				= set,
+		.dstBinding			= BindlessBinding::StorageBuffers,
+		.dstArrayElement	= index,
+		.descriptorCount	= 1,
+		.descriptorType		= vk::DescriptorType::eStorageBuffer,
+		.pBufferInfo		= &bufferInfo
+	};
+	sourceDevice.updateDescriptorSets(1, &descriptorWrite, 0, nullptr);
+}
+
+void BindlessHeap::WriteSampler(uint32_t index, vk::Sampler sampler) {
+	vk::DescriptorImageInfo samplerInfo = {
+		.sampler = sampler
+	};
+	vk::WriteDescriptorSet descriptorWrite = {
+		.dstSet				= set,
+		.dstBinding			= BindlessBinding::Samplers,
+		.dstArrayElement	= index,
+		.descriptorCount	= 1,
+		.descriptorType		= vk::DescriptorType::eSampler,
+		.pImageInfo			= &samplerInfo
+	};
+	sourceDevice.updateDescriptorSets(1, &descriptorWrite, 0, nullptr);
+}
@@ -0,0 +1,118 @@
+/******************************************************************************
+This file is part of the Newcastle Vulkan Tutorial Series
+
+Author:Rich Davison
+Contact:richgdavison@gmail.com
+License: MIT (see LICENSE file at the top of the source tree)
+*//////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include <deque>
+
+namespace NCL::Rendering::Vulkan {
+	class VulkanTexture;
+	struct VulkanBuffer;
+
+	namespace BindlessBinding {
+		enum Type : uint32_t {
+			SampledImages,
+			StorageBuffers,
+			Samplers,
+			MAX_SIZE
+		};
+	}
+
+	/*
+	BindlessHeap: A single large descriptor set holding arrays of sampled
+	images, storage buffers and samplers, which shaders index directly:
+
+	layout(set = N, binding = 0) uniform texture2D	textures[];
+	layout(set = N, binding = 1) buffer				Buffers { ... } buffers[];
+	layout(set = N, binding = 2) uniform sampler	samplers[];
+
+	Each resource added gets a slot in the matching array, and the index it
+	is given stays the same until it is removed, so it can be stored in
+	materials or per instance data, and the set only ever needs binding
+	once per command buffer.
+
+	The set is update-after-bind and partially bound, so slots can be
+	written while the set is bound in command buffers still in flight, and
+	unused slots don't need to hold valid descriptors. Removed slots aren't
+	reused until NextFrame has been called retireFrames times, so a slot
+	that the GPU could still be reading is never overwritten.
+
+	Requires the descriptorIndexing features runtimeDescriptorArray,
+	descriptorBindingPartiallyBound, descriptorBindingUpdateUnusedWhilePending,
+	the UpdateAfterBind features for sampled images, storage buffers and
+	samplers, and the non-uniform
+	indexing features for any array a shader indexes divergently.
+	Not thread safe.
+	*/
+	class BindlessHeap	{
+	public:
+		static const uint32_t INVALID_INDEX = ~0u;
+
+		BindlessHeap(vk::Device device, uint32_t maxImages = 16384, uint32_t maxBuffers = 16384, uint32_t maxSamplers = 256,
+			uint32_t retireFrames = 3, const std::string& debugName = "Bindless Heap");
+		~BindlessHeap();
+
+		uint32_t	AddTexture(const VulkanTexture& texture, vk::ImageLayout layout = vk::ImageLayout::eShaderReadOnlyOptimal);
+		uint32_t	AddImage(vk::ImageView view, vk::ImageLayout layout = vk::ImageLayout::eShaderReadOnlyOptimal);
+		uint32_t	AddBuffer(const VulkanBuffer& buffer, vk::DeviceSize offset = 0, vk::DeviceSize range = VK_WHOLE_SIZE);
+		uint32_t	AddBuffer(vk::Buffer buffer, vk::DeviceSize offset = 0, vk::DeviceSize range = VK_WHOLE_SIZE);
+		uint32_t	AddSampler(vk::Sampler sampler);
+
+		//Replaces what a slot points to, keeping its index
+		void		UpdateImage(uint32_t index, vk::ImageView view, vk::ImageLayout layout = vk::ImageLayout::eShaderReadOnlyOptimal);
+		void		UpdateBuffer(uint32_t index, vk::Buffer buffer, vk::DeviceSize offset = 0, vk::DeviceSize range = VK_WHOLE_SIZE);
+		void		UpdateSampler(uint32_t index, vk::Sampler sampler);
+
+		void		Remove(BindlessBinding::Type type, uint32_t index);
+
+		//Call once per frame, so removed slots can eventually be reused
+		void		NextFrame();
+
+		void		Bind(vk::CommandBuffer cmdBuffer, vk::PipelineBindPoint bindPoint, vk::PipelineLayout layout, uint32_t setIndex) const;
+
+		vk::DescriptorSetLayout GetLayout() const {
+			return *layout;
+		}
+		vk::DescriptorSet		GetSet() const {
+			return set;
+		}
+		uint32_t	GetUsedCount(BindlessBinding::Type type) const {
+			return slots[type].used;
+		}
+		uint32_t	GetCapacity(BindlessBinding::Type type) const {
+			return slots[type].capacity;
+		}
+
+	protected:
+		struct SlotList {
+			uint32_t				capacity	= 0;
+			uint32_t				highWater	= 0;	//Slots above this have never been used
+			uint32_t				used		= 0;
+			std::vector<uint32_t>	freeSlots;
+		};
+		struct RetiredSlot {
+			BindlessBinding::Type	type;
+			uint32_t				index;
+			uint64_t				frame;
+		};
+
+		uint32_t	AllocateSlot(BindlessBinding::Type type);
+		void		WriteImage(uint32_t index, vk::ImageView view, vk::ImageLayout layout);
+		void		WriteBuffer(uint32_t index, vk::Buffer buffer, vk::DeviceSize offset, vk::DeviceSize range);
+		void		WriteSampler(uint32_t index, vk::Sampler sampler);
+
+		vk::Device		sourceDevice;
+
+		vk::UniqueDescriptorSetLayout	layout;
+		vk::UniqueDescriptorPool		pool;
+		vk::DescriptorSet				set;
+
+		SlotList				slots[BindlessBinding::MAX_SIZE];
+		std::deque<RetiredSlot>	retiredSlots;
+		uint64_t				currentFrame;
+		uint32_t				retireFrames;
+	};
+}
@@ -0,0 +1,251 @@
+/******************************************************************************
+This file is part of the Newcastle Vulkan Tutorial Series
+
+Author:Rich Davison
+Contact:richgdavison@gmail.com
+License: MIT (see LICENSE file at the top of the source tree)
+*//////////////////////////////////////////////////////////////////////////////
+#include "VulkanCommandEncoder.h"
+#include <algorithm>
+
+using namespace NCL;
+using namespace Rendering;
+using namespace Vulkan;
+
+uint32_t CommandEncoderStats::TotalIssued() const {
+	uint32_t total = 0;
+	for (uint32_t i = 0; i < EncodedCommand::MAX_SIZE; ++i) {
+		total += issued[i];
+	}
+	return total;
+}
+
+uint32_t CommandEncoderStats::TotalElided() const {
+	uint32_t total = 0;
+	for (uint32_t i = 0; i < EncodedCommand::MAX_SIZE; ++i) {
+		total += elided[i];
+	}
+	return total;
+}
+
+CommandEncoderStats& CommandEncoderStats::operator+=(const CommandEncoderStats& other) {
+	for (uint32_t i = 0; i < EncodedCommand::MAX_SIZE; ++i) {
+		issued[i] += other.issued[i];
+		elided[i] += other.elided[i];
+	}
+	drawCalls += other.drawCalls;
+	return *this;
+}
+
+CommandEncoder::CommandEncoder(vk::CommandBuffer inBuffer) {
+	Begin(inBuffer);
+}
+
+void CommandEncoder::Begin(vk::CommandBuffer inBuffer) {
+	buffer = inBuffer;
+	Invalidate();
+}
+
+void CommandEncoder::Invalidate() {
+	graphicsState	= {};
+	computeState	= {};
+	rayTracingState = {};
+
+	for (uint32_t i = 0; i < MAX_VERTEX_BUFFERS; ++i) {
+		vertexBuffers[i] = nullptr;
+		vertexOffsets[i] = 0;
+	}
+	indexBuffer = nullptr;
+	indexOffset = 0;
+	indexType	= vk::IndexType::eUint32;
+
+	pushLayout = nullptr;
+	pushValid.reset();
+
+	viewportValid.reset();
+	scissorValid.reset();
+}
+
+CommandEncoder::BindPointState& CommandEncoder::GetBindPointState(vk::PipelineBindPoint bindPoint) {
+	if (bindPoint == vk::PipelineBindPoint::eCompute) {
+		return computeState;
+	}
+	if (bindPoint == vk::PipelineBindPoint::eRayTracingKHR) {
+		return rayTracingState;
+	}
+	return graphicsState;
+}
+
+void CommandEncoder::BindPipeline(vk::PipelineBindPoint bindPoint, vk::Pipeline pipeline) {
+	BindPointState& state = GetBindPointState(bindPoint);
+	if (state.pipeline == pipeline) {
+		Elided(EncodedCommand::Pipeline);
+		return;
+	}
+	buffer.bindPipeline(bindPoint, pipeline);
+	state.pipeline = pipeline;
+	Issued(EncodedCommand::Pipeline);
+}
+
+void CommandEncoder::BindDescriptorSets(vk::PipelineBindPoint bindPoint, vk::PipelineLayout layout, uint32_t firstSet, uint32_t setCount, const vk::DescriptorSet* sets,
+	uint32_t dynamicOffsetCount, const uint32_t* dynamicOffsets) {
+	assert(firstSet + setCount <= MAX_DESCRIPTOR_SETS);
+	BindPointState& state = GetBindPointState(bindPoint);
+
+	//A different layout may disturb any of the sets, so nothing can be assumed about them
+	if (state.setLayout != layout) {
+		for (uint32_t i = 0; i < MAX_DESCRIPTOR_SETS; ++i) {
+			state.sets[i] = nullptr;
+		}
+		state.setLayout = layout;
+	}
+
+	if (dynamicOffsetCount > 0) {
+		buffer.bindDescriptorSets(bindPoint, layout, firstSet, setCount, sets, dynamicOffsetCount, dynamicOffsets);
+		//The offsets aren't tracked, so these sets are always rebound next time
+		for (uint32_t i = 0; i < setCount; ++i) {
+			state.sets[firstSet + i] = nullptr;
+		}
+		Issued(EncodedCommand::DescriptorSets);
+		return;
+	}
+
+	uint32_t firstChanged	= ~0u;
+	uint32_t lastChanged	= 0;
+	for (uint32_t i = 0; i < setCount; ++i) {
+		if (!state.sets[firstSet + i] || state.sets[firstSet + i] != sets[i]) {
+			firstChanged	= std::min(firstChanged, i);
+			lastChanged		= i;
+		}
+	}
+	if (firstChanged == ~0u) {
+		Elided(EncodedCommand::DescriptorSets);
+		return;
+	}
+	uint32_t changedCount = lastChanged - firstChanged + 1;
+	buffer.bindDescriptorSets(bindPoint, layout, firstSet + firstChanged, changedCount, &sets[firstChanged], 0, nullptr);
+	for (uint32_t i = firstChanged; i <= lastChanged; ++i) {
+		state.sets[firstSet + i] = sets[i];
+	}
+	Issued(EncodedCommand::DescriptorSets);
+}
+
+void CommandEncoder::BindVertexBuffers(uint32_t firstBinding, uint32_t bindingCount, const vk::Buffer* buffers, const vk::DeviceSize* offsets) {
+	assert(firstBinding + bindingCount <= MAX_VERTEX_BUFFERS);
+	uint32_t firstChanged	= ~0u;
+	uint32_t lastChanged	= 0;
+	for (uint32_t i = 0; i < bindingCount; ++i) {
+		uint32_t slot = firstBinding + i;
+		if (!vertexBuffers[slot] || vertexBuffers[slot] != buffers[i] || vertexOffsets[slot] != offsets[i]) {
+			firstChanged	= std::min(firstChanged, i);
+			lastChanged		= i;
+		}
+	}
+	if (firstChanged == ~0u) {
+		Elided(EncodedCommand::VertexBuffers);
+		return;
+	}
+	uint32_t changedCount = lastChanged - firstChanged + 1;
+	buffer.bindVertexBuffers(firstBinding + firstChanged, changedCount, &buffers[firstChanged], &offsets[firstChanged]);
+	for (uint32_t i = firstChanged; i <= lastChanged; ++i) {
+		vertexBuffers[firstBinding + i] = buffers[i];
+		vertexOffsets[firstBinding + i] = offsets[i];
+	}
+	Issued(EncodedCommand::VertexBuffers);
+}
+
+void CommandEncoder::BindIndexBuffer(vk::Buffer inBuffer, vk::DeviceSize offset, vk::IndexType type) {
+	if (indexBuffer && indexBuffer == inBuffer && indexOffset == offset && indexType == type) {
+		Elided(EncodedCommand::IndexBuffer);
+		return;
+	}
+	buffer.bindIndexBuffer(inBuffer, offset, type);
+	indexBuffer = inBuffer;
+	indexOffset = offset;
+	indexType	= type;
+	Issued(EncodedCommand::IndexBuffer);
+}
+
+void CommandEncoder::PushConstants(vk::PipelineLayout layout, vk::ShaderStageFlags stages, uint32_t offset, uint32_t size, const void* data) {
+	if (offset + size > MAX_PUSH_CONSTANTS) {
+		//Too big to shadow, so just send it
+		buffer.pushConstants(layout, stages, offset, size, data);
+		Issued(EncodedCommand::PushConstants);
+		return;
+	}
+	if (pushLayout != layout) {
+		pushValid.reset();
+		pushLayout = layout;
+	}
+	bool redundant = memcmp(&pushData[offset], data, size) == 0;
+	for (uint32_t i = offset; redundant && i < offset + size; ++i) {
+		redundant = pushValid[i] && pushStages[i] == stages;
+	}
+	if (redundant) {
+		Elided(EncodedCommand::PushConstants);
+		return;
+	}
+	buffer.pushConstants(layout, stages, offset, size, data);
+	memcpy(&pushData[offset], data, size);
+	for (uint32_t i = offset; i < offset + size; ++i) {
+		pushValid[i]	= true;
+		pushStages[i]	= stages;
+	}
+	Issued(EncodedCommand::PushConstants);
+}
+
+void CommandEncoder::SetViewport(uint32_t index, const vk::Viewport& viewport) {
+	if (index < MAX_VIEWPORTS && viewportValid[index] && viewports[index] == viewport) {
+		Elided(EncodedCommand::Viewport);
+		return;
+	}
+	buffer.setViewport(index, 1, &viewport);
+	if (index < MAX_VIEWPORTS) {
+		viewports[index] = viewport;
+		viewportValid[index] = true;
+	}
+	Issued(EncodedCommand::Viewport);
+}
+
+void CommandEncoder::SetScissor(uint32_t index, const vk::Rect2D& scissor) {
+	if (index < MAX_VIEWPORTS && scissorValid[index] && scissors[index] == scissor) {
+		Elided(EncodedCommand::Scissor);
+		return;
+	}
+	buffer.setScissor(index, 1, &scissor);
+	if (index < MAX_VIEWPORTS) {
+		scissors[index] = scissor;
+		scissorValid[index] = true;
+	}
+	Issued(EncodedCommand::Scissor);
+}
+
+void CommandEncoder::Draw(uint32_t vertexCount, uint32_t instanceCount, uint32_t firstVertex, uint32_t firstInstance) {
+	buffer.draw(vertexCount, instanceCount, firstVertex, firstInstance);
+	stats.drawCalls++;
+}
+
+void CommandEncoder::DrawIndexed(uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex, int32_t vertexOffset, uint32_t firstInstance) {
+	buffer.drawIndexed(indexCount, instanceCount, firstIndex, vertexOffset, firstInstance);
+	stats.drawCalls++;
+}
+
+void CommandEncoder::DrawIndirect(vk::Buffer argBuffer, vk::DeviceSize offset, uint32_t drawCount, uint32_t stride) {
+	buffer.drawIndirect(argBuffer, offset, drawCount, stride);
+	stats.drawCalls++;
+}
+
+void CommandEncoder::DrawIndexedIndirect(vk::Buffer argBuffer, vk::DeviceSize offset, uint32_t drawCount, uint32_t stride) {
+	buffer.drawIndexedIndirect(argBuffer, offset, drawCount, stride);
+	stats.drawCalls++;
+}
+
+void CommandEncoder::DrawMeshTasks(uint32_t x, uint32_t y, uint32_t z) {
+	buffer.drawMeshTasksEXT(x, y, z);
+	stats.drawCalls++;
+}
+
+void CommandEncoder::Dispatch(uint32_t x, uint32_t y, uint32_t z) {
+	buffer.dispatch(x, y, z);
+	stats.drawCalls++;
+}
@@ -0,0 +1,145 @@
+/******************************************************************************
+This file is part of the Newcastle Vulkan Tutorial Series
+
+Author:Rich Davison
+Contact:richgdavison@gmail.com
+License: MIT (see LICENSE file at the top of the source tree)
+*//////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include <bitset>
+
+namespace NCL::Rendering::Vulkan {
+	namespace EncodedCommand {
+		enum Type : uint32_t {
+			Pipeline,
+			DescriptorSets,
+			VertexBuffers,
+			IndexBuffer,
+			PushConstants,
+			Viewport,
+			Scissor,
+			MAX_SIZE
+		};
+	}
+
+	struct CommandEncoderStats {
+		uint32_t issued[EncodedCommand::MAX_SIZE]	= {};
+		uint32_t elided[EncodedCommand::MAX_SIZE]	= {};
+		uint32_t drawCalls							= 0;
+
+		uint32_t TotalIssued() const;
+		uint32_t TotalElided() const;
+
+		CommandEncoderStats& operator+=(const CommandEncoderStats& other);
+	};
+
+	/*
+	CommandEncoder: A thin wrapper around a vk::CommandBuffer that remembers
+	which pipeline, descriptor sets, vertex and index buffers, push constants,
+	viewport and scissor are currently bound, and drops any call that would
+	set the state to what it already is. Partially redundant descriptor set
+	and vertex buffer binds are trimmed down to just the slots that change.
+
+	Tracking is conservative: sets and push constants are forgotten when the
+	pipeline layout changes, and sets bound with dynamic offsets are always
+	rebound. Viewport and scissor are assumed to be dynamic state, as they
+	are in pipelines from PipelineBuilder. If the command buffer is recorded
+	into directly, or secondary command buffers are executed, call
+	Invalidate so nothing is wrongly skipped afterwards.
+
+	The stats count issued and elided calls, and should be read and reset
+	once per frame.
+	*/
+	class CommandEncoder	{
+	public:
+		static const uint32_t MAX_DESCRIPTOR_SETS	= 16;
+		static const uint32_t MAX_VERTEX_BUFFERS	= 16;
+		static const uint32_t MAX_PUSH_CONSTANTS	= 256;
+		static const uint32_t MAX_VIEWPORTS			= 4;
+
+		CommandEncoder(vk::CommandBuffer buffer = {});
+		~CommandEncoder() {}
+
+		//Starts tracking a new command buffer, forgetting all bound state
+		void Begin(vk::CommandBuffer buffer);
+		void Invalidate();
+
+		void BindPipeline(vk::PipelineBindPoint bindPoint, vk::Pipeline pipeline);
+
+		void BindDescriptorSets(vk::PipelineBindPoint bindPoint, vk::PipelineLayout layout, uint32_t firstSet, uint32_t setCount, const vk::DescriptorSet* sets,
+			uint32_t dynamicOffsetCount = 0, const uint32_t* dynamicOffsets = nullptr);
+		void BindDescriptorSet(vk::PipelineBindPoint bindPoint, vk::PipelineLayout layout, uint32_t setIndex, vk::DescriptorSet set) {
+			BindDescriptorSets(bindPoint, layout, setIndex, 1, &set);
+		}
+
+		void BindVertexBuffers(uint32_t firstBinding, uint32_t bindingCount, const vk::Buffer* buffers, const vk::DeviceSize* offsets);
+		void BindIndexBuffer(vk::Buffer buffer, vk::DeviceSize offset, vk::IndexType type);
+
+		void PushConstants(vk::PipelineLayout layout, vk::ShaderStageFlags stages, uint32_t offset, uint32_t size, const void* data);
+
+		void SetViewport(uint32_t index, const vk::Viewport& viewport);
+		void SetScissor(uint32_t index, const vk::Rect2D& scissor);
+
+		//Draws and dispatches go straight through, and are only counted
+		void Draw(uint32_t vertexCount, uint32_t instanceCount, uint32_t firstVertex, uint32_t firstInstance);
+		void DrawIndexed(uint32_t indexCount, uint32_t instanceCount, uint32_t firstIndex, int32_t vertexOffset, uint32_t firstInstance);
+		void DrawIndirect(vk::Buffer buffer, vk::DeviceSize offset, uint32_t drawCount, uint32_t stride);
+		void DrawIndexedIndirect(vk::Buffer buffer, vk::DeviceSize offset, uint32_t drawCount, uint32_t stride);
+		void DrawMeshTasks(uint32_t x, uint32_t y, uint32_t z);
+		void Dispatch(uint32_t x, uint32_t y, uint32_t z);
+
+		vk::CommandBuffer GetCommandBuffer() const {
+			return buffer;
+		}
+		operator vk::CommandBuffer() const {
+			return buffer;
+		}
+
+		const CommandEncoderStats& GetStats() const {
+			return stats;
+		}
+		void ResetStats() {
+			stats = {};
+		}
+
+	protected:
+		struct BindPointState {
+			vk::Pipeline		pipeline;
+			vk::PipelineLayout	setLayout;
+			vk::DescriptorSet	sets[MAX_DESCRIPTOR_SETS];
+		};
+
+		BindPointState& GetBindPointState(vk::PipelineBindPoint bindPoint);
+
+		void Issued(EncodedCommand::Type type) {
+			stats.issued[type]++;
+		}
+		void Elided(EncodedCommand::Type type) {
+			stats.elided[type]++;
+		}
+
+		vk::CommandBuffer	buffer;
+		CommandEncoderStats	stats;
+
+		BindPointState		graphicsState;
+		BindPointState		computeState;
+		BindPointState		rayTracingState;
+
+		vk::Buffer			vertexBuffers[MAX_VERTEX_BUFFERS];
+		vk::DeviceSize		vertexOffsets[MAX_VERTEX_BUFFERS];
+
+		vk::Buffer			indexBuffer;
+		vk::DeviceSize		indexOffset;
+		vk::IndexType		indexType;
+
+		vk::PipelineLayout				pushLayout;
+		char							pushData[MAX_PUSH_CONSTANTS];
+		vk::ShaderStageFlags			pushStages[MAX_PUSH_CONSTANTS];
+		std::bitset<MAX_PUSH_CONSTANTS>	pushValid;
+
+		vk::Viewport		viewports[MAX_VIEWPORTS];
+		vk::Rect2D			scissors[MAX_VIEWPORTS];
+		std::bitset<MAX_VIEWPORTS>	viewportValid;
+		std::bitset<MAX_VIEWPORTS>	scissorValid;
+	};
+}
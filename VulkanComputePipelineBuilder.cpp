@@ -34,17 +34,26 @@ ComputePipelineBuilder& ComputePipelineBuilder::WithShader(const VulkanCompute&
 VulkanPipeline	ComputePipelineBuilder::Build(const std::string& debugName, vk::PipelineCache cache) {
 	VulkanPipeline output;
 
+	if (!cache) {
+		cache = GetDefaultPipelineCache(sourceDevice);
+	}
+
 	FinaliseDescriptorLayouts();
 
-	vk::PipelineLayoutCreateInfo pipeLayoutCreate = vk::PipelineLayoutCreateInfo()
-		.setSetLayoutCount((uint32_t)allLayouts.size())
-		.setPSetLayouts(allLayouts.data())
-		.setPPushConstantRanges(allPushConstants.data())
-		.setPushConstantRangeCount((uint32_t)allPushConstants.size());
+	if (layout) {
+		pipelineCreate.setLayout(layout);
+	}
+	else {
+		vk::PipelineLayoutCreateInfo pipeLayoutCreate = vk::PipelineLayoutCreateInfo()
+			.setSetLayoutCount((uint32_t)allLayouts.size())
+			.setPSetLayouts(allLayouts.data())
+			.setPPushConstantRanges(allPushConstants.data())
+			.setPushConstantRangeCount((uint32_t)allPushConstants.size());
 
-	output.layout = sourceDevice.createPipelineLayoutUnique(pipeLayoutCreate);
+		output.layout = sourceDevice.createPipelineLayoutUnique(pipeLayoutCreate);
 
-	pipelineCreate.setLayout(*output.layout);
+		pipelineCreate.setLayout(*output.layout);
+	}
 
 	output.pipeline = sourceDevice.createComputePipelineUnique(cache, pipelineCreate).value;
 
@@ -28,5 +28,6 @@ namespace NCL::Rendering::Vulkan {
 		VulkanPipeline	Build(const std::string& debugName = "", vk::PipelineCache cache = {});
 
 	protected:
+		friend class PipelineRegistry;
 	};
 };
\ No newline at end of file
@@ -0,0 +1,187 @@
+/******************************************************************************
+This file is part of the Newcastle Vulkan Tutorial Series
+
+Author:Rich Davison
+Contact:richgdavison@gmail.com
+License: MIT (see LICENSE file at the top of the source tree)
+*//////////////////////////////////////////////////////////////////////////////
+#include "VulkanDescriptorAllocator.h"
+#include "VulkanDescriptorSetLayoutCache.h"
+#include "VulkanUtils.h"
+#include <cmath>
+
+using namespace NCL;
+using namespace Rendering;
+using namespace Vulkan;
+
+const uint32_t MAX_SETS_PER_POOL = 4096;
+
+//Used for every pool until there's some usage to go on
+const vk::DescriptorType defaultPoolTypes[] = {
+	vk::DescriptorType::eUniformBuffer,
+	vk::DescriptorType::eStorageBuffer,
+	vk::DescriptorType::eUniformBufferDynamic,
+	vk::DescriptorType::eStorageBufferDynamic,
+	vk::DescriptorType::eCombinedImageSampler,
+	vk::DescriptorType::eSampledImage,
+	vk::DescriptorType::eStorageImage,
+};
+
+DescriptorAllocator::DescriptorAllocator(vk::Device device, bool inPersistent, uint32_t initialSetsPerPool, const std::string& inDebugName) {
+	sourceDevice	= device;
+	persistent		= inPersistent;
+	debugName		= inDebugName;
+	setsPerPool		= std::max(initialSetsPerPool, 1u);
+	nextPoolSets	= setsPerPool;
+}
+
+DescriptorAllocator::~DescriptorAllocator() {
+	for (vk::DescriptorPool pool : fullPools) {
+		sourceDevice.destroyDescriptorPool(pool);
+	}
+	if (currentPool) {
+		sourceDevice.destroyDescriptorPool(currentPool);
+	}
+}
+
+vk::DescriptorSet DescriptorAllocator::Allocate(vk::DescriptorSetLayout layout, uint32_t variableDescriptorCount) {
+	return AllocateFromPools(layout, variableDescriptorCount);
+}
+
+vk::UniqueDescriptorSet DescriptorAllocator::AllocateUnique(vk::DescriptorSetLayout layout, uint32_t variableDescriptorCount) {
+	if (!MessageAssert(persistent, "Only persistent descriptor allocators can free individual sets!")) {
+		return {};
+	}
+	vk::DescriptorSet set = AllocateFromPools(layout, variableDescriptorCount);
+	if (!set) {
+		return {};
+	}
+	//Each set is freed back to whichever pool in the chain it came from
+	return vk::UniqueDescriptorSet(set, vk::PoolFree<vk::Device, vk::DescriptorPool, VULKAN_HPP_DEFAULT_DISPATCHER_TYPE>(sourceDevice, currentPool));
+}
+
+vk::Result DescriptorAllocator::TryAllocate(vk::DescriptorPool pool, vk::DescriptorSetLayout layout, uint32_t variableDescriptorCount, vk::DescriptorSet& set) {
+	vk::DescriptorSetAllocateInfo allocateInfo = {
+		.descriptorPool		= pool,
+		.descriptorSetCount = 1,
+		.pSetLayouts		= &layout
+	};
+	vk::DescriptorSetVariableDescriptorCountAllocateInfo variableDescriptorInfo;
+	if (variableDescriptorCount > 0) {
+		variableDescriptorInfo.setDescriptorSetCount(1).setPDescriptorCounts(&variableDescriptorCount);
+		allocateInfo.setPNext(&variableDescriptorInfo);
+	}
+	//The non-throwing overload, as running out of pool space is expected here
+	return sourceDevice.allocateDescriptorSets(&allocateInfo, &set);
+}
+
+vk::DescriptorSet DescriptorAllocator::AllocateFromPools(vk::DescriptorSetLayout layout, uint32_t variableDescriptorCount) {
+	RecordUsage(layout);
+
+	vk::DescriptorSet set;
+	if (currentPool && TryAllocate(currentPool, layout, variableDescriptorCount, set) == vk::Result::eSuccess) {
+		stats.setsAllocated++;
+		stats.totalSetsAllocated++;
+		return set;
+	}
+	if (currentPool) {
+		stats.poolOverflows++;
+		fullPools.push_back(currentPool);
+		nextPoolSets = std::min(nextPoolSets * 2, MAX_SETS_PER_POOL);
+	}
+	currentPool = CreatePool(nextPoolSets);
+
+	vk::Result result = TryAllocate(currentPool, layout, variableDescriptorCount, set);
+	if (result != vk::Result::eSuccess) {
+		std::cout << __FUNCTION__ << " allocator " << debugName << " can't allocate a set even from a new pool: " << vk::to_string(result) << "\n";
+		return {};
+	}
+	stats.setsAllocated++;
+	stats.totalSetsAllocated++;
+	return set;
+}
+
+void DescriptorAllocator::RecordUsage(vk::DescriptorSetLayout layout) {
+	DescriptorSetLayoutCache* cache = GetDescriptorSetLayoutCache(sourceDevice);
+	if (!cache || !cache->GetDescriptorCounts(layout, layoutSizes)) {
+		uncachedLayoutUsed = true;
+		return;
+	}
+	for (const vk::DescriptorPoolSize& s : layoutSizes) {
+		observedTypes[s.type] += s.descriptorCount;
+	}
+}
+
+vk::DescriptorPool DescriptorAllocator::CreatePool(uint32_t setCount) {
+	std::map<vk::DescriptorType, uint32_t> typeCounts;
+	if (typeRatios.empty() || uncachedLayoutUsed) {
+		for (vk::DescriptorType type : defaultPoolTypes) {
+			typeCounts[type] = setCount;
+		}
+	}
+	for (const auto& [type, ratio] : typeRatios) {
+		typeCounts[type] = std::max(typeCounts[type], std::max((uint32_t)std::ceil(ratio * setCount), 1u));
+	}
+	//Makes sure there's room for anything seen so far this frame, too
+	for (const auto& [type, count] : observedTypes) {
+		typeCounts[type] = std::max(typeCounts[type], std::min(count, setCount));
+	}
+
+	std::vector<vk::DescriptorPoolSize> poolSizes;
+	for (const auto& [type, count] : typeCounts) {
+		poolSizes.push_back({ .type = type, .descriptorCount = count });
+	}
+
+	vk::DescriptorPoolCreateInfo poolCreate;
+	poolCreate.setPoolSizes(poolSizes);
+	poolCreate.setMaxSets(setCount);
+	if (persistent) {
+		poolCreate.setFlags(vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet);
+	}
+	vk::DescriptorPool pool = sourceDevice.createDescriptorPool(poolCreate);
+	if (!debugName.empty()) {
+		SetDebugName(sourceDevice, vk::ObjectType::eDescriptorPool, GetVulkanHandle(pool), debugName);
+	}
+	stats.poolsCreated++;
+	stats.poolCount++;
+	return pool;
+}
+
+void DescriptorAllocator::Reset() {
+	if (!MessageAssert(!persistent, "Persistent descriptor allocators can't be reset!")) {
+		return;
+	}
+	uint32_t usedSets = stats.setsAllocated;
+
+	//Learn how big each set tends to be, leaving a little headroom
+	if (uncachedLayoutUsed) {
+		typeRatios.clear();
+	}
+	else if (usedSets > 0 && !observedTypes.empty()) {
+		typeRatios.clear();
+		for (const auto& [type, count] : observedTypes) {
+			typeRatios[type] = (count * 1.25f) / usedSets;
+		}
+	}
+	//If this frame overflowed, the next one starts with a pool that would have fitted it
+	if (!fullPools.empty()) {
+		setsPerPool = std::min(std::max(setsPerPool, usedSets + usedSets / 4), MAX_SETS_PER_POOL);
+
+		for (vk::DescriptorPool pool : fullPools) {
+			sourceDevice.destroyDescriptorPool(pool);
+		}
+		sourceDevice.destroyDescriptorPool(currentPool);
+		stats.poolCount -= (uint32_t)fullPools.size() + 1;
+		fullPools.clear();
+		currentPool = nullptr;
+	}
+	else if (currentPool) {
+		sourceDevice.resetDescriptorPool(currentPool);
+	}
+	nextPoolSets = setsPerPool;
+	observedTypes.clear();
+	uncachedLayoutUsed = false;
+
+	stats.setsAllocated = 0;
+	stats.resetCount++;
+}
@@ -0,0 +1,82 @@
+/******************************************************************************
+This file is part of the Newcastle Vulkan Tutorial Series
+
+Author:Rich Davison
+Contact:richgdavison@gmail.com
+License: MIT (see LICENSE file at the top of the source tree)
+*//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+namespace NCL::Rendering::Vulkan {
+	struct DescriptorAllocatorStats {
+		uint32_t setsAllocated		= 0;	//Since the last reset
+		uint64_t totalSetsAllocated	= 0;
+		uint32_t poolCount			= 0;
+		uint32_t poolsCreated		= 0;
+		uint32_t poolOverflows		= 0;	//Allocations that had to move on to another pool
+		uint32_t resetCount			= 0;
+	};
+
+	/*
+	DescriptorAllocator: Hands out descriptor sets from a chain of pools,
+	making a new, larger pool whenever the current one runs out rather
+	than failing.
+
+	A transient allocator is meant to be used for a single frame's sets,
+	which are all released at once with Reset - its pools are kept around
+	and reused rather than destroyed. Each time it is reset, it looks at
+	how many sets, and how many descriptors of each type, the frame used,
+	and sizes its next pools to match, so a steady workload settles into a
+	single pool per frame. Descriptor counts are only known for layouts
+	that came from the device's DescriptorSetLayoutCache - if a frame uses
+	any other layout, its pools also get room for every common type.
+
+	A persistent allocator instead allows sets to be freed individually,
+	via AllocateUnique, and is never reset. Any sets it hands out must be
+	freed before it is destroyed.
+
+	Not thread safe - each recording thread should have its own.
+	*/
+	class DescriptorAllocator	{
+	public:
+		DescriptorAllocator(vk::Device device, bool persistent = false, uint32_t initialSetsPerPool = 128, const std::string& debugName = "");
+		~DescriptorAllocator();
+
+		//Transient sets are only valid until Reset
+		vk::DescriptorSet		Allocate(vk::DescriptorSetLayout layout, uint32_t variableDescriptorCount = 0);
+		//Only available to persistent allocators
+		vk::UniqueDescriptorSet AllocateUnique(vk::DescriptorSetLayout layout, uint32_t variableDescriptorCount = 0);
+
+		//Releases every set from a transient allocator at once
+		void	Reset();
+
+		const DescriptorAllocatorStats& GetStats() const {
+			return stats;
+		}
+
+	protected:
+		vk::DescriptorSet	AllocateFromPools(vk::DescriptorSetLayout layout, uint32_t variableDescriptorCount);
+		vk::Result			TryAllocate(vk::DescriptorPool pool, vk::DescriptorSetLayout layout, uint32_t variableDescriptorCount, vk::DescriptorSet& set);
+		vk::DescriptorPool	CreatePool(uint32_t setCount);
+		void				RecordUsage(vk::DescriptorSetLayout layout);
+
+		vk::Device	sourceDevice;
+		std::string	debugName;
+		bool		persistent;
+
+		vk::DescriptorPool				currentPool;
+		std::vector<vk::DescriptorPool> fullPools;
+
+		uint32_t	setsPerPool;	//Size of the first pool after a reset
+		uint32_t	nextPoolSets;	//Size of the next overflow pool
+
+		//Descriptors of each type per set, learned from previous frames
+		std::map<vk::DescriptorType, float>		typeRatios;
+		std::map<vk::DescriptorType, uint32_t>	observedTypes;
+		bool uncachedLayoutUsed = false; //Its descriptor counts are unknown, so the ratios can't be trusted
+
+		std::vector<vk::DescriptorPoolSize>		layoutSizes; //Scratch space
+
+		DescriptorAllocatorStats stats;
+	};
+}
@@ -0,0 +1,84 @@
+/******************************************************************************
+This file is part of the Newcastle Vulkan Tutorial Series
+
+Author:Rich Davison
+Contact:richgdavison@gmail.com
+License: MIT (see LICENSE file at the top of the source tree)
+*//////////////////////////////////////////////////////////////////////////////
+#include "VulkanDescriptorBufferRing.h"
+#include "VulkanBufferBuilder.h"
+#include "VulkanUtils.h"
+
+using namespace NCL;
+using namespace Rendering;
+using namespace Vulkan;
+
+DescriptorBufferRing::DescriptorBufferRing(vk::Device device, VmaAllocator allocator, size_t inBytesPerFrame, uint32_t frameCount, const std::string& inDebugName) {
+	sourceDevice	= device;
+	debugName		= inDebugName;
+	alignment		= std::max(GetDescriptorBufferProperties(device).descriptorBufferOffsetAlignment, (vk::DeviceSize)1);
+	bytesPerFrame	= ((inBytesPerFrame + alignment - 1) / alignment) * alignment;
+	frameStart		= 0;
+	frameOffset		= 0;
+	peakBytes		= 0;
+
+	buffer = BufferBuilder(device, allocator)
+		.WithBufferUsage(vk::BufferUsageFlagBits::eResourceDescriptorBufferEXT | vk::BufferUsageFlagBits::eSamplerDescriptorBufferEXT)
+		.WithDeviceAddress()
+		.WithHostVisibility()
+		.WithPersistentMapping()
+		.Build(bytesPerFrame * std::max(frameCount, 1u), debugName);
+}
+
+void DescriptorBufferRing::BeginFrame(uint32_t frameIndex) {
+	peakBytes	= std::max(peakBytes, frameOffset - frameStart);
+	frameStart	= bytesPerFrame * frameIndex;
+	frameOffset = frameStart;
+}
+
+DescriptorBufferAllocation DescriptorBufferRing::Allocate(vk::DescriptorSetLayout layout) {
+	vk::DeviceSize size		= GetDescriptorSetLayoutSize(sourceDevice, layout);
+	vk::DeviceSize offset	= ((frameOffset + alignment - 1) / alignment) * alignment;
+
+	if (offset + size > frameStart + bytesPerFrame) {
+		std::cout << __FUNCTION__ << " descriptor buffer " << debugName << " is out of space for this frame!\n";
+		return {};
+	}
+	frameOffset = offset + size;
+
+	return {
+		.layout = layout,
+		.offset = offset,
+		.size	= size,
+		.data	= ((char*)buffer.Data()) + offset
+	};
+}
+
+DescriptorBufferWriter DescriptorBufferRing::AllocateAndWrite(vk::DescriptorSetLayout layout, DescriptorBufferAllocation& allocation) {
+	allocation = Allocate(layout);
+	return DescriptorBufferWriter(sourceDevice, layout, allocation.data);
+}
+
+void DescriptorBufferRing::Bind(vk::CommandBuffer cmdBuffer) const {
+	vk::DescriptorBufferBindingInfoEXT bindingInfo = {
+		.address	= buffer.deviceAddress,
+		.usage		= vk::BufferUsageFlagBits::eResourceDescriptorBufferEXT | vk::BufferUsageFlagBits::eSamplerDescriptorBufferEXT
+	};
+	cmdBuffer.bindDescriptorBuffersEXT(1, &bindingInfo);
+}
+
+void DescriptorBufferRing::SetOffset(vk::CommandBuffer cmdBuffer, vk::PipelineBindPoint bindPoint, vk::PipelineLayout pipeLayout, uint32_t setIndex, const DescriptorBufferAllocation& allocation) const {
+	uint32_t		bufferIndex = 0;
+	vk::DeviceSize	offset		= allocation.offset;
+	cmdBuffer.setDescriptorBufferOffsetsEXT(bindPoint, pipeLayout, setIndex, 1, &bufferIndex, &offset);
+}
+
+void DescriptorBufferRing::SetOffsets(vk::CommandBuffer cmdBuffer, vk::PipelineBindPoint bindPoint, vk::PipelineLayout pipeLayout, uint32_t firstSet, const std::vector<DescriptorBufferAllocation>& allocations) const {
+	std::vector<uint32_t>		bufferIndices(allocations.size(), 0);
+	std::vector<vk::DeviceSize> offsets;
+	offsets.reserve(allocations.size());
+	for (const auto& a : allocations) {
+		offsets.push_back(a.offset);
+	}
+	cmdBuffer.setDescriptorBufferOffsetsEXT(bindPoint, pipeLayout, firstSet, (uint32_t)allocations.size(), bufferIndices.data(), offsets.data());
+}
@@ -0,0 +1,70 @@
+/******************************************************************************
+This file is part of the Newcastle Vulkan Tutorial Series
+
+Author:Rich Davison
+Contact:richgdavison@gmail.com
+License: MIT (see LICENSE file at the top of the source tree)
+*//////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "VulkanBuffers.h"
+#include "VulkanDescriptorBufferWriter.h"
+
+namespace NCL::Rendering::Vulkan {
+	struct DescriptorBufferAllocation {
+		vk::DescriptorSetLayout layout;
+		vk::DeviceSize			offset	= 0;	//From the start of the buffer, as given to SetOffset
+		vk::DeviceSize			size	= 0;
+		void*					data	= nullptr;
+
+		operator bool() const {
+			return data != nullptr;
+		}
+	};
+
+	/*
+	DescriptorBufferRing: A persistently mapped descriptor buffer, split
+	into a region per frame in flight, which descriptor 'sets' are linearly
+	allocated from. Each frame's region is reset as a whole in BeginFrame,
+	once the GPU is done with it, so there's no pool or per set freeing.
+
+	Bind should be called once per command buffer, after which each set is
+	selected with SetOffset. The buffer holds both resource and sampler
+	descriptors, so pipelines must be built WithDescriptorBuffers, and
+	their layouts with eDescriptorBufferEXT. Requires VK_EXT_descriptor_buffer,
+	and SetDescriptorSizes having been called for the device.
+	*/
+	class DescriptorBufferRing	{
+	public:
+		DescriptorBufferRing(vk::Device device, VmaAllocator allocator, size_t bytesPerFrame, uint32_t frameCount, const std::string& debugName = "Descriptor Buffer Ring");
+		~DescriptorBufferRing() {}
+
+		//Starts allocating from this frame's region, discarding what it held before
+		void	BeginFrame(uint32_t frameIndex);
+
+		DescriptorBufferAllocation	Allocate(vk::DescriptorSetLayout layout);
+		DescriptorBufferWriter		AllocateAndWrite(vk::DescriptorSetLayout layout, DescriptorBufferAllocation& allocation);
+
+		void	Bind(vk::CommandBuffer cmdBuffer) const;
+		void	SetOffset(vk::CommandBuffer cmdBuffer, vk::PipelineBindPoint bindPoint, vk::PipelineLayout pipeLayout, uint32_t setIndex, const DescriptorBufferAllocation& allocation) const;
+		//Sets a range of consecutive set indices in one call
+		void	SetOffsets(vk::CommandBuffer cmdBuffer, vk::PipelineBindPoint bindPoint, vk::PipelineLayout pipeLayout, uint32_t firstSet, const std::vector<DescriptorBufferAllocation>& allocations) const;
+
+		vk::DeviceSize	GetFrameBytesUsed() const {
+			return frameOffset - frameStart;
+		}
+		vk::DeviceSize	GetPeakFrameBytes() const {
+			return peakBytes;
+		}
+
+	protected:
+		vk::Device		sourceDevice;
+		VulkanBuffer	buffer;
+
+		vk::DeviceSize	bytesPerFrame;
+		vk::DeviceSize	alignment;
+		vk::DeviceSize	frameStart;
+		vk::DeviceSize	frameOffset;
+		vk::DeviceSize	peakBytes;
+		std::string		debugName;
+	};
+}
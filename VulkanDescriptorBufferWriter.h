@@ -6,26 +6,48 @@ Contact:richgdavison@gmail.com
 License: MIT (see LICENSE file at the top of the source tree)
 *//////////////////////////////////////////////////////////////////////////////
 #pragma once
+#include "VulkanBuffers.h"
+#include "VulkanUtils.h"
 
 namespace NCL::Rendering::Vulkan {
 	/*
-	DescriptorBufferWriter: A helper class for writing descriptors to a 
-	descriptor buffer. We MUST call Finish to ensure that the writes to the
-	buffer are synchronised, in case the buffer is not persistently mapped.
+	DescriptorBufferWriter: A helper class for writing descriptors to a
+	descriptor buffer. It can either write to the start of a whole buffer,
+	or to memory that has already been allocated for a set, such as from a
+	DescriptorBufferRing. If the buffer had to be mapped, we MUST call
+	Finish (or let the writer go out of scope) to unmap it again.
+
+	Binding offsets come from the device's layout cache, so they are only
+	queried once per layout, and descriptor sizes come from the properties
+	given to SetDescriptorSizes, unless SetProperties is used.
 	*/
 	class DescriptorBufferWriter {
 	public:
-		DescriptorBufferWriter(vk::Device inDevice, vk::DescriptorSetLayout inLayout, VulkanBuffer& inBuffer)
-		 : destBuffer(inBuffer) {
+		DescriptorBufferWriter(vk::Device inDevice, vk::DescriptorSetLayout inLayout, VulkanBuffer& inBuffer, vk::DeviceSize offset = 0) {
 			device = inDevice;
 			layout = inLayout;
-			descriptorBufferMemory = destBuffer.Map();
+			props  = &GetDescriptorBufferProperties(device);
+
+			mappedBuffer = nullptr;
+			descriptorBufferMemory = inBuffer.Data();
+			if (!descriptorBufferMemory) {
+				mappedBuffer = &inBuffer;
+				descriptorBufferMemory = inBuffer.Map();
+			}
+			descriptorBufferMemory = ((char*)descriptorBufferMemory) + offset;
+		}
+
+		DescriptorBufferWriter(vk::Device inDevice, vk::DescriptorSetLayout inLayout, void* setMemory) {
+			device = inDevice;
+			layout = inLayout;
+			props  = &GetDescriptorBufferProperties(device);
+
+			mappedBuffer = nullptr;
+			descriptorBufferMemory = setMemory;
 		}
 
 		~DescriptorBufferWriter() {
-			if (descriptorBufferMemory) {
-				Finish();
-			}
+			Finish();
 		}
 
 		DescriptorBufferWriter& SetProperties(vk::PhysicalDeviceDescriptorBufferPropertiesEXT* inProps) {
@@ -34,51 +56,115 @@ namespace NCL::Rendering::Vulkan {
 		}
 
 		DescriptorBufferWriter& WriteBuffer(uint32_t binding, vk::DescriptorType type, const VulkanBuffer& buffer, uint32_t arrayIndex = 0) {
+			return WriteBuffer(binding, type, buffer.deviceAddress, buffer.size, arrayIndex);
+		}
+
+		DescriptorBufferWriter& WriteBuffer(uint32_t binding, vk::DescriptorType type, vk::DeviceAddress address, vk::DeviceSize range, uint32_t arrayIndex = 0) {
 			vk::DescriptorAddressInfoEXT descriptorAddress = {
-				.address	= buffer.deviceAddress,
-				.range		= buffer.size
+				.address	= address,
+				.range		= range
 			};
-
 			vk::DescriptorGetInfoEXT getInfo = {
-				.type = type,
-				.data = &descriptorAddress
+				.type = type
 			};
+			if (type == vk::DescriptorType::eUniformBuffer) {
+				getInfo.data.pUniformBuffer = &descriptorAddress;
+			}
+			else if (type == vk::DescriptorType::eStorageBuffer) {
+				getInfo.data.pStorageBuffer = &descriptorAddress;
+			}
+			else if (type == vk::DescriptorType::eUniformTexelBuffer) {
+				getInfo.data.pUniformTexelBuffer = &descriptorAddress;
+			}
+			else if (type == vk::DescriptorType::eStorageTexelBuffer) {
+				getInfo.data.pStorageTexelBuffer = &descriptorAddress;
+			}
+			return Write(binding, arrayIndex, getInfo);
+		}
 
-			vk::DeviceSize		offset = device.getDescriptorSetLayoutBindingOffsetEXT(layout, binding);
-
-			device.getDescriptorEXT(&getInfo, Vulkan::GetDescriptorSize(type, *props), ((char*)descriptorBufferMemory) + offset);
+		DescriptorBufferWriter& WriteUniformBuffer(uint32_t binding, const VulkanBuffer& buffer, uint32_t arrayIndex = 0) {
+			return WriteBuffer(binding, vk::DescriptorType::eUniformBuffer, buffer, arrayIndex);
+		}
 
-			return *this;
+		DescriptorBufferWriter& WriteStorageBuffer(uint32_t binding, const VulkanBuffer& buffer, uint32_t arrayIndex = 0) {
+			return WriteBuffer(binding, vk::DescriptorType::eStorageBuffer, buffer, arrayIndex);
 		}
 
-		//DescriptorBufferWriter& WriteStorageBuffer(uint32_t binding, const VulkanBuffer& buffer) {
-		//	vk::DescriptorAddressInfoEXT descriptorAddress = {
-		//		.address = uniformBuffer.deviceAddress,
-		//		.range = uniformBuffer.size
-		//	};
+		DescriptorBufferWriter& WriteImage(uint32_t binding, vk::ImageView view, vk::Sampler sampler, vk::ImageLayout imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal, uint32_t arrayIndex = 0) {
+			vk::DescriptorImageInfo imageInfo = {
+				.sampler		= sampler,
+				.imageView		= view,
+				.imageLayout	= imageLayout
+			};
+			vk::DescriptorGetInfoEXT getInfo = {
+				.type = vk::DescriptorType::eCombinedImageSampler
+			};
+			getInfo.data.pCombinedImageSampler = &imageInfo;
+			return Write(binding, arrayIndex, getInfo);
+		}
 
-		//	vk::DescriptorGetInfoEXT getInfo = {
-		//		.type = vk::DescriptorType::eUniformBuffer,
-		//		.data = &descriptorAddress
-		//	};
+		DescriptorBufferWriter& WriteSampledImage(uint32_t binding, vk::ImageView view, vk::ImageLayout imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal, uint32_t arrayIndex = 0) {
+			vk::DescriptorImageInfo imageInfo = {
+				.imageView		= view,
+				.imageLayout	= imageLayout
+			};
+			vk::DescriptorGetInfoEXT getInfo = {
+				.type = vk::DescriptorType::eSampledImage
+			};
+			getInfo.data.pSampledImage = &imageInfo;
+			return Write(binding, arrayIndex, getInfo);
+		}
 
-		//	vk::DeviceSize		offset = device.getDescriptorSetLayoutBindingOffsetEXT(layout, binding);
+		DescriptorBufferWriter& WriteStorageImage(uint32_t binding, vk::ImageView view, vk::ImageLayout imageLayout = vk::ImageLayout::eGeneral, uint32_t arrayIndex = 0) {
+			vk::DescriptorImageInfo imageInfo = {
+				.imageView		= view,
+				.imageLayout	= imageLayout
+			};
+			vk::DescriptorGetInfoEXT getInfo = {
+				.type = vk::DescriptorType::eStorageImage
+			};
+			getInfo.data.pStorageImage = &imageInfo;
+			return Write(binding, arrayIndex, getInfo);
+		}
 
-		//	device.getDescriptorEXT(&getInfo, props->uniformBufferDescriptorSize, ((char*)descriptorBufferMemory) + offset);
+		DescriptorBufferWriter& WriteSampler(uint32_t binding, vk::Sampler sampler, uint32_t arrayIndex = 0) {
+			vk::DescriptorGetInfoEXT getInfo = {
+				.type = vk::DescriptorType::eSampler
+			};
+			getInfo.data.pSampler = &sampler;
+			return Write(binding, arrayIndex, getInfo);
+		}
 
-		//	return *this;
-		//}
+		DescriptorBufferWriter& WriteAccelerationStructure(uint32_t binding, vk::DeviceAddress tlasAddress, uint32_t arrayIndex = 0) {
+			vk::DescriptorGetInfoEXT getInfo = {
+				.type = vk::DescriptorType::eAccelerationStructureKHR
+			};
+			getInfo.data.accelerationStructure = tlasAddress;
+			return Write(binding, arrayIndex, getInfo);
+		}
 
 		void Finish() {
-			destBuffer.Unmap();
+			if (mappedBuffer) {
+				mappedBuffer->Unmap();
+				mappedBuffer = nullptr;
+			}
 			descriptorBufferMemory = nullptr;
 		}
 
 	protected:
+		DescriptorBufferWriter& Write(uint32_t binding, uint32_t arrayIndex, const vk::DescriptorGetInfoEXT& getInfo) {
+			assert(descriptorBufferMemory);
+			size_t			descriptorSize	= Vulkan::GetDescriptorSize(getInfo.type, *props);
+			vk::DeviceSize	offset			= GetDescriptorBindingOffset(device, layout, binding) + (arrayIndex * descriptorSize);
+
+			device.getDescriptorEXT(&getInfo, descriptorSize, ((char*)descriptorBufferMemory) + offset);
+			return *this;
+		}
+
 		vk::Device device;
-		VulkanBuffer& destBuffer;
+		VulkanBuffer* mappedBuffer; //Only set if we mapped it, and so have to unmap it
 		void* descriptorBufferMemory;
 		vk::DescriptorSetLayout layout;
-		vk::PhysicalDeviceDescriptorBufferPropertiesEXT* props;
+		const vk::PhysicalDeviceDescriptorBufferPropertiesEXT* props;
 	};
-};
\ No newline at end of file
+};
@@ -10,6 +10,7 @@ License: MIT (see LICENSE file at the top of the source tree)
 #include "VulkanShader.h"
 #include "Vulkanrenderer.h"
 #include "VulkanUtils.h"
+#include "VulkanDescriptorSetLayoutCache.h"
 
 using namespace NCL;
 using namespace Rendering;
@@ -104,4 +105,12 @@ vk::UniqueDescriptorSetLayout DescriptorSetLayoutBuilder::Build(const std::strin
 		SetDebugName(sourceDevice, vk::ObjectType::eDescriptorSetLayout, GetVulkanHandle(*layout), debugName);
 	}
 	return layout;
-}
\ No newline at end of file
+}
+
+vk::DescriptorSetLayout DescriptorSetLayoutBuilder::BuildCached(const std::string& debugName) {
+	DescriptorSetLayoutCache* cache = GetDescriptorSetLayoutCache(sourceDevice);
+	if (!MessageAssert(cache != nullptr, "Device has no descriptor set layout cache!")) {
+		return Build(debugName).release();
+	}
+	return cache->GetLayout(addedBindings, addedFlags, createInfo.flags, debugName);
+}
@@ -45,6 +45,8 @@ namespace NCL::Rendering::Vulkan {
 		DescriptorSetLayoutBuilder& WithCreationFlags(vk::DescriptorSetLayoutCreateFlags flags);
 
 		vk::UniqueDescriptorSetLayout Build(const std::string& debugName = "");
+		//Returns the device's shared layout for these bindings, which the DescriptorSetLayoutCache owns
+		vk::DescriptorSetLayout BuildCached(const std::string& debugName = "");
 
 	protected:
 		vk::Device sourceDevice;
@@ -0,0 +1,147 @@
+/******************************************************************************
+This file is part of the Newcastle Vulkan Tutorial Series
+
+Author:Rich Davison
+Contact:richgdavison@gmail.com
+License: MIT (see LICENSE file at the top of the source tree)
+*//////////////////////////////////////////////////////////////////////////////
+#include "VulkanDescriptorSetLayoutCache.h"
+#include "VulkanUtils.h"
+#include <algorithm>
+
+using namespace NCL;
+using namespace Rendering;
+using namespace Vulkan;
+
+DescriptorSetLayoutCache::DescriptorSetLayoutCache(vk::Device device) {
+	sourceDevice	= device;
+	hitCount		= 0;
+}
+
+DescriptorSetLayoutCache::~DescriptorSetLayoutCache() {
+	for (auto& [key, layout] : layouts) {
+		sourceDevice.destroyDescriptorSetLayout(layout);
+	}
+}
+
+vk::DescriptorSetLayout DescriptorSetLayoutCache::GetLayout(const std::vector<vk::DescriptorSetLayoutBinding>& bindings,
+	const std::vector<vk::DescriptorBindingFlags>& bindingFlags, vk::DescriptorSetLayoutCreateFlags createFlags, const std::string& debugName) {
+	assert(bindingFlags.empty() || bindingFlags.size() == bindings.size());
+
+	//Bindings are put in order first, so the order they were added in doesn't matter
+	std::vector<uint32_t> order(bindings.size());
+	for (uint32_t i = 0; i < order.size(); ++i) {
+		order[i] = i;
+	}
+	std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+		return bindings[a].binding < bindings[b].binding;
+	});
+
+	std::string key;
+	key.reserve(sizeof(uint32_t) * 6 * bindings.size() + sizeof(uint32_t));
+	auto append = [&key](auto value) {
+		key.append((const char*)&value, sizeof(value));
+	};
+	append((uint32_t)createFlags);
+	for (uint32_t i : order) {
+		const vk::DescriptorSetLayoutBinding& b = bindings[i];
+		append(b.binding);
+		append(b.descriptorType);
+		append(b.descriptorCount);
+		append((uint32_t)b.stageFlags);
+		append((uint32_t)(bindingFlags.empty() ? vk::DescriptorBindingFlags() : bindingFlags[i]));
+		append(b.pImmutableSamplers != nullptr);
+		if (b.pImmutableSamplers) {
+			for (uint32_t s = 0; s < b.descriptorCount; ++s) {
+				append(GetVulkanHandle(b.pImmutableSamplers[s]));
+			}
+		}
+	}
+
+	std::unique_lock lock(cacheMutex);
+	auto i = layouts.find(key);
+	if (i != layouts.end()) {
+		hitCount++;
+		return i->second;
+	}
+
+	vk::DescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo;
+	bindingFlagsInfo.setBindingFlags(bindingFlags);
+
+	vk::DescriptorSetLayoutCreateInfo createInfo;
+	createInfo.setBindings(bindings);
+	createInfo.setFlags(createFlags);
+	if (!bindingFlags.empty()) {
+		createInfo.pNext = &bindingFlagsInfo;
+	}
+	vk::DescriptorSetLayout layout = sourceDevice.createDescriptorSetLayout(createInfo);
+	if (!debugName.empty()) {
+		SetDebugName(sourceDevice, vk::ObjectType::eDescriptorSetLayout, GetVulkanHandle(layout), debugName);
+	}
+	layouts.insert({ key, layout });
+
+	LayoutInfo& info = layoutInfo[layout];
+	std::vector<vk::DescriptorPoolSize>& counts = info.counts;
+	for (const vk::DescriptorSetLayoutBinding& b : bindings) {
+		info.bindings.push_back(b.binding);
+		auto i = std::find_if(counts.begin(), counts.end(), [&](const vk::DescriptorPoolSize& s) {
+			return s.type == b.descriptorType;
+		});
+		if (i == counts.end()) {
+			counts.push_back({ .type = b.descriptorType, .descriptorCount = b.descriptorCount });
+		}
+		else {
+			i->descriptorCount += b.descriptorCount;
+		}
+	}
+	return layout;
+}
+
+bool DescriptorSetLayoutCache::GetDescriptorCounts(vk::DescriptorSetLayout layout, std::vector<vk::DescriptorPoolSize>& counts) const {
+	std::unique_lock lock(cacheMutex);
+	auto i = layoutInfo.find(layout);
+	if (i == layoutInfo.end()) {
+		return false;
+	}
+	counts = i->second.counts;
+	return true;
+}
+
+DescriptorSetLayoutCache::LayoutInfo* DescriptorSetLayoutCache::GetBufferInfo(vk::DescriptorSetLayout layout) {
+	auto i = layoutInfo.find(layout);
+	if (i == layoutInfo.end()) {
+		return nullptr;
+	}
+	LayoutInfo& info = i->second;
+	if (!info.bufferQueried) {
+		info.bufferSize = sourceDevice.getDescriptorSetLayoutSizeEXT(layout);
+		for (uint32_t binding : info.bindings) {
+			info.bindingOffsets[binding] = sourceDevice.getDescriptorSetLayoutBindingOffsetEXT(layout, binding);
+		}
+		info.bufferQueried = true;
+	}
+	return &info;
+}
+
+vk::DeviceSize DescriptorSetLayoutCache::GetBindingOffset(vk::DescriptorSetLayout layout, uint32_t binding) {
+	std::unique_lock lock(cacheMutex);
+	LayoutInfo* info = GetBufferInfo(layout);
+	if (info) {
+		auto i = info->bindingOffsets.find(binding);
+		if (i != info->bindingOffsets.end()) {
+			return i->second;
+		}
+	}
+	return sourceDevice.getDescriptorSetLayoutBindingOffsetEXT(layout, binding);
+}
+
+vk::DeviceSize DescriptorSetLayoutCache::GetLayoutSize(vk::DescriptorSetLayout layout) {
+	std::unique_lock lock(cacheMutex);
+	LayoutInfo* info = GetBufferInfo(layout);
+	return info ? info->bufferSize : sourceDevice.getDescriptorSetLayoutSizeEXT(layout);
+}
+
+uint32_t DescriptorSetLayoutCache::GetLayoutCount() const {
+	std::unique_lock lock(cacheMutex);
+	return (uint32_t)layouts.size();
+}
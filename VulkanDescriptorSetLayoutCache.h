@@ -0,0 +1,72 @@
+/******************************************************************************
+This file is part of the Newcastle Vulkan Tutorial Series
+
+Author:Rich Davison
+Contact:richgdavison@gmail.com
+License: MIT (see LICENSE file at the top of the source tree)
+*//////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
+namespace NCL::Rendering::Vulkan {
+	/*
+	DescriptorSetLayoutCache: Makes sure there is only ever one descriptor
+	set layout for any given set of bindings, so layouts that are equal are
+	also pointer-equal. This keeps pipeline layouts compatible with each
+	other, so descriptor sets can be bound once and shared across any
+	pipeline that uses the same layout for a set.
+
+	Layouts are keyed by their creation flags, and the binding index, type,
+	count, stages, immutable samplers and binding flags of every binding,
+	in binding order. The cache owns every layout it returns, which live
+	until the cache is destroyed.
+
+	The renderer makes one of these per device and registers it with
+	SetDescriptorSetLayoutCache, after which shader reflection and
+	DescriptorSetLayoutBuilder::BuildCached both use it. Safe to use from
+	multiple threads.
+	*/
+	class DescriptorSetLayoutCache	{
+	public:
+		DescriptorSetLayoutCache(vk::Device device);
+		~DescriptorSetLayoutCache();
+
+		//bindingFlags can either be empty or have an entry per binding
+		vk::DescriptorSetLayout	GetLayout(const std::vector<vk::DescriptorSetLayoutBinding>& bindings,
+									const std::vector<vk::DescriptorBindingFlags>& bindingFlags = {},
+									vk::DescriptorSetLayoutCreateFlags createFlags = {}, const std::string& debugName = "");
+
+		//How many descriptors of each type a set with this layout needs. Returns false if the layout isn't from this cache
+		bool		GetDescriptorCounts(vk::DescriptorSetLayout layout, std::vector<vk::DescriptorPoolSize>& counts) const;
+
+		//Descriptor buffer placement, queried once per layout. Needs VK_EXT_descriptor_buffer
+		vk::DeviceSize	GetBindingOffset(vk::DescriptorSetLayout layout, uint32_t binding);
+		vk::DeviceSize	GetLayoutSize(vk::DescriptorSetLayout layout);
+
+		uint32_t	GetLayoutCount() const;
+		uint32_t	GetHitCount() const {
+			return hitCount;
+		}
+
+	protected:
+		vk::Device	sourceDevice;
+
+		mutable std::mutex	cacheMutex;
+		std::unordered_map<std::string, vk::DescriptorSetLayout> layouts;
+		struct LayoutInfo {
+			std::vector<vk::DescriptorPoolSize> counts;
+			std::vector<uint32_t>				bindings;
+
+			bool							bufferQueried = false;
+			vk::DeviceSize					bufferSize = 0;
+			std::map<uint32_t, vk::DeviceSize>	bindingOffsets;
+		};
+		LayoutInfo*	GetBufferInfo(vk::DescriptorSetLayout layout); //cacheMutex must be held
+
+		std::map<vk::DescriptorSetLayout, LayoutInfo> layoutInfo;
+
+		std::atomic<uint32_t>	hitCount;
+	};
+}
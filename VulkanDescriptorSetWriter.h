@@ -6,33 +6,120 @@ Contact:richgdavison@gmail.com
 License: MIT (see LICENSE file at the top of the source tree)
 *//////////////////////////////////////////////////////////////////////////////
 #pragma once
+#include <deque>
+
 namespace NCL::Rendering::Vulkan {
+	/*
+	DescriptorSetWriter: Gathers up descriptor writes, and sends them to the
+	device in a single updateDescriptorSets call, either when Flush is
+	called or when the writer goes out of scope. ForSet switches which set
+	the following writes go to, so many sets can be updated in one batch.
+	*/
 	class DescriptorSetWriter {
 	public:
-		DescriptorSetWriter(vk::Device device, vk::DescriptorSet set) {
+		DescriptorSetWriter(vk::Device device, vk::DescriptorSet set = {}) {
 			this->device = device;
 			this->set = set;
 		}
 		~DescriptorSetWriter() {
+			Flush();
 		}
+		//The pending writes point into this writer's own deques, so a copy would leave them dangling
+		DescriptorSetWriter(const DescriptorSetWriter&) = delete;
+		DescriptorSetWriter& operator=(const DescriptorSetWriter&) = delete;
 
-		DescriptorSetWriter& WriteImage(uint32_t binding, vk::ImageView view, vk::Sampler sampler, vk::ImageLayout layout = vk::ImageLayout::eShaderReadOnlyOptimal) {
-			Vulkan::WriteImageDescriptor(device, set, binding, view, sampler, layout);
+		DescriptorSetWriter& ForSet(vk::DescriptorSet newSet) {
+			set = newSet;
 			return *this;
 		}
 
-		DescriptorSetWriter& WriteStorageImage(uint32_t binding, vk::ImageView view, vk::Sampler sampler, vk::ImageLayout layout = vk::ImageLayout::eShaderReadOnlyOptimal) {
-			Vulkan::WriteStorageImageDescriptor(device, set, binding, view, sampler, layout);
+		DescriptorSetWriter& WriteImage(uint32_t binding, vk::ImageView view, vk::Sampler sampler, vk::ImageLayout layout = vk::ImageLayout::eShaderReadOnlyOptimal, uint32_t arrayIndex = 0) {
+			return AddImage(binding, arrayIndex, vk::DescriptorType::eCombinedImageSampler, { .sampler = sampler, .imageView = view, .imageLayout = layout });
+		}
+
+		DescriptorSetWriter& WriteSampledImage(uint32_t binding, vk::ImageView view, vk::ImageLayout layout = vk::ImageLayout::eShaderReadOnlyOptimal, uint32_t arrayIndex = 0) {
+			return AddImage(binding, arrayIndex, vk::DescriptorType::eSampledImage, { .imageView = view, .imageLayout = layout });
+		}
+
+		DescriptorSetWriter& WriteStorageImage(uint32_t binding, vk::ImageView view, vk::Sampler sampler, vk::ImageLayout layout = vk::ImageLayout::eShaderReadOnlyOptimal, uint32_t arrayIndex = 0) {
+			return AddImage(binding, arrayIndex, vk::DescriptorType::eStorageImage, { .sampler = sampler, .imageView = view, .imageLayout = layout });
+		}
+
+		DescriptorSetWriter& WriteSampler(uint32_t binding, vk::Sampler sampler, uint32_t arrayIndex = 0) {
+			return AddImage(binding, arrayIndex, vk::DescriptorType::eSampler, { .sampler = sampler });
+		}
+
+		DescriptorSetWriter& WriteBuffer(uint32_t binding, vk::Buffer buffer, vk::DescriptorType type, size_t offset = 0, size_t range = VK_WHOLE_SIZE, uint32_t arrayIndex = 0) {
+			bufferInfos.push_back({
+				.buffer = buffer,
+				.offset = offset,
+				.range	= range > 0 ? range : VK_WHOLE_SIZE
+			});
+			writes.push_back({
+				.dstSet				= set,
+				.dstBinding			= binding,
+				.dstArrayElement	= arrayIndex,
+				.descriptorCount	= 1,
+				.descriptorType		= type,
+				.pBufferInfo		= &bufferInfos.back()
+			});
 			return *this;
 		}
 
-		DescriptorSetWriter& WriteBuffer(uint32_t binding, vk::Buffer buffer, vk::DescriptorType type, size_t offset = 0, size_t range = VK_WHOLE_SIZE) {
-			Vulkan::WriteBufferDescriptor(device, set, binding, type, buffer, offset, range);
+		DescriptorSetWriter& WriteTLAS(uint32_t binding, vk::AccelerationStructureKHR tlas, uint32_t arrayIndex = 0) {
+			tlasHandles.push_back(tlas);
+			tlasInfos.push_back({
+				.accelerationStructureCount = 1,
+				.pAccelerationStructures	= &tlasHandles.back()
+			});
+			writes.push_back({
+				.pNext				= &tlasInfos.back(),
+				.dstSet				= set,
+				.dstBinding			= binding,
+				.dstArrayElement	= arrayIndex,
+				.descriptorCount	= 1,
+				.descriptorType		= vk::DescriptorType::eAccelerationStructureKHR
+			});
 			return *this;
 		}
 
+		void Flush() {
+			if (!writes.empty()) {
+				device.updateDescriptorSets((uint32_t)writes.size(), writes.data(), 0, nullptr);
+			}
+			writes.clear();
+			imageInfos.clear();
+			bufferInfos.clear();
+			tlasInfos.clear();
+			tlasHandles.clear();
+		}
+
+		size_t GetPendingWriteCount() const {
+			return writes.size();
+		}
+
 	protected:
+		DescriptorSetWriter& AddImage(uint32_t binding, uint32_t arrayIndex, vk::DescriptorType type, const vk::DescriptorImageInfo& info) {
+			imageInfos.push_back(info);
+			writes.push_back({
+				.dstSet				= set,
+				.dstBinding			= binding,
+				.dstArrayElement	= arrayIndex,
+				.descriptorCount	= 1,
+				.descriptorType		= type,
+				.pImageInfo			= &imageInfos.back()
+			});
+			return *this;
+		}
+
 		vk::Device device;
 		vk::DescriptorSet set;
+
+		std::vector<vk::WriteDescriptorSet> writes;
+		//Deques, so the writes' pointers stay valid as more are added
+		std::deque<vk::DescriptorImageInfo>		imageInfos;
+		std::deque<vk::DescriptorBufferInfo>	bufferInfos;
+		std::deque<vk::WriteDescriptorSetAccelerationStructureKHR>	tlasInfos;
+		std::deque<vk::AccelerationStructureKHR>					tlasHandles;
 	};
-}
\ No newline at end of file
+}
@@ -0,0 +1,98 @@
+/******************************************************************************
+This file is part of the Newcastle Vulkan Tutorial Series
+
+Author:Rich Davison
+Contact:richgdavison@gmail.com
+License: MIT (see LICENSE file at the top of the source tree)
+*//////////////////////////////////////////////////////////////////////////////
+#include "VulkanDescriptorUpdateTemplate.h"
+#include "VulkanShaderBase.h"
+#include "VulkanUtils.h"
+#include <algorithm>
+
+using namespace NCL;
+using namespace Rendering;
+using namespace Vulkan;
+
+DescriptorUpdateTemplate::DescriptorUpdateTemplate(vk::Device device, const VulkanShaderBase& shader, uint32_t setIndex, const std::string& debugName) {
+	sourceDevice	= device;
+	layout			= shader.GetLayout(setIndex);
+	Init(shader.GetLayoutBinding(setIndex), debugName);
+}
+
+DescriptorUpdateTemplate::DescriptorUpdateTemplate(vk::Device device, vk::DescriptorSetLayout inLayout, const std::vector<vk::DescriptorSetLayoutBinding>& bindings, const std::string& debugName) {
+	sourceDevice	= device;
+	layout			= inLayout;
+	Init(bindings, debugName);
+}
+
+void DescriptorUpdateTemplate::Init(const std::vector<vk::DescriptorSetLayoutBinding>& bindings, const std::string& debugName) {
+	slotCount = 0;
+
+	std::vector<vk::DescriptorSetLayoutBinding> sortedBindings = bindings;
+	std::sort(sortedBindings.begin(), sortedBindings.end(),
+		[](const vk::DescriptorSetLayoutBinding& a, const vk::DescriptorSetLayoutBinding& b) {
+			return a.binding < b.binding;
+		}
+	);
+
+	std::vector<vk::DescriptorUpdateTemplateEntry> entries;
+	for (const vk::DescriptorSetLayoutBinding& b : sortedBindings) {
+		if (b.descriptorCount == 0) {
+			continue;
+		}
+		if (!MessageAssert(b.descriptorType != vk::DescriptorType::eInlineUniformBlock, "Descriptor update templates don't support inline uniform blocks!")) {
+			continue;
+		}
+		entries.push_back({
+			.dstBinding			= b.binding,
+			.dstArrayElement	= 0,
+			.descriptorCount	= b.descriptorCount,
+			.descriptorType		= b.descriptorType,
+			.offset				= slotCount * sizeof(DescriptorTemplateSlot),
+			.stride				= sizeof(DescriptorTemplateSlot)
+		});
+		bindingSlots[b.binding] = { slotCount, b.descriptorCount, b.descriptorType };
+		slotCount += b.descriptorCount;
+	}
+
+	vk::DescriptorUpdateTemplateCreateInfo createInfo = {
+		.descriptorUpdateEntryCount = (uint32_t)entries.size(),
+		.pDescriptorUpdateEntries	= entries.data(),
+		.templateType				= vk::DescriptorUpdateTemplateType::eDescriptorSet,
+		.descriptorSetLayout		= layout
+	};
+	updateTemplate = sourceDevice.createDescriptorUpdateTemplateUnique(createInfo);
+	if (!debugName.empty()) {
+		SetDebugName(sourceDevice, vk::ObjectType::eDescriptorUpdateTemplate, GetVulkanHandle(*updateTemplate), debugName);
+	}
+}
+
+void DescriptorUpdateTemplate::Update(vk::DescriptorSet set, const DescriptorTemplateSlot* slots) const {
+	sourceDevice.updateDescriptorSetWithTemplate(set, *updateTemplate, slots);
+}
+
+uint32_t DescriptorUpdateTemplate::GetSlotIndex(uint32_t binding, uint32_t arrayIndex) const {
+	auto i = bindingSlots.find(binding);
+	if (i == bindingSlots.end() || arrayIndex >= i->second.count) {
+		return INVALID_SLOT;
+	}
+	return i->second.firstSlot + arrayIndex;
+}
+
+vk::DescriptorType DescriptorUpdateTemplate::GetDescriptorType(uint32_t binding) const {
+	auto i = bindingSlots.find(binding);
+	assert(i != bindingSlots.end());
+	return i->second.type;
+}
+
+void DescriptorTemplateData::Update(vk::DescriptorSet set) const {
+	if (!MessageAssert(IsComplete(), "Every descriptor must be written before a template update!")) {
+		return;
+	}
+	updateTemplate.Update(set, slots.data());
+}
+
+bool DescriptorTemplateData::IsComplete() const {
+	return std::find(written.begin(), written.end(), false) == written.end();
+}
@@ -0,0 +1,134 @@
+/******************************************************************************
+This file is part of the Newcastle Vulkan Tutorial Series
+
+Author:Rich Davison
+Contact:richgdavison@gmail.com
+License: MIT (see LICENSE file at the top of the source tree)
+*//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+namespace NCL::Rendering::Vulkan {
+	class VulkanShaderBase;
+
+	//One descriptor's worth of template data, laid out as Vulkan expects it
+	union DescriptorTemplateSlot {
+		DescriptorTemplateSlot() : image() {}
+
+		vk::DescriptorImageInfo			image;
+		vk::DescriptorBufferInfo		buffer;
+		vk::BufferView					texelBuffer;
+		vk::AccelerationStructureKHR	tlas;
+	};
+
+	/*
+	DescriptorUpdateTemplate: Wraps a vk::DescriptorUpdateTemplate covering
+	every binding of a descriptor set layout, so that a whole set can be
+	written with a single updateDescriptorSetWithTemplate call, reading
+	straight out of a packed array of DescriptorTemplateSlots, rather than
+	the driver having to walk a list of vk::WriteDescriptorSets.
+
+	The bindings can come from a shader's reflection data, so the template
+	always matches what the shader expects. Fill a DescriptorTemplateData
+	once per material, and then Update as many sets as needed from it.
+	Inline uniform blocks aren't supported.
+	*/
+	class DescriptorUpdateTemplate	{
+	public:
+		DescriptorUpdateTemplate(vk::Device device, const VulkanShaderBase& shader, uint32_t setIndex, const std::string& debugName = "");
+		DescriptorUpdateTemplate(vk::Device device, vk::DescriptorSetLayout layout, const std::vector<vk::DescriptorSetLayoutBinding>& bindings, const std::string& debugName = "");
+		~DescriptorUpdateTemplate() {}
+
+		void Update(vk::DescriptorSet set, const DescriptorTemplateSlot* slots) const;
+
+		//Returns the slot a descriptor lives in, or INVALID_SLOT if the binding isn't in the set
+		uint32_t GetSlotIndex(uint32_t binding, uint32_t arrayIndex = 0) const;
+		vk::DescriptorType GetDescriptorType(uint32_t binding) const;
+
+		uint32_t GetSlotCount() const {
+			return slotCount;
+		}
+		vk::DescriptorSetLayout GetLayout() const {
+			return layout;
+		}
+		vk::DescriptorUpdateTemplate GetTemplate() const {
+			return *updateTemplate;
+		}
+
+		static const uint32_t INVALID_SLOT = ~0u;
+
+	protected:
+		void Init(const std::vector<vk::DescriptorSetLayoutBinding>& bindings, const std::string& debugName);
+
+		struct BindingSlots {
+			uint32_t			firstSlot;
+			uint32_t			count;
+			vk::DescriptorType	type;
+		};
+
+		vk::Device								sourceDevice;
+		vk::DescriptorSetLayout					layout;
+		vk::UniqueDescriptorUpdateTemplate		updateTemplate;
+		std::map<uint32_t, BindingSlots>		bindingSlots;
+		uint32_t								slotCount;
+	};
+
+	/*
+	DescriptorTemplateData: The per-material data for a DescriptorUpdateTemplate,
+	with writes that mirror those of DescriptorSetWriter. Nothing is sent
+	to the device until Update is called. The template writes every slot,
+	so all of them must have been written first, as null descriptors
+	aren't valid without the nullDescriptor feature.
+	*/
+	class DescriptorTemplateData {
+	public:
+		DescriptorTemplateData(const DescriptorUpdateTemplate& inTemplate) : updateTemplate(inTemplate) {
+			slots.resize(inTemplate.GetSlotCount());
+			written.resize(inTemplate.GetSlotCount(), false);
+		}
+
+		DescriptorTemplateData& WriteImage(uint32_t binding, vk::ImageView view, vk::Sampler sampler, vk::ImageLayout layout = vk::ImageLayout::eShaderReadOnlyOptimal, uint32_t arrayIndex = 0) {
+			GetSlot(binding, arrayIndex).image = { .sampler = sampler, .imageView = view, .imageLayout = layout };
+			return *this;
+		}
+
+		DescriptorTemplateData& WriteSampler(uint32_t binding, vk::Sampler sampler, uint32_t arrayIndex = 0) {
+			GetSlot(binding, arrayIndex).image = { .sampler = sampler };
+			return *this;
+		}
+
+		DescriptorTemplateData& WriteBuffer(uint32_t binding, vk::Buffer buffer, size_t offset = 0, size_t range = VK_WHOLE_SIZE, uint32_t arrayIndex = 0) {
+			GetSlot(binding, arrayIndex).buffer = { .buffer = buffer, .offset = offset, .range = range > 0 ? range : VK_WHOLE_SIZE };
+			return *this;
+		}
+
+		DescriptorTemplateData& WriteTexelBuffer(uint32_t binding, vk::BufferView view, uint32_t arrayIndex = 0) {
+			GetSlot(binding, arrayIndex).texelBuffer = view;
+			return *this;
+		}
+
+		DescriptorTemplateData& WriteTLAS(uint32_t binding, vk::AccelerationStructureKHR tlas, uint32_t arrayIndex = 0) {
+			GetSlot(binding, arrayIndex).tlas = tlas;
+			return *this;
+		}
+
+		void Update(vk::DescriptorSet set) const;
+
+		bool IsComplete() const;
+
+		const DescriptorTemplateSlot* GetSlots() const {
+			return slots.data();
+		}
+
+	protected:
+		DescriptorTemplateSlot& GetSlot(uint32_t binding, uint32_t arrayIndex) {
+			uint32_t index = updateTemplate.GetSlotIndex(binding, arrayIndex);
+			assert(index != DescriptorUpdateTemplate::INVALID_SLOT);
+			written[index] = true;
+			return slots[index];
+		}
+
+		const DescriptorUpdateTemplate&		updateTemplate;
+		std::vector<DescriptorTemplateSlot>	slots;
+		std::vector<bool>					written;
+	};
+}
@@ -0,0 +1,406 @@
+/******************************************************************************
+This file is part of the Newcastle Vulkan Tutorial Series
+
+Author:Rich Davison
+Contact:richgdavison@gmail.com
+License: MIT (see LICENSE file at the top of the source tree)
+*//////////////////////////////////////////////////////////////////////////////
+#include "VulkanGPUDrivenScene.h"
+#include "VulkanRenderer.h"
+#include "VulkanMesh.h"
+#include "VulkanGeometryPool.h"
+#include "VulkanCompute.h"
+#include "VulkanComputePipelineBuilder.h"
+#include "VulkanBufferBuilder.h"
+#include "VulkanDescriptorSetWriter.h"
+#include "VulkanStagingRingBuffer.h"
+#include "VulkanUtils.h"
+
+using namespace NCL;
+using namespace Rendering;
+using namespace Vulkan;
+using namespace Maths;
+
+//vkCmdUpdateBuffer can only write this much at a time
+const size_t MAX_INLINE_UPDATE = 65536;
+
+static void GlobalMemoryBarrier(vk::CommandBuffer cmdBuffer, vk::PipelineStageFlags2 srcStage, vk::AccessFlags2 srcAccess, vk::PipelineStageFlags2 dstStage, vk::AccessFlags2 dstAccess) {
+	vk::MemoryBarrier2 barrier = {
+		.srcStageMask	= srcStage,
+		.srcAccessMask	= srcAccess,
+		.dstStageMask	= dstStage,
+		.dstAccessMask	= dstAccess
+	};
+	vk::DependencyInfo info;
+	info.memoryBarrierCount = 1;
+	info.pMemoryBarriers	= &barrier;
+	cmdBuffer.pipelineBarrier2(info);
+}
+
+GPUDrivenScene::GPUDrivenScene(VulkanRenderer& inRenderer, GeometryPool& inPool, uint32_t inMaxInstances, uint32_t inMaxDrawRecords,
+	const std::string& cullShaderFile, const std::string& hiZShaderFile) : renderer(inRenderer), pool(inPool) {
+	device				= renderer.GetDevice();
+	maxInstances		= inMaxInstances;
+	maxDrawRecords		= inMaxDrawRecords;
+	occlusionCulling	= false;
+	bindingMesh			= nullptr;
+	hiZImage			= nullptr;
+	hiZAllocation		= nullptr;
+	hiZValid			= false;
+	firstDirtyInstance	= UINT32_MAX;
+	lastDirtyInstance	= 0;
+	firstDirtyRecord	= 0;
+
+	VmaAllocator allocator = renderer.GetMemoryAllocator();
+
+	instanceBuffer = BufferBuilder(device, allocator)
+		.WithBufferUsage(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst)
+		.Build(sizeof(GPUInstance) * maxInstances, "GPU Driven Instances");
+
+	drawRecordBuffer = BufferBuilder(device, allocator)
+		.WithBufferUsage(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst)
+		.Build(sizeof(GPUDrawRecord) * maxDrawRecords, "GPU Driven Draw Records");
+
+	drawCommandBuffer = BufferBuilder(device, allocator)
+		.WithBufferUsage(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer)
+		.Build(sizeof(vk::DrawIndexedIndirectCommand) * maxDrawRecords, "GPU Driven Draw Commands");
+
+	drawCountBuffer = BufferBuilder(device, allocator)
+		.WithBufferUsage(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer | vk::BufferUsageFlagBits::eTransferDst)
+		.Build(sizeof(uint32_t), "GPU Driven Draw Count");
+
+	cullDataBuffer = BufferBuilder(device, allocator)
+		.WithBufferUsage(vk::BufferUsageFlagBits::eUniformBuffer | vk::BufferUsageFlagBits::eTransferDst)
+		.Build(sizeof(GPUCullData), "GPU Driven Cull Data");
+
+	cullShader		= UniqueVulkanCompute(new VulkanCompute(device, cullShaderFile));
+	cullPipeline	= ComputePipelineBuilder(device)
+		.WithShader(cullShader)
+		.Build("GPU Driven Cull");
+
+	hiZShader		= UniqueVulkanCompute(new VulkanCompute(device, hiZShaderFile));
+	hiZPipeline		= ComputePipelineBuilder(device)
+		.WithShader(hiZShader)
+		.Build("Hi-Z Downsample");
+
+	hiZSampler = device.createSamplerUnique(
+		{
+			.magFilter		= vk::Filter::eNearest,
+			.minFilter		= vk::Filter::eNearest,
+			.mipmapMode		= vk::SamplerMipmapMode::eNearest,
+			.addressModeU	= vk::SamplerAddressMode::eClampToEdge,
+			.addressModeV	= vk::SamplerAddressMode::eClampToEdge,
+			.addressModeW	= vk::SamplerAddressMode::eClampToEdge,
+			.maxLod			= VK_LOD_CLAMP_NONE
+		}
+	);
+
+	cullSet = CreateDescriptorSet(device, renderer.GetDescriptorPool(), cullShader->GetLayout(0));
+	DescriptorSetWriter(device, *cullSet)
+		.WriteBuffer(0, instanceBuffer.buffer	, vk::DescriptorType::eStorageBuffer)
+		.WriteBuffer(1, drawRecordBuffer.buffer	, vk::DescriptorType::eStorageBuffer)
+		.WriteBuffer(2, drawCommandBuffer.buffer, vk::DescriptorType::eStorageBuffer)
+		.WriteBuffer(3, drawCountBuffer.buffer	, vk::DescriptorType::eStorageBuffer)
+		.WriteBuffer(4, cullDataBuffer.buffer	, vk::DescriptorType::eUniformBuffer);
+
+	//Gives the culling set a valid pyramid to point at until there's a depth buffer
+	CreateHiZ(1, 1);
+}
+
+GPUDrivenScene::~GPUDrivenScene() {
+	DestroyHiZ();
+}
+
+uint32_t GPUDrivenScene::AddInstance(const VulkanMesh& mesh, const Matrix4& transform, const Vector4& userData) {
+	if (!MessageAssert(mesh.GetGeometryPool() == &pool, "Mesh isn't in this scene's geometry pool!")) {
+		return UINT32_MAX;
+	}
+	if (!MessageAssert(mesh.GetIndexCount() > 0, "GPU driven scenes can only draw indexed meshes!")) {
+		return UINT32_MAX;
+	}
+	const std::vector<Vector4>& bounds = GetSubMeshBounds(mesh);
+
+	if (instances.size() >= maxInstances || drawRecords.size() + bounds.size() > maxDrawRecords) {
+		std::cout << __FUNCTION__ << " GPU driven scene is full!\n";
+		return UINT32_MAX;
+	}
+	if (!bindingMesh) {
+		bindingMesh = &mesh;
+	}
+	uint32_t instanceIndex = (uint32_t)instances.size();
+	instances.push_back({ transform, userData });
+	firstDirtyInstance	= std::min(firstDirtyInstance, instanceIndex);
+	lastDirtyInstance	= std::max(lastDirtyInstance, instanceIndex);
+
+	for (uint32_t i = 0; i < bounds.size(); ++i) {
+		SubMesh sm = { 0, mesh.GetIndexCount(), 0 };
+		if (mesh.GetSubMeshCount() > 0) {
+			sm = *mesh.GetSubMesh(i);
+		}
+		drawRecords.push_back({
+			.sphereCentre	= Vector3(bounds[i].x, bounds[i].y, bounds[i].z),
+			.sphereRadius	= bounds[i].w,
+			.indexCount		= sm.count,
+			.firstIndex		= mesh.GetFirstIndex() + sm.start,
+			.vertexOffset	= (int32_t)(mesh.GetBaseVertex() + sm.base),
+			.instanceIndex	= instanceIndex
+		});
+	}
+	return instanceIndex;
+}
+
+void GPUDrivenScene::UpdateInstance(uint32_t instance, const Matrix4& transform) {
+	if (instance >= instances.size()) {
+		return;
+	}
+	UpdateInstance(instance, transform, instances[instance].userData);
+}
+
+void GPUDrivenScene::UpdateInstance(uint32_t instance, const Matrix4& transform, const Vector4& userData) {
+	if (instance >= instances.size()) {
+		return;
+	}
+	instances[instance] = { transform, userData };
+	firstDirtyInstance	= std::min(firstDirtyInstance, instance);
+	lastDirtyInstance	= std::max(lastDirtyInstance, instance);
+}
+
+void GPUDrivenScene::Clear() {
+	instances.clear();
+	drawRecords.clear();
+	meshBounds.clear();
+	bindingMesh			= nullptr;
+	firstDirtyInstance	= UINT32_MAX;
+	lastDirtyInstance	= 0;
+	firstDirtyRecord	= 0;
+}
+
+const std::vector<Vector4>& GPUDrivenScene::GetSubMeshBounds(const VulkanMesh& mesh) {
+	auto found = meshBounds.find(&mesh);
+	if (found != meshBounds.end()) {
+		return found->second;
+	}
+	std::vector<Vector4>& bounds = meshBounds[&mesh];
+
+	const std::vector<Vector3>&		 positions	= mesh.GetPositionData();
+	const std::vector<unsigned int>& indices	= mesh.GetIndexData();
+
+	uint32_t subMeshCount = std::max(mesh.GetSubMeshCount(), 1u);
+	for (uint32_t s = 0; s < subMeshCount; ++s) {
+		SubMesh sm = { 0, mesh.GetIndexCount(), 0 };
+		if (mesh.GetSubMeshCount() > 0) {
+			sm = *mesh.GetSubMesh(s);
+		}
+		if (sm.count == 0) {
+			bounds.emplace_back(0.0f, 0.0f, 0.0f, 0.0f);
+			continue;
+		}
+		Vector3 minPos = positions[indices[sm.start] + sm.base];
+		Vector3 maxPos = minPos;
+		for (uint32_t i = sm.start; i < sm.start + sm.count; ++i) {
+			const Vector3& p = positions[indices[i] + sm.base];
+			minPos = Vector3(std::min(minPos.x, p.x), std::min(minPos.y, p.y), std::min(minPos.z, p.z));
+			maxPos = Vector3(std::max(maxPos.x, p.x), std::max(maxPos.y, p.y), std::max(maxPos.z, p.z));
+		}
+		Vector3 centre = (minPos + maxPos) * 0.5f;
+		float	radius = 0.0f;
+		for (uint32_t i = sm.start; i < sm.start + sm.count; ++i) {
+			radius = std::max(radius, Vector::Length(positions[indices[i] + sm.base] - centre));
+		}
+		bounds.emplace_back(centre.x, centre.y, centre.z, radius);
+	}
+	return bounds;
+}
+
+void GPUDrivenScene::WriteBuffer(vk::CommandBuffer cmdBuffer, vk::Buffer buffer, vk::DeviceSize offset, const void* data, size_t byteCount) {
+	StagingAllocation staging = renderer.GetStagingBuffer().Allocate(data, byteCount);
+	if (staging) {
+		cmdBuffer.copyBuffer(staging.buffer, buffer, { { .srcOffset = staging.offset, .dstOffset = offset, .size = byteCount } });
+		return;
+	}
+	//Staging ring is full, so put the data straight into the command buffer instead
+	for (size_t written = 0; written < byteCount; written += MAX_INLINE_UPDATE) {
+		size_t chunkSize = std::min(MAX_INLINE_UPDATE, byteCount - written);
+		cmdBuffer.updateBuffer(buffer, offset + written, chunkSize, (const char*)data + written);
+	}
+}
+
+void GPUDrivenScene::UploadChanges(vk::CommandBuffer cmdBuffer) {
+	if (firstDirtyInstance <= lastDirtyInstance) {
+		size_t count = lastDirtyInstance - firstDirtyInstance + 1;
+		WriteBuffer(cmdBuffer, instanceBuffer.buffer, firstDirtyInstance * sizeof(GPUInstance), &instances[firstDirtyInstance], count * sizeof(GPUInstance));
+		firstDirtyInstance	= UINT32_MAX;
+		lastDirtyInstance	= 0;
+	}
+	//Records are only ever appended, so just the new ones need writing
+	if (firstDirtyRecord < drawRecords.size()) {
+		size_t count = drawRecords.size() - firstDirtyRecord;
+		WriteBuffer(cmdBuffer, drawRecordBuffer.buffer, firstDirtyRecord * sizeof(GPUDrawRecord), &drawRecords[firstDirtyRecord], count * sizeof(GPUDrawRecord));
+		firstDirtyRecord = (uint32_t)drawRecords.size();
+	}
+}
+
+void GPUDrivenScene::Cull(vk::CommandBuffer cmdBuffer, const Matrix4& viewProjMatrix) {
+	ScopedDebugArea debugArea(cmdBuffer, "GPU Driven Cull");
+
+	//The previous frame's draws and culling must be done with the buffers before they are overwritten
+	GlobalMemoryBarrier(cmdBuffer,
+		vk::PipelineStageFlagBits2::eDrawIndirect | vk::PipelineStageFlagBits2::eVertexShader | vk::PipelineStageFlagBits2::eComputeShader,
+		vk::AccessFlagBits2::eIndirectCommandRead | vk::AccessFlagBits2::eShaderRead,
+		vk::PipelineStageFlagBits2::eTransfer | vk::PipelineStageFlagBits2::eComputeShader,
+		vk::AccessFlagBits2::eTransferWrite | vk::AccessFlagBits2::eShaderWrite);
+
+	UploadChanges(cmdBuffer);
+
+	GPUCullData cullData = {
+		.viewProjMatrix		= viewProjMatrix,
+		.hiZSize			= hiZMipSizes.empty() ? Vector2() : Vector2((float)hiZMipSizes[0].x, (float)hiZMipSizes[0].y),
+		.drawCount			= (uint32_t)drawRecords.size(),
+		.occlusionCulling	= (occlusionCulling && hiZValid) ? 1u : 0u
+	};
+	cmdBuffer.updateBuffer(cullDataBuffer.buffer, 0, sizeof(GPUCullData), &cullData);
+	cmdBuffer.fillBuffer(drawCountBuffer.buffer, 0, sizeof(uint32_t), 0);
+
+	GlobalMemoryBarrier(cmdBuffer,
+		vk::PipelineStageFlagBits2::eTransfer, vk::AccessFlagBits2::eTransferWrite,
+		vk::PipelineStageFlagBits2::eComputeShader | vk::PipelineStageFlagBits2::eVertexShader,
+		vk::AccessFlagBits2::eShaderRead | vk::AccessFlagBits2::eUniformRead | vk::AccessFlagBits2::eShaderWrite);
+
+	if (!drawRecords.empty()) {
+		uint32_t groupSize = std::max(cullShader->GetThreadCount().x, 1);
+
+		cmdBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, cullPipeline);
+		cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, *cullPipeline.layout, 0, 1, &*cullSet, 0, nullptr);
+		cmdBuffer.dispatch(((uint32_t)drawRecords.size() + groupSize - 1) / groupSize, 1, 1);
+	}
+
+	GlobalMemoryBarrier(cmdBuffer,
+		vk::PipelineStageFlagBits2::eComputeShader, vk::AccessFlagBits2::eShaderWrite,
+		vk::PipelineStageFlagBits2::eDrawIndirect, vk::AccessFlagBits2::eIndirectCommandRead);
+}
+
+void GPUDrivenScene::Draw(vk::CommandBuffer cmdBuffer) {
+	if (!bindingMesh || drawRecords.empty()) {
+		return;
+	}
+	bindingMesh->BindToCommandBuffer(cmdBuffer);
+	cmdBuffer.drawIndexedIndirectCount(drawCommandBuffer.buffer, 0, drawCountBuffer.buffer, 0,
+		(uint32_t)drawRecords.size(), sizeof(vk::DrawIndexedIndirectCommand));
+}
+
+void GPUDrivenScene::SetDepthBuffer(vk::ImageView inDepthView, uint32_t width, uint32_t height) {
+	CreateHiZ(width, height);
+	depthView = inDepthView;
+	DescriptorSetWriter(device, *hiZSets[0])
+		.WriteImage(0, depthView, *hiZSampler, vk::ImageLayout::eDepthStencilReadOnlyOptimal);
+}
+
+void GPUDrivenScene::CreateHiZ(uint32_t width, uint32_t height) {
+	//Frames still in flight may be building or sampling the old pyramid through
+	//the cull set, and this is only done on a resize, so just wait for them
+	if (hiZImage) {
+		device.waitIdle();
+	}
+	DestroyHiZ();
+
+	uint32_t mipCount = (uint32_t)std::floor(std::log2((float)std::max(width, height))) + 1;
+
+	vk::ImageCreateInfo createInfo = vk::ImageCreateInfo()
+		.setImageType(vk::ImageType::e2D)
+		.setExtent(vk::Extent3D(width, height, 1))
+		.setFormat(vk::Format::eR32Sfloat)
+		.setUsage(vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eSampled)
+		.setMipLevels(mipCount)
+		.setArrayLayers(1);
+
+	VmaAllocationCreateInfo vmaallocInfo = {};
+	vmaallocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+	vmaCreateImage(renderer.GetMemoryAllocator(), (VkImageCreateInfo*)&createInfo, &vmaallocInfo, (VkImage*)&hiZImage, &hiZAllocation, nullptr);
+	SetDebugName(device, vk::ObjectType::eImage, GetVulkanHandle(hiZImage), "Hi-Z Pyramid");
+
+	vk::ImageViewCreateInfo viewInfo = vk::ImageViewCreateInfo()
+		.setViewType(vk::ImageViewType::e2D)
+		.setFormat(vk::Format::eR32Sfloat)
+		.setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, mipCount, 0, 1))
+		.setImage(hiZImage);
+	hiZView = device.createImageViewUnique(viewInfo);
+
+	for (uint32_t mip = 0; mip < mipCount; ++mip) {
+		viewInfo.setSubresourceRange(vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, mip, 1, 0, 1));
+		hiZMipViews.push_back(device.createImageViewUnique(viewInfo));
+		hiZMipSizes.push_back(Vector2ui(std::max(width >> mip, 1u), std::max(height >> mip, 1u)));
+
+		hiZSets.push_back(CreateDescriptorSet(device, renderer.GetDescriptorPool(), hiZShader->GetLayout(0)));
+		DescriptorSetWriter writer(device, *hiZSets.back());
+		writer.WriteStorageImage(1, *hiZMipViews[mip], {}, vk::ImageLayout::eGeneral);
+		//Mip 0 reads from the depth buffer, set when there is one
+		if (mip > 0) {
+			writer.WriteImage(0, *hiZMipViews[mip - 1], *hiZSampler, vk::ImageLayout::eGeneral);
+		}
+	}
+	//The pyramid stays in the general layout, as it's written and sampled by compute
+	vk::UniqueCommandBuffer cmdBuffer = CmdBufferCreateBegin(device, renderer.GetCommandPool(CommandType::Graphics), "Hi-Z Creation");
+	ImageTransitionBarrier(*cmdBuffer, hiZImage, vk::ImageLayout::eUndefined, vk::ImageLayout::eGeneral, vk::ImageAspectFlagBits::eColor,
+		vk::PipelineStageFlagBits2::eTopOfPipe, vk::PipelineStageFlagBits2::eComputeShader);
+	CmdBufferEndSubmitWait(*cmdBuffer, device, renderer.GetQueue(CommandType::Graphics));
+
+	DescriptorSetWriter(device, *cullSet)
+		.WriteImage(5, *hiZView, *hiZSampler, vk::ImageLayout::eGeneral);
+	hiZValid = false;
+}
+
+void GPUDrivenScene::DestroyHiZ() {
+	hiZSets.clear();
+	hiZMipViews.clear();
+	hiZMipSizes.clear();
+	hiZView.reset();
+	if (hiZImage) {
+		vmaDestroyImage(renderer.GetMemoryAllocator(), hiZImage, hiZAllocation);
+		hiZImage = nullptr;
+	}
+	depthView = nullptr;
+	hiZValid	= false;
+}
+
+void GPUDrivenScene::BuildHiZ(vk::CommandBuffer cmdBuffer) {
+	if (!depthView) {
+		return;
+	}
+	ScopedDebugArea debugArea(cmdBuffer, "Hi-Z Build");
+
+	Vector3i threads = hiZShader->GetThreadCount();
+	uint32_t groupX = std::max(threads.x, 1);
+	uint32_t groupY = std::max(threads.y, 1);
+
+	//Last frame's culling must have finished reading the pyramid
+	GlobalMemoryBarrier(cmdBuffer,
+		vk::PipelineStageFlagBits2::eComputeShader, vk::AccessFlagBits2::eShaderSampledRead,
+		vk::PipelineStageFlagBits2::eComputeShader, vk::AccessFlagBits2::eShaderStorageWrite);
+
+	cmdBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, hiZPipeline);
+	for (uint32_t mip = 0; mip < hiZMipViews.size(); ++mip) {
+		if (mip > 0) {
+			//Each mip is made from the one before it
+			ImageTransitionBarrier(cmdBuffer, hiZImage, {
+				.srcStageMask	= vk::PipelineStageFlagBits2::eComputeShader,
+				.srcAccessMask	= vk::AccessFlagBits2::eShaderStorageWrite,
+				.dstStageMask	= vk::PipelineStageFlagBits2::eComputeShader,
+				.dstAccessMask	= vk::AccessFlagBits2::eShaderSampledRead,
+				.oldLayout		= vk::ImageLayout::eGeneral,
+				.newLayout		= vk::ImageLayout::eGeneral,
+				.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.subresourceRange = { vk::ImageAspectFlagBits::eColor, mip - 1, 1, 0, 1 }
+			});
+		}
+		const Vector2ui& size = hiZMipSizes[mip];
+		cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, *hiZPipeline.layout, 0, 1, &*hiZSets[mip], 0, nullptr);
+		cmdBuffer.pushConstants(*hiZPipeline.layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(Vector2ui), &size);
+		cmdBuffer.dispatch((size.x + groupX - 1) / groupX, (size.y + groupY - 1) / groupY, 1);
+	}
+	GlobalMemoryBarrier(cmdBuffer,
+		vk::PipelineStageFlagBits2::eComputeShader, vk::AccessFlagBits2::eShaderStorageWrite,
+		vk::PipelineStageFlagBits2::eComputeShader, vk::AccessFlagBits2::eShaderSampledRead);
+
+	hiZValid = true;
+}
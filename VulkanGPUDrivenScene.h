@@ -0,0 +1,157 @@
+/******************************************************************************
+This file is part of the Newcastle Vulkan Tutorial Series
+
+Author:Rich Davison
+Contact:richgdavison@gmail.com
+License: MIT (see LICENSE file at the top of the source tree)
+*//////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "VulkanBuffers.h"
+#include "VulkanPipeline.h"
+#include "SmartTypes.h"
+
+namespace NCL::Rendering::Vulkan {
+	class VulkanRenderer;
+	class VulkanMesh;
+	class GeometryPool;
+
+	//Per instance data, read by the culling shader and the vertex shader via gl_InstanceIndex
+	struct GPUInstance {
+		Maths::Matrix4	modelMatrix;
+		Maths::Vector4	userData;
+	};
+
+	//A single submesh of a single instance, laid out to match std430 rules
+	struct GPUDrawRecord {
+		Maths::Vector3	sphereCentre;	//In object space
+		float			sphereRadius;
+		uint32_t		indexCount;
+		uint32_t		firstIndex;
+		int32_t			vertexOffset;
+		uint32_t		instanceIndex;
+	};
+
+	//Written into a uniform buffer by Cull
+	struct GPUCullData {
+		Maths::Matrix4	viewProjMatrix;
+		Maths::Vector2	hiZSize;
+		uint32_t		drawCount;
+		uint32_t		occlusionCulling;
+	};
+
+	/*
+	GPUDrivenScene: Draws many instances of meshes stored in a GeometryPool,
+	without the CPU having to record a draw for each of them. Every submesh
+	of every instance has a draw record, and each frame a compute shader
+	tests these against the frustum, and optionally a Hi-Z pyramid made from
+	the previous frame's depth buffer, writing a VkDrawIndexedIndirectCommand
+	for each one that passes. Draw then consumes these with a single
+	drawIndexedIndirectCount call.
+
+	The culling shader is expected to have a thread per draw record, with:
+	set 0 binding 0 - GPUInstance buffer
+	set 0 binding 1 - GPUDrawRecord buffer
+	set 0 binding 2 - output VkDrawIndexedIndirectCommand buffer
+	set 0 binding 3 - output draw count, appended to atomically
+	set 0 binding 4 - GPUCullData uniform buffer
+	set 0 binding 5 - Hi-Z pyramid sampler
+	with each command's firstInstance set to the record's instanceIndex. The
+	Hi-Z shader takes a source sampler at binding 0, writes its destination
+	storage image at binding 1, and has its destination size pushed as a
+	uvec2. The pyramid stores the furthest depth of each region.
+
+	All meshes should have the same vertex attributes, as Draw binds the
+	pool's buffers via the first mesh added.
+	*/
+	class GPUDrivenScene	{
+	public:
+		GPUDrivenScene(VulkanRenderer& renderer, GeometryPool& pool, uint32_t maxInstances, uint32_t maxDrawRecords,
+			const std::string& cullShader = "GPUDrivenCull.comp.spv", const std::string& hiZShader = "HiZDownsample.comp.spv");
+		~GPUDrivenScene();
+
+		//Returns the new instance's index, or UINT32_MAX if the scene is full
+		uint32_t	AddInstance(const VulkanMesh& mesh, const Maths::Matrix4& transform, const Maths::Vector4& userData = {});
+		void		UpdateInstance(uint32_t instance, const Maths::Matrix4& transform);
+		void		UpdateInstance(uint32_t instance, const Maths::Matrix4& transform, const Maths::Vector4& userData);
+		void		Clear();
+
+		//Must be called before Hi-Z culling can be used, and again whenever the depth buffer is recreated,
+		//which waits for the device to go idle. The depth image is read in the DepthStencilReadOnlyOptimal layout
+		void		SetDepthBuffer(vk::ImageView depthView, uint32_t width, uint32_t height);
+		void		SetOcclusionCulling(bool state) {
+			occlusionCulling = state;
+		}
+
+		//Records any instance changes and the culling pass. Must be outside of a render pass, and in the
+		//renderer's frame command buffer, as changes are staged through the renderer's staging ring
+		void		Cull(vk::CommandBuffer cmdBuffer, const Maths::Matrix4& viewProjMatrix);
+		//Draws everything that survived culling, with whatever graphics pipeline is currently bound
+		void		Draw(vk::CommandBuffer cmdBuffer);
+		//Builds the Hi-Z pyramid from the depth buffer, which must be in a shader readable layout
+		void		BuildHiZ(vk::CommandBuffer cmdBuffer);
+
+		uint32_t	GetInstanceCount() const {
+			return (uint32_t)instances.size();
+		}
+		uint32_t	GetDrawRecordCount() const {
+			return (uint32_t)drawRecords.size();
+		}
+		vk::Buffer	GetInstanceBuffer() const {
+			return instanceBuffer.buffer;
+		}
+		vk::Buffer	GetDrawCommandBuffer() const {
+			return drawCommandBuffer.buffer;
+		}
+		vk::Buffer	GetDrawCountBuffer() const {
+			return drawCountBuffer.buffer;
+		}
+
+	protected:
+		void	UploadChanges(vk::CommandBuffer cmdBuffer);
+		void	WriteBuffer(vk::CommandBuffer cmdBuffer, vk::Buffer buffer, vk::DeviceSize offset, const void* data, size_t byteCount);
+		void	CreateHiZ(uint32_t width, uint32_t height);
+		void	DestroyHiZ();
+		const std::vector<Maths::Vector4>& GetSubMeshBounds(const VulkanMesh& mesh);
+
+		VulkanRenderer&	renderer;
+		GeometryPool&	pool;
+		vk::Device		device;
+
+		const VulkanMesh* bindingMesh;
+
+		uint32_t		maxInstances;
+		uint32_t		maxDrawRecords;
+		bool			occlusionCulling;
+
+		std::vector<GPUInstance>	instances;
+		std::vector<GPUDrawRecord>	drawRecords;
+		uint32_t					firstDirtyInstance;
+		uint32_t					lastDirtyInstance;
+		uint32_t					firstDirtyRecord;
+
+		std::map<const VulkanMesh*, std::vector<Maths::Vector4>> meshBounds;
+
+		VulkanBuffer	instanceBuffer;
+		VulkanBuffer	drawRecordBuffer;
+		VulkanBuffer	drawCommandBuffer;
+		VulkanBuffer	drawCountBuffer;
+		VulkanBuffer	cullDataBuffer;
+
+		UniqueVulkanCompute		cullShader;
+		VulkanPipeline			cullPipeline;
+		vk::UniqueDescriptorSet	cullSet;
+
+		UniqueVulkanCompute		hiZShader;
+		VulkanPipeline			hiZPipeline;
+		vk::UniqueSampler		hiZSampler;
+
+		vk::Image						hiZImage;
+		VmaAllocation					hiZAllocation;
+		vk::UniqueImageView				hiZView;
+		std::vector<vk::UniqueImageView>		hiZMipViews;
+		std::vector<vk::UniqueDescriptorSet>	hiZSets;
+		std::vector<Maths::Vector2ui>			hiZMipSizes;
+		vk::ImageView					depthView;
+		bool							hiZValid;
+	};
+}
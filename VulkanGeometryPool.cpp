@@ -0,0 +1,235 @@
+/******************************************************************************
+This file is part of the Newcastle Vulkan Tutorial Series
+
+Author:Rich Davison
+Contact:richgdavison@gmail.com
+License: MIT (see LICENSE file at the top of the source tree)
+*//////////////////////////////////////////////////////////////////////////////
+#include "VulkanGeometryPool.h"
+#include "VulkanMesh.h"
+#include "VulkanRenderer.h"
+#include "VulkanBufferBuilder.h"
+#include "VulkanStagingRingBuffer.h"
+#include "VulkanUploadScheduler.h"
+#include "VulkanUtils.h"
+
+using namespace NCL;
+using namespace Rendering;
+using namespace Vulkan;
+
+//Keeps each stream suitably aligned for any use of the buffer
+const size_t STREAM_ALIGNMENT = 256;
+
+GeometryPool::GeometryPool(vk::Device device, VmaAllocator allocator, uint32_t vertexCapacity, uint32_t indexCapacity,
+	uint32_t inAttributeMask, const VertexFormat& format, vk::IndexType inIndexType, vk::BufferUsageFlags extraUses, const std::string& inDebugName) {
+	attributeMask	= inAttributeMask & ((1 << VertexAttribute::MAX_ATTRIBUTES) - 1);
+	debugName		= inDebugName;
+	vertexFormat	= format;
+	indexType		= inIndexType;
+
+	if (!MessageAssert(vertexFormat.streams == VertexFormat::Separate, "Geometry pools store each attribute in a separate stream!")) {
+		vertexFormat.streams = VertexFormat::Separate;
+	}
+
+	vertexRanges.Reset(vertexCapacity);
+	indexRanges.Reset(indexCapacity);
+
+	size_t byteSize = 0;
+	for (uint32_t i = 0; i < VertexAttribute::MAX_ATTRIBUTES; ++i) {
+		streamOffsets[i] = 0;
+		if (!HasStream((VertexAttribute::Type)i)) {
+			continue;
+		}
+		byteSize = ((byteSize + STREAM_ALIGNMENT - 1) / STREAM_ALIGNMENT) * STREAM_ALIGNMENT;
+		streamOffsets[i] = byteSize;
+		byteSize += VulkanMesh::GetAttributeSize((VertexAttribute::Type)i, vertexFormat) * vertexCapacity;
+	}
+	byteSize = ((byteSize + STREAM_ALIGNMENT - 1) / STREAM_ALIGNMENT) * STREAM_ALIGNMENT;
+	indexRegionOffset = byteSize;
+	byteSize += VulkanMesh::GetIndexSize(indexType) * indexCapacity;
+
+	buffer = BufferBuilder(device, allocator)
+		.WithBufferUsage(	vk::BufferUsageFlagBits::eVertexBuffer	|
+							vk::BufferUsageFlagBits::eIndexBuffer	|
+							vk::BufferUsageFlagBits::eTransferDst	|
+							vk::BufferUsageFlagBits::eStorageBuffer |
+							extraUses)
+		.Build(byteSize, debugName);
+}
+
+GeometryPool::~GeometryPool() {
+}
+
+bool GeometryPool::ReserveMesh(VulkanMesh& mesh, std::vector<const char*>& attributeDataSources) {
+	if (mesh.sourcePool) {
+		mesh.sourcePool->Release(mesh);
+	}
+	//Done first, as it can change how many vertices the mesh needs space for
+	mesh.OptimiseBeforeUpload();
+	attributeDataSources.clear();
+	mesh.SetVertexFormat(vertexFormat);
+	mesh.BuildVertexInputState(attributeDataSources);
+
+	for (VertexAttribute::Type attribute : mesh.usedAttributes) {
+		if (!MessageAssert(HasStream(attribute), "Mesh has an attribute the geometry pool doesn't store!")) {
+			return false;
+		}
+	}
+	if (mesh.HasMeshlets()) {
+		std::cout << __FUNCTION__ << " mesh " << mesh.debugName << " has meshlets, which geometry pool " << debugName << " doesn't store\n";
+	}
+	if (mesh.GetIndexCount() > 0 && indexType == vk::IndexType::eUint16 && mesh.GetSmallestIndexType() != vk::IndexType::eUint16) {
+		std::cout << __FUNCTION__ << " mesh " << mesh.debugName << " has too many vertices for 16 bit geometry pool " << debugName << "\n";
+		return false;
+	}
+	size_t vertexStart = 0;
+	size_t indexStart	= 0;
+	if (!vertexRanges.Allocate(mesh.GetVertexCount(), 1, vertexStart)) {
+		std::cout << __FUNCTION__ << " geometry pool " << debugName << " is out of vertex space!\n";
+		return false;
+	}
+	if (mesh.GetIndexCount() > 0 && !indexRanges.Allocate(mesh.GetIndexCount(), 1, indexStart)) {
+		std::cout << __FUNCTION__ << " geometry pool " << debugName << " is out of index space!\n";
+		vertexRanges.Free(vertexStart, mesh.GetVertexCount());
+		return false;
+	}
+	mesh.sourcePool	= this;
+	mesh.baseVertex	= (uint32_t)vertexStart;
+	mesh.firstIndex	= (uint32_t)indexStart;
+
+	//Every pooled mesh binds the same offsets, it's the draw parameters that differ
+	for (VertexAttribute::Type attribute : mesh.usedAttributes) {
+		mesh.usedBuffers.push_back(buffer.buffer);
+		mesh.usedOffsets.push_back(streamOffsets[attribute]);
+	}
+	if (mesh.GetIndexCount() > 0) {
+		mesh.indexBuffer	= buffer.buffer;
+		mesh.indexOffset	= indexRegionOffset;
+		mesh.indexType		= GetIndexType();
+	}
+	//Any buffer from a previous standalone upload is no longer needed
+	VulkanBuffer oldBuffer = std::move(mesh.gpuBuffer);
+	return true;
+}
+
+void GeometryPool::Release(VulkanMesh& mesh) {
+	if (mesh.sourcePool != this) {
+		return;
+	}
+	vertexRanges.Free(mesh.baseVertex, mesh.GetVertexCount());
+	if (mesh.GetIndexCount() > 0) {
+		indexRanges.Free(mesh.firstIndex, mesh.GetIndexCount());
+	}
+	mesh.sourcePool = nullptr;
+	mesh.baseVertex = 0;
+	mesh.firstIndex = 0;
+	mesh.usedBuffers.clear();
+	mesh.usedOffsets.clear();
+	mesh.indexBuffer = nullptr;
+}
+
+size_t GeometryPool::GetMeshByteCount(const VulkanMesh& mesh) const {
+	size_t byteCount = 0;
+	for (VertexAttribute::Type attribute : mesh.usedAttributes) {
+		byteCount += VulkanMesh::GetAttributeSize(attribute, vertexFormat) * mesh.GetVertexCount();
+	}
+	return byteCount + VulkanMesh::GetIndexSize(indexType) * mesh.GetIndexCount();
+}
+
+void GeometryPool::WriteMesh(VulkanMesh& mesh, const std::vector<const char*>& attributeDataSources, char* stagingData, vk::DeviceSize stagingOffset, std::vector<vk::BufferCopy>& regions) {
+	size_t offset = 0;
+	for (size_t i = 0; i < mesh.usedAttributes.size(); ++i) {
+		size_t attributeSize	= VulkanMesh::GetAttributeSize(mesh.usedAttributes[i], vertexFormat);
+		size_t copySize			= attributeSize * mesh.GetVertexCount();
+
+		mesh.WriteAttribute(mesh.usedAttributes[i], attributeDataSources[i], stagingData + offset, attributeSize);
+		regions.push_back({
+			.srcOffset	= stagingOffset + offset,
+			.dstOffset	= streamOffsets[mesh.usedAttributes[i]] + (mesh.baseVertex * attributeSize),
+			.size		= copySize
+		});
+		offset += copySize;
+	}
+	if (mesh.GetIndexCount() > 0) {
+		size_t indexSize	= VulkanMesh::GetIndexSize(indexType);
+		size_t copySize		= indexSize * mesh.GetIndexCount();
+		mesh.WriteIndices(stagingData + offset, indexType);
+		regions.push_back({
+			.srcOffset	= stagingOffset + offset,
+			.dstOffset	= indexRegionOffset + (mesh.firstIndex * indexSize),
+			.size		= copySize
+		});
+	}
+}
+
+bool GeometryPool::Upload(VulkanRenderer& renderer, const std::vector<VulkanMesh*>& meshes) {
+	vk::Device		device	= renderer.GetDevice();
+	vk::Queue		queue	= renderer.GetQueue(CommandType::Graphics);
+	StagingRingBuffer& stagingRing = renderer.GetStagingBuffer();
+	StagingOwner stagingOwner = stagingRing.NewOwner();
+
+	vk::UniqueCommandBuffer cmdBuffer = CmdBufferCreateBegin(device, renderer.GetCommandPool(CommandType::Graphics), debugName + " upload");
+
+	std::vector<VulkanBuffer>	dedicatedStaging;
+	std::vector<vk::BufferCopy> regions;
+	std::vector<const char*>	attributeDataSources;
+	bool allUploaded = true;
+
+	for (VulkanMesh* mesh : meshes) {
+		assert(mesh->ValidateMeshData());
+		if (!ReserveMesh(*mesh, attributeDataSources)) {
+			allUploaded = false;
+			continue;
+		}
+		size_t byteCount = GetMeshByteCount(*mesh);
+		StagingAllocation staging = stagingRing.Allocate(byteCount, 16, stagingOwner);
+
+		if (!staging && stagingRing.HasUnfencedAllocations(stagingOwner)) {
+			//Ring is full of this batch, so submit what we have so far to free it up
+			CmdBufferEndSubmitWait(*cmdBuffer, device, queue, stagingRing.FenceAllocations(stagingOwner));
+			stagingRing.Reclaim();
+			dedicatedStaging.clear();
+			CmdBufferResetBegin(*cmdBuffer);
+			staging = stagingRing.Allocate(byteCount, 16, stagingOwner);
+		}
+		if (!staging) {
+			dedicatedStaging.push_back(BufferBuilder(device, renderer.GetMemoryAllocator())
+				.WithBufferUsage(vk::BufferUsageFlagBits::eTransferSrc)
+				.WithHostVisibility()
+				.WithPersistentMapping()
+				.Build(byteCount, "Staging Buffer"));
+			staging = {
+				.buffer = dedicatedStaging.back().buffer,
+				.offset = 0,
+				.size	= byteCount,
+				.data	= (char*)dedicatedStaging.back().Data()
+			};
+		}
+		regions.clear();
+		WriteMesh(*mesh, attributeDataSources, staging.data, staging.offset, regions);
+		cmdBuffer->copyBuffer(staging.buffer, buffer.buffer, regions);
+	}
+	CmdBufferEndSubmitWait(*cmdBuffer, device, queue, stagingRing.FenceAllocations(stagingOwner));
+	return allUploaded;
+}
+
+uint64_t GeometryPool::Upload(UploadScheduler& scheduler, const std::vector<VulkanMesh*>& meshes) {
+	uint64_t ticket = 0;
+	std::vector<vk::BufferCopy> regions;
+	std::vector<const char*>	attributeDataSources;
+
+	for (VulkanMesh* mesh : meshes) {
+		assert(mesh->ValidateMeshData());
+		if (!ReserveMesh(*mesh, attributeDataSources)) {
+			continue;
+		}
+		StagingAllocation staging = scheduler.AllocateStaging(GetMeshByteCount(*mesh));
+		regions.clear();
+		WriteMesh(*mesh, attributeDataSources, staging.data, staging.offset, regions);
+
+		//All of a mesh's regions share one staging allocation, so they must go in the same batch
+		ticket = scheduler.CopyBuffer(staging, buffer.buffer, regions, vk::PipelineStageFlagBits2::eAllCommands,
+			vk::AccessFlagBits2::eVertexAttributeRead | vk::AccessFlagBits2::eIndexRead | vk::AccessFlagBits2::eShaderStorageRead);
+	}
+	return ticket;
+}
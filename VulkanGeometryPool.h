@@ -0,0 +1,99 @@
+/******************************************************************************
+This file is part of the Newcastle Vulkan Tutorial Series
+
+Author:Rich Davison
+Contact:richgdavison@gmail.com
+License: MIT (see LICENSE file at the top of the source tree)
+*//////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "../NCLCoreClasses/Mesh.h"
+#include "VulkanBuffers.h"
+#include "VulkanRangeAllocator.h"
+#include "VulkanMesh.h"
+
+namespace NCL::Rendering::Vulkan {
+	class VulkanRenderer;
+	class UploadScheduler;
+
+	/*
+	GeometryPool: A few large buffers that many meshes can share, instead of
+	each having their own allocation. The vertex buffer is split into one
+	stream per vertex attribute, and meshes are given a range of vertices that
+	is the same in every stream, along with a range of the index buffer.
+	As each attribute has its own stream, the pool's VertexFormat must use
+	the Separate layout, but can still use the compressed formats. Indices
+	are relative to each mesh's baseVertex, so a pool of 16 bit indices can
+	hold any mesh of up to 65535 vertices.
+
+	Meshes in a pool record their baseVertex and firstIndex, and all use the
+	same buffer and offsets per attribute, so once one mesh has been bound,
+	any others with the same attributes can be drawn after it, or via
+	multi-draw / indirect commands, without rebinding anything.
+
+	A mesh's range is freed when it is deleted, so as with a mesh's own
+	buffer, it's up to the user to ensure the GPU has finished with it first.
+	The pool must outlive any meshes placed in it.
+	*/
+	class GeometryPool	{
+	public:
+		GeometryPool(vk::Device device, VmaAllocator allocator, uint32_t vertexCapacity, uint32_t indexCapacity,
+			uint32_t attributeMask = ~0u, const VertexFormat& format = {}, vk::IndexType indexType = vk::IndexType::eUint32,
+			vk::BufferUsageFlags extraUses = {}, const std::string& debugName = "Geometry Pool");
+		~GeometryPool();
+
+		//Uploads the meshes via the renderer's staging buffer, waiting until they're complete
+		bool		Upload(VulkanRenderer& renderer, const std::vector<VulkanMesh*>& meshes);
+		//Streams the meshes in via the copy queue, returning the scheduler ticket to wait for
+		uint64_t	Upload(UploadScheduler& scheduler, const std::vector<VulkanMesh*>& meshes);
+
+		void		Release(VulkanMesh& mesh);
+
+		vk::Buffer	GetBuffer() const {
+			return buffer.buffer;
+		}
+		vk::DeviceAddress GetDeviceAddress() const {
+			return buffer.deviceAddress;
+		}
+		vk::DeviceSize	GetStreamOffset(VertexAttribute::Type attribute) const {
+			return streamOffsets[attribute];
+		}
+		vk::DeviceSize	GetIndexOffset() const {
+			return indexRegionOffset;
+		}
+		vk::IndexType	GetIndexType() const {
+			return indexType;
+		}
+		const VertexFormat& GetVertexFormat() const {
+			return vertexFormat;
+		}
+		bool HasStream(VertexAttribute::Type attribute) const {
+			return attributeMask & (1 << attribute);
+		}
+
+		size_t GetFreeVertexCount() const {
+			return vertexRanges.GetFreeSpace();
+		}
+		size_t GetFreeIndexCount() const {
+			return indexRanges.GetFreeSpace();
+		}
+
+	protected:
+		bool	ReserveMesh(VulkanMesh& mesh, std::vector<const char*>& attributeDataSources);
+		size_t	GetMeshByteCount(const VulkanMesh& mesh) const;
+		//Copies a reserved mesh's data into staging memory, and describes where each part of it needs to go
+		void	WriteMesh(VulkanMesh& mesh, const std::vector<const char*>& attributeDataSources, char* stagingData, vk::DeviceSize stagingOffset, std::vector<vk::BufferCopy>& regions);
+
+		VulkanBuffer	buffer;
+
+		vk::DeviceSize	streamOffsets[VertexAttribute::MAX_ATTRIBUTES];
+		vk::DeviceSize	indexRegionOffset;
+		uint32_t		attributeMask;
+		VertexFormat	vertexFormat;
+		vk::IndexType	indexType;
+
+		RangeAllocator	vertexRanges;	//In vertices, not bytes
+		RangeAllocator	indexRanges;	//In indices
+
+		std::string		debugName;
+	};
+}
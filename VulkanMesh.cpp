@@ -9,10 +9,16 @@ License: MIT (see LICENSE file at the top of the source tree)
 #include "Vulkanrenderer.h"
 #include "VulkanUtils.h"
 #include "VulkanBufferBuilder.h"
+#include "VulkanUploadScheduler.h"
+#include "VulkanGeometryPool.h"
+#include "VulkanCommandEncoder.h"
 
 using namespace NCL;
 using namespace Rendering;
 using namespace Vulkan;
+using namespace Maths;
+
+const size_t MESHLET_ALIGNMENT = 16;
 
 //These are both carefully arranged to match the MeshBuffer enum class!
 vk::Format attributeFormats[] = { 
@@ -39,15 +45,154 @@ VulkanMesh::VulkanMesh()	{
 }
 
 VulkanMesh::~VulkanMesh()	{
+	if (sourcePool) {
+		sourcePool->Release(*this);
+	}
 }
 
-void VulkanMesh::UploadToGPU(RendererBase* r, vk::BufferUsageFlags extraUses) {
-	assert(ValidateMeshData());
+size_t VulkanMesh::GetAttributeSize(VertexAttribute::Type attribute, const VertexFormat& format) {
+	switch (attribute) {
+		case VertexAttribute::TextureCoords:	return format.halfFloatTexCoords ? sizeof(uint16_t) * 2 : attributeSizes[attribute];
+		case VertexAttribute::Normals:			return format.octahedralNormals	? sizeof(int16_t) * 2	: attributeSizes[attribute];
+		case VertexAttribute::Tangents:			return format.octahedralNormals	? sizeof(int16_t) * 4	: attributeSizes[attribute];
+		case VertexAttribute::JointWeights:		return format.compressedSkinning ? sizeof(uint16_t) * 4 : attributeSizes[attribute];
+		case VertexAttribute::JointIndices:		return format.compressedSkinning ? sizeof(int16_t) * 4	: attributeSizes[attribute];
+	}
+	return attributeSizes[attribute];
+}
 
-	//TODO: Do we care about supporting 16bit indices?
-	if (GetIndexCount() > 0) {
-		indexType = vk::IndexType::eUint32;
+vk::Format VulkanMesh::GetAttributeFormat(VertexAttribute::Type attribute, const VertexFormat& format) {
+	switch (attribute) {
+		case VertexAttribute::TextureCoords:	return format.halfFloatTexCoords ? vk::Format::eR16G16Sfloat			: attributeFormats[attribute];
+		case VertexAttribute::Normals:			return format.octahedralNormals	? vk::Format::eR16G16Snorm			: attributeFormats[attribute];
+		case VertexAttribute::Tangents:			return format.octahedralNormals	? vk::Format::eR16G16B16A16Snorm	: attributeFormats[attribute];
+		case VertexAttribute::JointWeights:		return format.compressedSkinning ? vk::Format::eR16G16B16A16Unorm	: attributeFormats[attribute];
+		case VertexAttribute::JointIndices:		return format.compressedSkinning ? vk::Format::eR16G16B16A16Sint	: attributeFormats[attribute];
+	}
+	return attributeFormats[attribute];
+}
+
+uint32_t VulkanMesh::GetAttributeStride(VertexAttribute::Type attribute) const {
+	for (uint32_t i = 0; i < usedAttributes.size(); ++i) {
+		if (usedAttributes[i] == attribute) {
+			return attributeBindings[usedBindings[i]].stride;
+		}
+	}
+	return 0;
+}
+
+//Quantisation helpers for the compressed vertex formats
+static uint16_t FloatToHalf(float f) {
+	uint32_t bits;
+	memcpy(&bits, &f, sizeof(float));
+
+	uint32_t sign		= (bits >> 16) & 0x8000;
+	int32_t  exponent	= ((bits >> 23) & 0xFF) - 127 + 15;
+	uint32_t mantissa	= bits & 0x7FFFFF;
+
+	if (exponent <= 0) { //Too small even for a denormal half, so flush to zero
+		if (exponent < -10) {
+			return (uint16_t)sign;
+		}
+		mantissa = (mantissa | 0x800000) >> (1 - exponent);
+		return (uint16_t)(sign | ((mantissa + 0x1000) >> 13));
+	}
+	if (exponent >= 31) { //Clamp to infinity
+		return (uint16_t)(sign | 0x7C00);
+	}
+	uint32_t half = sign | (exponent << 10) | (mantissa >> 13);
+	return (uint16_t)(half + ((mantissa >> 12) & 1)); //Round to nearest
+}
+
+static int16_t FloatToSnorm16(float f) {
+	f = std::clamp(f, -1.0f, 1.0f);
+	return (int16_t)std::round(f * 32767.0f);
+}
+
+static uint16_t FloatToUnorm16(float f) {
+	f = std::clamp(f, 0.0f, 1.0f);
+	return (uint16_t)std::round(f * 65535.0f);
+}
+
+static Vector2 OctahedralEncode(Vector3 n) {
+	float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+	if (l1 == 0.0f) {
+		return Vector2(0, 0);
+	}
+	n = n * (1.0f / l1);
+	if (n.z < 0.0f) { //Fold the lower hemisphere over the diagonals
+		Vector2 folded(
+			(1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f),
+			(1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f)
+		);
+		return folded;
 	}
+	return Vector2(n.x, n.y);
+}
+
+void VulkanMesh::WriteAttribute(VertexAttribute::Type attribute, const char* source, char* dest, size_t destStride) const {
+	size_t		sourceSize	= attributeSizes[attribute];
+	size_t		destSize	= GetAttributeSize(attribute, vertexFormat);
+	uint32_t	count		= GetVertexCount();
+
+	if (sourceSize == destSize) {
+		if (destStride == destSize) {
+			memcpy(dest, source, destSize * count);
+		}
+		else {
+			for (uint32_t v = 0; v < count; ++v) {
+				memcpy(dest + (v * destStride), source + (v * sourceSize), destSize);
+			}
+		}
+		return;
+	}
+	for (uint32_t v = 0; v < count; ++v) {
+		const float*	in	= (const float*)(source + (v * sourceSize));
+		char*			out = dest + (v * destStride);
+
+		switch (attribute) {
+			case VertexAttribute::TextureCoords: {
+				((uint16_t*)out)[0] = FloatToHalf(in[0]);
+				((uint16_t*)out)[1] = FloatToHalf(in[1]);
+			}break;
+			case VertexAttribute::Normals: {
+				Vector2 oct = OctahedralEncode(Vector3(in[0], in[1], in[2]));
+				((int16_t*)out)[0] = FloatToSnorm16(oct.x);
+				((int16_t*)out)[1] = FloatToSnorm16(oct.y);
+			}break;
+			case VertexAttribute::Tangents: {
+				for (int i = 0; i < 4; ++i) {
+					((int16_t*)out)[i] = FloatToSnorm16(in[i]);
+				}
+			}break;
+			case VertexAttribute::JointWeights: {
+				for (int i = 0; i < 4; ++i) {
+					((uint16_t*)out)[i] = FloatToUnorm16(in[i]);
+				}
+			}break;
+			case VertexAttribute::JointIndices: {
+				const int* inIndices = (const int*)in;
+				for (int i = 0; i < 4; ++i) {
+					((int16_t*)out)[i] = (int16_t)inIndices[i];
+				}
+			}break;
+		}
+	}
+}
+
+void VulkanMesh::OptimiseBeforeUpload() {
+	if (optimiseOnUpload) {
+		optimiserStats = MeshOptimiser(optimiserOptions).Optimise(*this);
+		//The optimiser moves vertices and triangles around, which the old meshlets still point at
+		if (HasMeshlets()) {
+			GenerateMeshlets(meshletMaxVertices, meshletMaxPrimitives);
+		}
+	}
+}
+
+void VulkanMesh::UploadToGPU(RendererBase* r, vk::BufferUsageFlags extraUses) {
+	assert(ValidateMeshData());
+	OptimiseBeforeUpload();
 
 	VulkanRenderer* renderer = (VulkanRenderer*)r;
 
@@ -59,6 +204,16 @@ void VulkanMesh::UploadToGPU(RendererBase* r, vk::BufferUsageFlags extraUses) {
 
 	size_t allocationSize = CalculateGPUAllocationSize();
 
+	StagingRingBuffer& stagingRing = renderer->GetStagingBuffer();
+	StagingOwner stagingOwner = stagingRing.NewOwner();
+	StagingAllocation staging = stagingRing.Allocate(allocationSize, 16, stagingOwner);
+
+	if (staging) {
+		UploadToGPU(renderer, *cmdBuffer, staging, extraUses);
+		CmdBufferEndSubmitWait(*cmdBuffer, device, gfxQueue, stagingRing.FenceAllocations(stagingOwner));
+		return;
+	}
+	//Too big for the staging ring, so fall back to a dedicated buffer
 	VulkanBuffer stagingBuffer = BufferBuilder(renderer->GetDevice(), renderer->GetMemoryAllocator())
 		.WithBufferUsage(vk::BufferUsageFlagBits::eTransferSrc)
 		.WithHostVisibility()
@@ -77,22 +232,118 @@ void VulkanMesh::UploadToGPU(RendererBase* r)  {
 }
 
 void VulkanMesh::UploadToGPU(VulkanRenderer* renderer, VkQueue queue, vk::CommandBuffer cmdBuffer, VulkanBuffer& stagingBuffer, vk::BufferUsageFlags extraUses) {
-	usedAttributes.clear();
-	attributeBindings.clear();
-	attributeDescriptions.clear();
+	StagingAllocation staging = {
+		.buffer = stagingBuffer.buffer,
+		.offset = 0,
+		.size	= stagingBuffer.size,
+		.data	= (char*)stagingBuffer.Map()
+	};
+	UploadToGPU(renderer, cmdBuffer, staging, extraUses);
+	stagingBuffer.Unmap();
+}
+
+void VulkanMesh::UploadToGPU(VulkanRenderer* renderer, vk::CommandBuffer cmdBuffer, const StagingAllocation& staging, vk::BufferUsageFlags extraUses) {
+	size_t copySize = PrepareGPUBuffer(renderer, staging.data, staging.size, extraUses);
+
+	{//Now to transfer the mesh data from the staging buffer to the gpu-only buffer
+		vk::BufferCopy copyRegion;
+		copyRegion.srcOffset	= staging.offset;
+		copyRegion.size			= copySize;
+		cmdBuffer.copyBuffer(staging.buffer, gpuBuffer.buffer, copyRegion);
+	}
+}
 
+uint64_t VulkanMesh::UploadToGPU(VulkanRenderer* renderer, UploadScheduler& scheduler, vk::BufferUsageFlags extraUses) {
+	assert(ValidateMeshData());
+	OptimiseBeforeUpload();
+
+	StagingAllocation staging = scheduler.AllocateStaging(CalculateGPUAllocationSize());
+	staging.size = PrepareGPUBuffer(renderer, staging.data, staging.size, extraUses);
+
+	//Mesh buffers may also be read as storage buffers, so this could be any stage
+	return scheduler.CopyBuffer(staging, gpuBuffer.buffer, 0, vk::PipelineStageFlagBits2::eAllCommands,
+		vk::AccessFlagBits2::eVertexAttributeRead | vk::AccessFlagBits2::eIndexRead | vk::AccessFlagBits2::eShaderStorageRead);
+}
+
+size_t VulkanMesh::PrepareGPUBuffer(VulkanRenderer* renderer, char* stagingData, size_t stagingSize, vk::BufferUsageFlags extraUses) {
 	vk::Device sourceDevice = renderer->GetDevice();
 
+	if (sourcePool) {
+		sourcePool->Release(*this);
+	}
+
 	std::vector<const char*> attributeDataSources;//Pointer for each attribute in CPU memory
+	BuildVertexInputState(attributeDataSources);
 
-	size_t vSize = 0;
+	vk::IndexType meshIndexType = GetSmallestIndexType();
+
+	size_t vertexDataSize	= vertexStride * GetVertexCount();
+	size_t indexDataSize	= GetIndexSize(meshIndexType) * GetIndexCount();
+	size_t totalAllocationSize = vertexDataSize + indexDataSize;
+
+	if (HasMeshlets()) {
+		//Meshlets are read via their device address, so keep them aligned after the 16 bit indices
+		meshletDataOffset	= ((totalAllocationSize + MESHLET_ALIGNMENT - 1) / MESHLET_ALIGNMENT) * MESHLET_ALIGNMENT;
+		totalAllocationSize = meshletDataOffset + GetMeshletDataSize();
+		extraUses |= vk::BufferUsageFlagBits::eShaderDeviceAddress;
+	}
+
+	assert(stagingSize >= (totalAllocationSize));
+
+	gpuBuffer = BufferBuilder(sourceDevice, renderer->GetMemoryAllocator())
+		.WithBufferUsage(	vk::BufferUsageFlagBits::eVertexBuffer	| 
+							vk::BufferUsageFlagBits::eIndexBuffer	| 
+							vk::BufferUsageFlagBits::eTransferDst	| 
+							vk::BufferUsageFlagBits::eStorageBuffer |
+							extraUses)
+		.Build(totalAllocationSize, debugName + " mesh Data");
+
+	//need to now copy vertex data to device memory
+	char* dataPtr = stagingData;
+	size_t offset = 0;
+	for (const vk::VertexInputBindingDescription& binding : attributeBindings) {
+		//We're going to use the same buffer for every binding
+		usedBuffers.push_back(gpuBuffer.buffer);
+		//But each binding starts at a different offset
+		usedOffsets.push_back(offset);
+		offset += binding.stride * GetVertexCount();
+	}
+	for (size_t i = 0; i < usedAttributes.size(); ++i) {
+		//Copy the data from CPU to GPU-visible memory, converting it to the vertex format as we go
+		char* attributeStart = dataPtr + usedOffsets[usedBindings[i]] + attributeOffsets[i];
+		WriteAttribute(usedAttributes[i], attributeDataSources[i], attributeStart, attributeBindings[usedBindings[i]].stride);
+	}
+	
+	if (GetIndexCount() > 0) {
+		//Vertex data is always a multiple of 4 bytes, so either index size is aligned here
+		WriteIndices(dataPtr + offset, meshIndexType);
+		indexType		= meshIndexType;
+		indexOffset		= offset;
+		indexBuffer		= gpuBuffer.buffer;
+	}
+	if (HasMeshlets()) {
+		WriteMeshletData(dataPtr + meshletDataOffset);
+	}
+	return totalAllocationSize;
+}
+
+void VulkanMesh::BuildVertexInputState(std::vector<const char*>& attributeDataSources) {
+	usedAttributes.clear();
+	usedBindings.clear();
+	attributeOffsets.clear();
+	usedBuffers.clear();
+	usedOffsets.clear();
+	usedFormats.clear();
+	attributeBindings.clear();
+	attributeDescriptions.clear();
+	attributeMask = 0;
+	vertexStride  = 0;
 
 	auto atrributeFunc = [&](VertexAttribute::Type attribute, size_t count, const char* data) {
 		if (count > 0) {
 			usedAttributes.push_back(attribute);
-			usedFormats.push_back(attributeFormats[attribute]);
+			usedFormats.push_back(GetAttributeFormat(attribute, vertexFormat));
 			attributeDataSources.push_back(data);
-			vSize += attributeSizes[attribute];
 		}
 	};
 
@@ -104,13 +355,31 @@ void VulkanMesh::UploadToGPU(VulkanRenderer* renderer, VkQueue queue, vk::Comman
 	atrributeFunc(VertexAttribute::JointWeights, GetSkinWeightData().size(), (const char*)GetSkinWeightData().data());
 	atrributeFunc(VertexAttribute::JointIndices, GetSkinIndexData().size(), (const char*)GetSkinIndexData().data());
 
+	bool splitPositions = vertexFormat.streams == VertexFormat::PositionSplit && !usedAttributes.empty() && usedAttributes[0] == VertexAttribute::Positions;
+
 	for (uint32_t i = 0; i < usedAttributes.size(); ++i) {
 		//Which vertex attribute slot should Vulkan buffer index i map to?
 		int attributeType = usedAttributes[i];
-		//Describes the vertex attribute state
-		attributeBindings.emplace_back(i, (unsigned int)attributeSizes[attributeType], vk::VertexInputRate::eVertex);
+		uint32_t binding = 0;
+		if (vertexFormat.streams == VertexFormat::Separate) {
+			binding = i;
+		}
+		else if (splitPositions && i > 0) {
+			binding = 1;
+		}
+		if (binding >= attributeBindings.size()) {
+			//Describes the vertex attribute state
+			attributeBindings.emplace_back(binding, 0, vk::VertexInputRate::eVertex);
+		}
+		uint32_t attributeSize = (uint32_t)GetAttributeSize((VertexAttribute::Type)attributeType, vertexFormat);
+
+		usedBindings.push_back(binding);
+		attributeOffsets.push_back(attributeBindings[binding].stride);
 		//Describes the vertex attribute data type and offset
-		attributeDescriptions.emplace_back(attributeType, i, attributeFormats[attributeType], 0);
+		attributeDescriptions.emplace_back(attributeType, binding, usedFormats[i], attributeBindings[binding].stride);
+
+		attributeBindings[binding].stride += attributeSize;
+		vertexStride += attributeSize;
 
 		attributeMask |= (1 << attributeType);
 	}
@@ -125,54 +394,27 @@ void VulkanMesh::UploadToGPU(VulkanRenderer* renderer, VkQueue queue, vk::Comman
 		}
 	);
 
-	size_t vertexDataSize	= vSize * GetVertexCount();
-	size_t indexDataSize	= sizeof(int) * GetIndexCount();
-	size_t totalAllocationSize = vertexDataSize + indexDataSize;
-
-	assert(stagingBuffer.size >= (totalAllocationSize));
-
-	gpuBuffer = BufferBuilder(sourceDevice, renderer->GetMemoryAllocator())
-		.WithBufferUsage(	vk::BufferUsageFlagBits::eVertexBuffer	| 
-							vk::BufferUsageFlagBits::eIndexBuffer	| 
-							vk::BufferUsageFlagBits::eTransferDst	| 
-							vk::BufferUsageFlagBits::eStorageBuffer |
-							extraUses)
-		.Build(totalAllocationSize, debugName + " mesh Data");
-
-	//need to now copy vertex data to device memory
-	char* dataPtr = (char*)stagingBuffer.Map();
-	size_t offset = 0;
-	for (size_t i = 0; i < usedAttributes.size(); ++i) {
-		//We're going to use the same buffer for every attribute
-		usedBuffers.push_back(gpuBuffer.buffer);
-		//But each attribute starts at a different offset
-		usedOffsets.push_back(offset);
-		//Copy the data from CPU to GPU-visible memory
-		size_t copySize = GetVertexCount() * attributeSizes[usedAttributes[i]];
-		memcpy(dataPtr + offset, attributeDataSources[i], copySize);
-		offset += copySize;
-	}
-	
-	if (GetIndexCount() > 0) {
-		memcpy(dataPtr + offset, GetIndexData().data(), indexDataSize);
-		indexType		= vk::IndexType::eUint32;	
-		indexOffset		= offset;
-	}
-	stagingBuffer.Unmap();
-
-	{//Now to transfer the mesh data from the staging buffer to the gpu-only buffer
-		vk::BufferCopy copyRegion;
-		copyRegion.size = vertexDataSize + indexDataSize;
-		cmdBuffer.copyBuffer(stagingBuffer.buffer, gpuBuffer.buffer, copyRegion);
+	positionInputState = vk::PipelineVertexInputStateCreateInfo();
+	if (!usedAttributes.empty() && usedAttributes[0] == VertexAttribute::Positions) {
+		positionBinding		= vk::VertexInputBindingDescription(0, attributeBindings[0].stride, vk::VertexInputRate::eVertex);
+		positionAttribute	= vk::VertexInputAttributeDescription(VertexAttribute::Positions, 0, usedFormats[0], 0);
+
+		positionInputState = vk::PipelineVertexInputStateCreateInfo(
+			{
+				.vertexBindingDescriptionCount		= 1,
+				.pVertexBindingDescriptions			= &positionBinding,
+				.vertexAttributeDescriptionCount	= 1,
+				.pVertexAttributeDescriptions		= &positionAttribute
+			}
+		);
 	}
-
 }
 
 void VulkanMesh::BindToCommandBuffer(vk::CommandBuffer  buffer) const {
 	buffer.bindVertexBuffers(0, usedBuffers.size(), &usedBuffers[0], &usedOffsets[0]);
 
 	if (GetIndexCount() > 0) {
-		buffer.bindIndexBuffer(gpuBuffer.buffer, indexOffset, indexType);
+		buffer.bindIndexBuffer(indexBuffer, indexOffset, indexType);
 	}
 }
 
@@ -184,10 +426,10 @@ void VulkanMesh::DrawLayer(unsigned int layer, vk::CommandBuffer  to, int instan
 	BindToCommandBuffer(to);
 
 	if (GetIndexCount() > 0) {
-		to.drawIndexed(sm->count, instanceCount, sm->start, sm->base, 0);
+		to.drawIndexed(sm->count, instanceCount, firstIndex + sm->start, baseVertex + sm->base, 0);
 	}
 	else {
-		to.draw(sm->count, instanceCount, sm->start, 0);
+		to.draw(sm->count, instanceCount, baseVertex + sm->start, 0);
 	}
 }
 
@@ -197,10 +439,42 @@ void VulkanMesh::Draw(vk::CommandBuffer  to, int instanceCount) {
 	BindToCommandBuffer(to);
 
 	if (GetIndexCount() > 0) {
-		to.drawIndexed(GetIndexCount(), instanceCount, 0, 0, 0);
+		to.drawIndexed(GetIndexCount(), instanceCount, firstIndex, baseVertex, 0);
 	}
 	else {
-		to.draw(GetVertexCount(), instanceCount, 0, 0);
+		to.draw(GetVertexCount(), instanceCount, baseVertex, 0);
+	}
+}
+
+void VulkanMesh::BindToCommandEncoder(CommandEncoder& encoder) const {
+	encoder.BindVertexBuffers(0, (uint32_t)usedBuffers.size(), &usedBuffers[0], &usedOffsets[0]);
+
+	if (GetIndexCount() > 0) {
+		encoder.BindIndexBuffer(indexBuffer, indexOffset, indexType);
+	}
+}
+
+void VulkanMesh::DrawLayer(unsigned int layer, CommandEncoder& to, int instanceCount) {
+	const SubMesh* sm = GetSubMesh(layer);
+
+	BindToCommandEncoder(to);
+
+	if (GetIndexCount() > 0) {
+		to.DrawIndexed(sm->count, instanceCount, firstIndex + sm->start, baseVertex + sm->base, 0);
+	}
+	else {
+		to.Draw(sm->count, instanceCount, baseVertex + sm->start, 0);
+	}
+}
+
+void VulkanMesh::Draw(CommandEncoder& to, int instanceCount) {
+	BindToCommandEncoder(to);
+
+	if (GetIndexCount() > 0) {
+		to.DrawIndexed(GetIndexCount(), instanceCount, firstIndex, baseVertex, 0);
+	}
+	else {
+		to.Draw(GetVertexCount(), instanceCount, baseVertex, 0);
 	}
 }
 
@@ -227,7 +501,7 @@ size_t VulkanMesh::CalculateGPUAllocationSize() const {
 	size_t vSize = 0;
 	auto atrributeSizeFunc = [&](VertexAttribute::Type attribute, size_t count) {
 		if (count > 0) {
-			vSize += (int)attributeSizes[attribute];
+			vSize += GetAttributeSize(attribute, vertexFormat);
 		}
 	};
 
@@ -243,10 +517,34 @@ size_t VulkanMesh::CalculateGPUAllocationSize() const {
 	size_t indexDataSize = 0;
 
 	if (GetIndexCount() > 0) {
-		int elementSize = (indexType == vk::IndexType::eUint32) ? 4 : 2;
-		indexDataSize = elementSize * GetIndexCount();
+		indexDataSize = GetIndexSize(GetSmallestIndexType()) * GetIndexCount();
+	}
+	size_t totalSize = vertexDataSize + indexDataSize;
+	if (HasMeshlets()) {
+		totalSize = ((totalSize + MESHLET_ALIGNMENT - 1) / MESHLET_ALIGNMENT) * MESHLET_ALIGNMENT;
+		totalSize += GetMeshletDataSize();
+	}
+	return totalSize;
+}
+
+vk::IndexType VulkanMesh::GetSmallestIndexType() const {
+	if (GetIndexCount() == 0) {
+		return vk::IndexType::eNoneKHR;
+	}
+	//65535 vertices need indices up to 0xFFFE, leaving 0xFFFF free as it's the primitive restart value
+	return GetVertexCount() <= 0xFFFF ? vk::IndexType::eUint16 : vk::IndexType::eUint32;
+}
+
+void VulkanMesh::WriteIndices(char* dest, vk::IndexType type) const {
+	const auto& indices = GetIndexData();
+	if (type == vk::IndexType::eUint32) {
+		memcpy(dest, indices.data(), indices.size() * sizeof(uint32_t));
+		return;
+	}
+	uint16_t* dest16 = (uint16_t*)dest;
+	for (size_t i = 0; i < indices.size(); ++i) {
+		dest16[i] = (uint16_t)indices[i];
 	}
-	return vertexDataSize + indexDataSize;
 }
 
 bool VulkanMesh::GetIndexInformation(vk::Buffer& outBuffer, uint32_t& outOffset, uint32_t& outRange, vk::IndexType& outType) {
@@ -254,10 +552,10 @@ bool VulkanMesh::GetIndexInformation(vk::Buffer& outBuffer, uint32_t& outOffset,
 		return false;
 	}
 
-	int elementSize = (indexType == vk::IndexType::eUint32) ? 4: 2;
+	size_t elementSize = GetIndexSize(indexType);
 	
-	outBuffer	= gpuBuffer.buffer;
-	outOffset	= indexOffset;
+	outBuffer	= indexBuffer;
+	outOffset	= indexOffset + (firstIndex * elementSize);
 	outRange	= elementSize * GetIndexCount();
 	outType		= indexType;
 
@@ -270,13 +568,208 @@ bool VulkanMesh::GetAttributeInformation(VertexAttribute::Type v, vk::Buffer& ou
 			continue;
 		}
 
-		outBuffer	= usedBuffers[i];
-		outOffset	= usedOffsets[i];
-		outRange	= attributeSizes[v] * GetVertexCount();
+		uint32_t binding	= usedBindings[i];
+		uint32_t stride		= attributeBindings[binding].stride;
+
+		outBuffer	= usedBuffers[binding];
+		outOffset	= usedOffsets[binding] + attributeOffsets[i] + (baseVertex * stride);
+		outRange	= (stride * GetVertexCount()) - attributeOffsets[i];
 		outFormat	= usedFormats[i];
 
 		return true;
 	}
 
 	return false;
-}
\ No newline at end of file
+}
+/*
+Meshlets are built greedily, in index order, so work best on meshes that
+have been through a MeshOptimiser first. Each holds a list of up to
+maxVertices of the mesh's vertices, and up to maxPrimitives triangles,
+indexing into that list with 8 bit indices. Meshlets never cross submeshes.
+*/
+bool VulkanMesh::GenerateMeshlets(uint32_t maxVertices, uint32_t maxPrimitives) {
+	meshlets.clear();
+	meshletVertices.clear();
+	meshletPrimitives.clear();
+	meshletRanges.clear();
+
+	if (!MessageAssert(primType == GeometryPrimitive::Triangles, "Meshlets can only be made from triangle lists!")) {
+		return false;
+	}
+	//Local indices have to fit in 8 bits
+	maxVertices		= std::clamp(maxVertices	, 3u, 256u);
+	maxPrimitives	= std::max(maxPrimitives, 1u);
+
+	meshletMaxVertices		= maxVertices;
+	meshletMaxPrimitives	= maxPrimitives;
+
+	const std::vector<unsigned int>& indices = GetIndexData();
+
+	std::vector<uint32_t> localIndices(GetVertexCount(), UINT32_MAX);
+	Meshlet current = {};
+
+	auto FinishMeshlet = [&]() {
+		if (current.primitiveCount > 0) {
+			for (uint32_t i = 0; i < current.vertexCount; ++i) {
+				localIndices[meshletVertices[current.vertexOffset + i]] = UINT32_MAX;
+			}
+			CalculateMeshletBounds(current, GetPositionData(), meshletVertices, meshletPrimitives);
+			meshlets.push_back(current);
+		}
+		current = {};
+		current.vertexOffset	= (uint32_t)meshletVertices.size();
+		current.primitiveOffset = (uint32_t)meshletPrimitives.size();
+	};
+
+	uint32_t subMeshCount = std::max(GetSubMeshCount(), 1u);
+	for (uint32_t s = 0; s < subMeshCount; ++s) {
+		SubMesh range = { 0, GetIndexCount() > 0 ? GetIndexCount() : GetVertexCount(), 0 };
+		if (GetSubMeshCount() > 0) {
+			range = *GetSubMesh(s);
+		}
+		MeshletRange meshletRange = { (uint32_t)meshlets.size(), 0 };
+
+		for (uint32_t t = 0; t + 2 < range.count; t += 3) {
+			uint32_t v[3];
+			for (int j = 0; j < 3; ++j) {
+				v[j] = GetIndexCount() > 0 ? indices[range.start + t + j] + range.base : range.start + t + j;
+			}
+			uint32_t newVertices = 0;
+			for (int j = 0; j < 3; ++j) {
+				bool repeated = (j > 0 && v[j] == v[0]) || (j > 1 && v[j] == v[1]);
+				if (localIndices[v[j]] == UINT32_MAX && !repeated) {
+					newVertices++;
+				}
+			}
+			if (current.vertexCount + newVertices > maxVertices || current.primitiveCount == maxPrimitives) {
+				FinishMeshlet();
+			}
+			uint32_t packedPrimitive = 0;
+			for (int j = 0; j < 3; ++j) {
+				if (localIndices[v[j]] == UINT32_MAX) {
+					localIndices[v[j]] = current.vertexCount++;
+					meshletVertices.push_back(v[j]);
+				}
+				packedPrimitive |= localIndices[v[j]] << (j * 8);
+			}
+			meshletPrimitives.push_back(packedPrimitive);
+			current.primitiveCount++;
+		}
+		FinishMeshlet();
+		meshletRange.count = (uint32_t)meshlets.size() - meshletRange.first;
+		meshletRanges.push_back(meshletRange);
+	}
+	return HasMeshlets();
+}
+
+/*
+The bounding sphere is centred on the meshlet's AABB, and the normal cone
+is the average of its triangles' normals. If every triangle faces within
+the cone, and the camera is within the region behind the cone's apex, then
+every triangle is backfacing and the meshlet can be skipped.
+*/
+void VulkanMesh::CalculateMeshletBounds(Meshlet& m, const std::vector<Vector3>& positions, const std::vector<uint32_t>& vertices, const std::vector<uint32_t>& primitives) {
+	Vector3 minPos = positions[vertices[m.vertexOffset]];
+	Vector3 maxPos = minPos;
+	for (uint32_t i = 1; i < m.vertexCount; ++i) {
+		const Vector3& p = positions[vertices[m.vertexOffset + i]];
+		minPos = Vector3(std::min(minPos.x, p.x), std::min(minPos.y, p.y), std::min(minPos.z, p.z));
+		maxPos = Vector3(std::max(maxPos.x, p.x), std::max(maxPos.y, p.y), std::max(maxPos.z, p.z));
+	}
+	m.sphereCentre = (minPos + maxPos) * 0.5f;
+	m.sphereRadius = 0.0f;
+	for (uint32_t i = 0; i < m.vertexCount; ++i) {
+		m.sphereRadius = std::max(m.sphereRadius, Vector::Length(positions[vertices[m.vertexOffset + i]] - m.sphereCentre));
+	}
+
+	std::vector<Vector3> normals;
+	std::vector<Vector3> corners;
+	Vector3 axis;
+	for (uint32_t i = 0; i < m.primitiveCount; ++i) {
+		uint32_t packed = primitives[m.primitiveOffset + i];
+		const Vector3& a = positions[vertices[m.vertexOffset + ( packed		 & 0xFF)]];
+		const Vector3& b = positions[vertices[m.vertexOffset + ((packed >> 8)  & 0xFF)]];
+		const Vector3& c = positions[vertices[m.vertexOffset + ((packed >> 16) & 0xFF)]];
+
+		Vector3 normal	= Vector::Cross(b - a, c - a);
+		float	length	= Vector::Length(normal);
+		if (length > 0.0f) {
+			normals.push_back(normal * (1.0f / length));
+			corners.push_back(a);
+			axis = axis + normals.back();
+		}
+	}
+	m.coneApex		= m.sphereCentre;
+	m.coneAxis		= Vector3();
+	m.coneCutoff	= 2.0f; //Never culled
+
+	float axisLength = Vector::Length(axis);
+	if (axisLength <= 0.0f) {
+		return;
+	}
+	axis = axis * (1.0f / axisLength);
+
+	float minDot = 1.0f;
+	for (const Vector3& n : normals) {
+		minDot = std::min(minDot, Vector::Dot(n, axis));
+	}
+	//Too wide a cone will almost never be culled, so don't bother testing it
+	if (minDot <= 0.1f) {
+		return;
+	}
+	//Move the apex back until it's behind every triangle's plane
+	float maxT = 0.0f;
+	for (size_t i = 0; i < normals.size(); ++i) {
+		float t = Vector::Dot(m.sphereCentre - corners[i], normals[i]) / Vector::Dot(axis, normals[i]);
+		maxT = std::max(maxT, t);
+	}
+	m.coneAxis		= axis;
+	m.coneApex		= m.sphereCentre - axis * maxT;
+	m.coneCutoff	= std::sqrt(1.0f - minDot * minDot);
+}
+
+size_t VulkanMesh::GetMeshletDataSize() const {
+	return	meshlets.size()				* sizeof(Meshlet) +
+			meshletVertices.size()		* sizeof(uint32_t) +
+			meshletPrimitives.size()	* sizeof(uint32_t);
+}
+
+void VulkanMesh::WriteMeshletData(char* dest) {
+	size_t meshletBytes = meshlets.size()		 * sizeof(Meshlet);
+	size_t vertexBytes	= meshletVertices.size() * sizeof(uint32_t);
+
+	memcpy(dest, meshlets.data(), meshletBytes);
+	memcpy(dest + meshletBytes, meshletVertices.data(), vertexBytes);
+	memcpy(dest + meshletBytes + vertexBytes, meshletPrimitives.data(), meshletPrimitives.size() * sizeof(uint32_t));
+}
+
+void VulkanMesh::DrawMeshlets(vk::CommandBuffer to, vk::PipelineLayout layout, uint32_t pushOffset, vk::ShaderStageFlags pushStages) {
+	DrawMeshletRange(to, layout, pushOffset, pushStages, 0, (uint32_t)meshlets.size());
+}
+
+void VulkanMesh::DrawMeshletLayer(unsigned int layer, vk::CommandBuffer to, vk::PipelineLayout layout, uint32_t pushOffset, vk::ShaderStageFlags pushStages) {
+	if (layer >= meshletRanges.size()) {
+		return;
+	}
+	DrawMeshletRange(to, layout, pushOffset, pushStages, meshletRanges[layer].first, meshletRanges[layer].count);
+}
+
+void VulkanMesh::DrawMeshletRange(vk::CommandBuffer to, vk::PipelineLayout layout, uint32_t pushOffset, vk::ShaderStageFlags pushStages, uint32_t firstMeshlet, uint32_t meshletCount) const {
+	if (meshletCount == 0 || !gpuBuffer.deviceAddress) {
+		return;
+	}
+	vk::DeviceAddress meshletAddress = gpuBuffer.deviceAddress + meshletDataOffset;
+
+	MeshletDrawConstants constants = {
+		.meshlets			= meshletAddress,
+		.meshletVertices	= meshletAddress	+ meshlets.size() * sizeof(Meshlet),
+		.meshletPrimitives	= meshletAddress	+ meshlets.size() * sizeof(Meshlet) + meshletVertices.size() * sizeof(uint32_t),
+		.vertices			= gpuBuffer.deviceAddress + usedOffsets[0],
+		.vertexStride		= attributeBindings[0].stride,
+		.firstMeshlet		= firstMeshlet,
+		.meshletCount		= meshletCount
+	};
+	to.pushConstants(layout, pushStages, pushOffset, sizeof(MeshletDrawConstants), &constants);
+	//The task shader culls its group's meshlets, and launches mesh workgroups for whatever is left
+	to.drawMeshTasksEXT((meshletCount + MESHLET_TASK_GROUP_SIZE - 1) / MESHLET_TASK_GROUP_SIZE, 1, 1);
+}
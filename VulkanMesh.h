@@ -8,11 +8,66 @@ License: MIT (see LICENSE file at the top of the source tree)
 #pragma once
 #include "../NCLCoreClasses/Mesh.h"
 #include "VulkanBuffers.h"
+#include "VulkanStagingRingBuffer.h"
+#include "VulkanMeshOptimiser.h"
 
 namespace NCL::Rendering::Vulkan {
+	class UploadScheduler;
+	class GeometryPool;
+	class CommandEncoder;
+
+	//How a VulkanMesh lays out its vertex data in GPU memory
+	struct VertexFormat {
+		enum StreamLayout : uint32_t {
+			Separate,		//A buffer binding per attribute
+			Interleaved,	//Every attribute in a single binding
+			PositionSplit	//Positions in binding 0, for depth passes, and everything else interleaved in binding 1
+		};
+		StreamLayout	streams				= Separate;
+		bool			halfFloatTexCoords	= false;	//R16G16Sfloat
+		bool			octahedralNormals	= false;	//R16G16Snorm, decoded in the vertex shader. Tangents become R16G16B16A16Snorm
+		bool			compressedSkinning	= false;	//R16G16B16A16Unorm weights and R16G16B16A16Sint indices
+	};
+
+	//A small cluster of a mesh's triangles, laid out to match std430 rules
+	struct Meshlet {
+		Maths::Vector3	sphereCentre;
+		float			sphereRadius;
+		Maths::Vector3	coneApex;
+		float			coneCutoff;		//Culled if dot(normalize(coneApex - cameraPos), coneAxis) >= coneCutoff. Above 1 if it can't be
+		Maths::Vector3	coneAxis;
+		uint32_t		vertexOffset;	//Into the meshlet vertex list
+		uint32_t		primitiveOffset;//Into the meshlet primitive list
+		uint32_t		vertexCount;
+		uint32_t		primitiveCount;
+		uint32_t		padding;
+	};
+
+	//Pushed by DrawMeshlets for the task and mesh shaders to read everything from
+	struct MeshletDrawConstants {
+		vk::DeviceAddress	meshlets;
+		vk::DeviceAddress	meshletVertices;	//uint per vertex, indexing the mesh's vertices
+		vk::DeviceAddress	meshletPrimitives;	//uint per triangle, holding 3 8 bit indices into the meshlet's vertices
+		vk::DeviceAddress	vertices;			//Start of binding 0
+		uint32_t			vertexStride;
+		uint32_t			firstMeshlet;
+		uint32_t			meshletCount;
+		uint32_t			padding;
+	};
+
+	/*
+	Meshlets are handed out to task shader workgroups of this size. Each
+	invocation tests one meshlet's bounding sphere against the frustum, and
+	its normal cone against the camera position, then the workgroup emits a
+	mesh workgroup for each survivor, passing their indices in the payload.
+	*/
+	const uint32_t MESHLET_TASK_GROUP_SIZE = 32;
+
 	class VulkanMesh : public Mesh {
 	public:
 		friend class VulkanRenderer;
+		friend class GeometryPool;
+		friend class MeshOptimiser;
 		VulkanMesh();
 		~VulkanMesh();
 
@@ -20,15 +75,63 @@ namespace NCL::Rendering::Vulkan {
 			return vertexInputState;
 		}
 
+		//Only the position attribute, at location 0 and binding 0. Best used with the PositionSplit layout
+		const vk::PipelineVertexInputStateCreateInfo& GetPositionOnlyInputState() const {
+			return positionInputState;
+		}
+
+		//Must be set before the mesh is uploaded
+		void SetVertexFormat(const VertexFormat& format) {
+			vertexFormat = format;
+		}
+		const VertexFormat& GetVertexFormat() const {
+			return vertexFormat;
+		}
+
+		//Runs the mesh through a MeshOptimiser just before it is uploaded. This changes the mesh's CPU data!
+		void SetOptimiseOnUpload(bool state, const MeshOptimiserOptions& options = {}) {
+			optimiseOnUpload	= state;
+			optimiserOptions	= options;
+		}
+		//Results from the last optimisation pass, if any
+		const MeshOptimiserStats& GetOptimiserStats() const {
+			return optimiserStats;
+		}
+
+		//Splits the mesh's triangles into meshlets, which are then uploaded along with it. Must be called before upload,
+		//and if the mesh is optimised on upload, the meshlets are made again afterwards with the same limits
+		bool GenerateMeshlets(uint32_t maxVertices = 64, uint32_t maxPrimitives = 124);
+		bool HasMeshlets() const {
+			return !meshlets.empty();
+		}
+		const std::vector<Meshlet>& GetMeshlets() const {
+			return meshlets;
+		}
+
+		//Pushes the MeshletDrawConstants at pushOffset, and launches a task workgroup per MESHLET_TASK_GROUP_SIZE meshlets
+		void DrawMeshlets(vk::CommandBuffer to, vk::PipelineLayout layout, uint32_t pushOffset = 0,
+			vk::ShaderStageFlags pushStages = vk::ShaderStageFlagBits::eTaskEXT | vk::ShaderStageFlagBits::eMeshEXT);
+		void DrawMeshletLayer(unsigned int layer, vk::CommandBuffer to, vk::PipelineLayout layout, uint32_t pushOffset = 0,
+			vk::ShaderStageFlags pushStages = vk::ShaderStageFlagBits::eTaskEXT | vk::ShaderStageFlagBits::eMeshEXT);
+
 		void BindToCommandBuffer(vk::CommandBuffer  buffer) const;
+		void BindToCommandEncoder(CommandEncoder& encoder) const;
 
 		void Draw(vk::CommandBuffer  to, int instanceCount = 1);
 		void DrawLayer(unsigned int layer, vk::CommandBuffer  to, int instanceCount = 1);
 
+		//As above, but the vertex and index buffers are only bound if they aren't already
+		void Draw(CommandEncoder& to, int instanceCount = 1);
+		void DrawLayer(unsigned int layer, CommandEncoder& to, int instanceCount = 1);
+
 		void UploadToGPU(RendererBase* renderer) override;
 
 		void UploadToGPU(RendererBase* renderer, vk::BufferUsageFlags extraUses);
 		void UploadToGPU(VulkanRenderer* renderer, VkQueue queue, vk::CommandBuffer buffer, VulkanBuffer& stagingBuffer, vk::BufferUsageFlags extraUses = {});
+		//Records the upload from a region of staging memory, which must stay alive until the commands have completed
+		void UploadToGPU(VulkanRenderer* renderer, vk::CommandBuffer buffer, const StagingAllocation& staging, vk::BufferUsageFlags extraUses = {});
+		//Streams the mesh in via the copy queue, returning the scheduler ticket to check before drawing it
+		uint64_t UploadToGPU(VulkanRenderer* renderer, UploadScheduler& scheduler, vk::BufferUsageFlags extraUses = {});
 
 		uint32_t	GetAttributeMask() const;
 		size_t		CalculateGPUAllocationSize() const;
@@ -42,27 +145,94 @@ namespace NCL::Rendering::Vulkan {
 			return vertexInputState;
 		}
 
+		//Where this mesh's data starts within a GeometryPool, for use in multi-draw and indirect calls
+		GeometryPool* GetGeometryPool() const {
+			return sourcePool;
+		}
+		uint32_t GetBaseVertex() const {
+			return baseVertex;
+		}
+		uint32_t GetFirstIndex() const {
+			return firstIndex;
+		}
+
+		static size_t		GetAttributeSize(VertexAttribute::Type attribute, const VertexFormat& format = {});
+		static vk::Format	GetAttributeFormat(VertexAttribute::Type attribute, const VertexFormat& format = {});
+
+		//Distance in bytes between each vertex's value of this attribute, or 0 if the mesh doesn't have it
+		uint32_t GetAttributeStride(VertexAttribute::Type attribute) const;
+
+		//16 bit indices are used whenever every vertex can be addressed by one
+		vk::IndexType	GetSmallestIndexType() const;
+		static size_t	GetIndexSize(vk::IndexType type) {
+			return type == vk::IndexType::eUint16 ? sizeof(uint16_t) : sizeof(uint32_t);
+		}
+
 		bool GetIndexInformation(vk::Buffer& outBuffer, uint32_t& outOffset, uint32_t& outRange, vk::IndexType& outType);
 		bool GetAttributeInformation(VertexAttribute::Type v, vk::Buffer& outBuffer, uint32_t& outOffset, uint32_t& outRange, vk::Format& outFormat) const;
 
 	protected:
+		//Creates the GPU buffer and vertex state, writing the mesh data into staging memory. Returns the bytes written
+		size_t PrepareGPUBuffer(VulkanRenderer* renderer, char* stagingData, size_t stagingSize, vk::BufferUsageFlags extraUses);
+		//Fills in the used attributes and the vertex input state to match, along with where each attribute's data is
+		void BuildVertexInputState(std::vector<const char*>& attributeDataSources);
+		//Writes every vertex's value of an attribute, converting it to the vertex format
+		void WriteAttribute(VertexAttribute::Type attribute, const char* source, char* dest, size_t destStride) const;
+		//Writes the index data, narrowing it if necessary
+		void WriteIndices(char* dest, vk::IndexType type) const;
+		void OptimiseBeforeUpload();
+
+		static void CalculateMeshletBounds(Meshlet& m, const std::vector<Maths::Vector3>& positions, const std::vector<uint32_t>& vertices, const std::vector<uint32_t>& primitives);
+		size_t	GetMeshletDataSize() const;
+		void	WriteMeshletData(char* dest);
+		void	DrawMeshletRange(vk::CommandBuffer to, vk::PipelineLayout layout, uint32_t pushOffset, vk::ShaderStageFlags pushStages, uint32_t firstMeshlet, uint32_t meshletCount) const;
+
 		vk::PipelineVertexInputStateCreateInfo				vertexInputState;
 		std::vector<vk::VertexInputAttributeDescription>	attributeDescriptions;
 		std::vector<vk::VertexInputBindingDescription>		attributeBindings;		
+
+		vk::PipelineVertexInputStateCreateInfo	positionInputState;
+		vk::VertexInputAttributeDescription		positionAttribute;
+		vk::VertexInputBindingDescription		positionBinding;
+
+		VertexFormat	vertexFormat;
+
+		bool					optimiseOnUpload = false;
+		MeshOptimiserOptions	optimiserOptions;
+		MeshOptimiserStats		optimiserStats;
+
+		struct MeshletRange {
+			uint32_t first;
+			uint32_t count;
+		};
+		std::vector<Meshlet>		meshlets;
+		std::vector<uint32_t>		meshletVertices;
+		std::vector<uint32_t>		meshletPrimitives;
+		std::vector<MeshletRange>	meshletRanges;		//Per submesh
+		uint32_t					meshletMaxVertices		= 64;
+		uint32_t					meshletMaxPrimitives	= 124;
+		vk::DeviceSize				meshletDataOffset = 0;	//Where the meshlets start in the gpuBuffer
 	
 		VulkanBuffer gpuBuffer;
+		vk::Buffer	indexBuffer;
 		size_t vertexOffset = 0;
 		size_t indexOffset	= 0;
 
+		GeometryPool*	sourcePool	= nullptr;
+		uint32_t		baseVertex	= 0;
+		uint32_t		firstIndex	= 0;
+
 		size_t vertexStride = 0;
 
 		uint32_t attributeMask = 0;
 
 		vk::IndexType indexType = vk::IndexType::eNoneKHR;
 
-		std::vector<vk::Buffer>					usedBuffers;
+		std::vector<vk::Buffer>					usedBuffers;	//Per binding
 		std::vector<vk::DeviceSize>				usedOffsets;
 		std::vector<vk::Format>					usedFormats;
 		std::vector< VertexAttribute::Type >	usedAttributes;
+		std::vector<uint32_t>					usedBindings;		//Which binding each used attribute is in
+		std::vector<uint32_t>					attributeOffsets;	//And its offset within that binding's vertex
 	};
 }
\ No newline at end of file
@@ -0,0 +1,476 @@
+/******************************************************************************
+This file is part of the Newcastle Vulkan Tutorial Series
+
+Author:Rich Davison
+Contact:richgdavison@gmail.com
+License: MIT (see LICENSE file at the top of the source tree)
+*//////////////////////////////////////////////////////////////////////////////
+#include "VulkanMeshOptimiser.h"
+#include "VulkanMesh.h"
+#include <future>
+#include <thread>
+#include <chrono>
+#include <deque>
+#include <unordered_map>
+#include <string_view>
+#include <algorithm>
+
+using namespace NCL;
+using namespace Rendering;
+using namespace Vulkan;
+using namespace Maths;
+
+using Clock = std::chrono::high_resolution_clock;
+
+static float ElapsedMilliseconds(Clock::time_point from) {
+	return std::chrono::duration<float, std::milli>(Clock::now() - from).count();
+}
+
+template<typename T>
+static void RemapAttribute(VulkanMesh& mesh, const std::vector<T>& data, const std::vector<uint32_t>& newToOld, void (Mesh::*setter)(const std::vector<T>&)) {
+	if (data.empty()) {
+		return;
+	}
+	std::vector<T> remapped(newToOld.size());
+	for (size_t i = 0; i < newToOld.size(); ++i) {
+		remapped[i] = data[newToOld[i]];
+	}
+	(mesh.*setter)(remapped);
+}
+
+//Rewrites every vertex attribute so that new vertex i comes from old vertex newToOld[i]
+static void RemapVertices(VulkanMesh& mesh, const std::vector<uint32_t>& newToOld) {
+	RemapAttribute(mesh, mesh.GetPositionData()		, newToOld, &Mesh::SetVertexPositions);
+	RemapAttribute(mesh, mesh.GetColourData()		, newToOld, &Mesh::SetVertexColours);
+	RemapAttribute(mesh, mesh.GetTextureCoordData()	, newToOld, &Mesh::SetVertexTextureCoords);
+	RemapAttribute(mesh, mesh.GetNormalData()		, newToOld, &Mesh::SetVertexNormals);
+	RemapAttribute(mesh, mesh.GetTangentData()		, newToOld, &Mesh::SetVertexTangents);
+	RemapAttribute(mesh, mesh.GetSkinWeightData()	, newToOld, &Mesh::SetVertexSkinWeights);
+	RemapAttribute(mesh, mesh.GetSkinIndexData()	, newToOld, &Mesh::SetVertexSkinIndices);
+}
+
+template<typename T>
+static void AppendVertexBytes(std::vector<char>& bytes, const std::vector<T>& data, uint32_t vertex) {
+	if (!data.empty()) {
+		const char* start = (const char*)&data[vertex];
+		bytes.insert(bytes.end(), start, start + sizeof(T));
+	}
+}
+
+MeshOptimiser::MeshOptimiser(const MeshOptimiserOptions& inOptions) {
+	options = inOptions;
+}
+
+float MeshOptimiser::CalculateACMR(const std::vector<unsigned int>& indices, uint32_t cacheSize) {
+	if (indices.size() < 3) {
+		return 0.0f;
+	}
+	std::deque<unsigned int> cache;
+	size_t misses = 0;
+	for (unsigned int index : indices) {
+		if (std::find(cache.begin(), cache.end(), index) != cache.end()) {
+			continue;
+		}
+		misses++;
+		cache.push_back(index);
+		if (cache.size() > cacheSize) {
+			cache.pop_front();
+		}
+	}
+	return (float)misses / (float)(indices.size() / 3);
+}
+
+MeshOptimiserStats MeshOptimiser::Optimise(VulkanMesh& mesh) const {
+	MeshOptimiserStats stats;
+	Clock::time_point startTime = Clock::now();
+
+	stats.verticesBefore	= mesh.GetVertexCount();
+	stats.verticesAfter		= mesh.GetVertexCount();
+
+	if (mesh.primType != GeometryPrimitive::Triangles || mesh.GetVertexCount() == 0) {
+		return stats;
+	}
+	std::vector<unsigned int> indices = mesh.GetIndexData();
+	std::vector<SubMesh> subMeshes = mesh.subMeshes;
+
+	if (indices.empty()) {
+		if (subMeshes.size() > 1) {
+			return stats; //Can't tell which generated indices would belong to which submesh
+		}
+		indices.resize(mesh.GetVertexCount());
+		for (uint32_t i = 0; i < indices.size(); ++i) {
+			indices[i] = i;
+		}
+	}
+	if (subMeshes.empty()) {
+		subMeshes.push_back({ 0, (uint32_t)indices.size(), 0 });
+	}
+	//Each submesh's base vertex is folded into its indices, so they can all be remapped together
+	for (const SubMesh& sm : subMeshes) {
+		for (uint32_t i = sm.start; i < sm.start + sm.count; ++i) {
+			indices[i] += sm.base;
+		}
+	}
+	stats.triangleCount = (uint32_t)(indices.size() / 3);
+	stats.acmrBefore	= CalculateACMR(indices, options.acmrCacheSize);
+
+	uint32_t vertexCount = mesh.GetVertexCount();
+
+	if (options.removeDuplicates) {
+		Clock::time_point dedupTime = Clock::now();
+
+		std::vector<uint32_t> remap(vertexCount);
+		std::unordered_map<size_t, std::vector<uint32_t>> buckets;
+		std::vector<std::vector<char>> vertexBytes(vertexCount);
+
+		for (uint32_t v = 0; v < vertexCount; ++v) {
+			std::vector<char>& bytes = vertexBytes[v];
+			AppendVertexBytes(bytes, mesh.GetPositionData()		, v);
+			AppendVertexBytes(bytes, mesh.GetColourData()		, v);
+			AppendVertexBytes(bytes, mesh.GetTextureCoordData()	, v);
+			AppendVertexBytes(bytes, mesh.GetNormalData()		, v);
+			AppendVertexBytes(bytes, mesh.GetTangentData()		, v);
+			AppendVertexBytes(bytes, mesh.GetSkinWeightData()	, v);
+			AppendVertexBytes(bytes, mesh.GetSkinIndexData()	, v);
+
+			size_t hash = std::hash<std::string_view>()(std::string_view(bytes.data(), bytes.size()));
+			std::vector<uint32_t>& bucket = buckets[hash];
+
+			remap[v] = v;
+			for (uint32_t other : bucket) {
+				if (vertexBytes[other] == bytes) {
+					remap[v] = other;
+					break;
+				}
+			}
+			if (remap[v] == v) {
+				bucket.push_back(v);
+			}
+		}
+		for (unsigned int& i : indices) {
+			i = remap[i];
+		}
+		stats.dedupMilliseconds = ElapsedMilliseconds(dedupTime);
+	}
+
+	if (options.reorderTriangles || options.sortForOverdraw) {
+		Clock::time_point triangleTime = Clock::now();
+
+		const std::vector<Vector3>& positions = mesh.GetPositionData();
+		auto processSubMesh = [&](const SubMesh& sm) {
+			if (options.reorderTriangles) {
+				ReorderTriangles(&indices[sm.start], sm.count, vertexCount);
+			}
+			if (options.sortForOverdraw) {
+				SortForOverdraw(&indices[sm.start], sm.count, positions);
+			}
+		};
+		if (subMeshes.size() == 1) {
+			processSubMesh(subMeshes[0]);
+		}
+		else {
+			//Each submesh owns a separate range of the index buffer, so they can all be done at once
+			std::vector<std::future<void>> tasks;
+			for (const SubMesh& sm : subMeshes) {
+				tasks.push_back(std::async(std::launch::async, processSubMesh, sm));
+			}
+			for (auto& t : tasks) {
+				t.wait();
+			}
+		}
+		stats.triangleMilliseconds = ElapsedMilliseconds(triangleTime);
+	}
+
+	if (options.reorderVertices || options.removeDuplicates) {
+		Clock::time_point vertexTime = Clock::now();
+
+		//Duplicates are now unreferenced, so compacting the vertices in first use order removes them too
+		std::vector<uint32_t> oldToNew(vertexCount, UINT32_MAX);
+		std::vector<uint32_t> newToOld;
+		newToOld.reserve(vertexCount);
+
+		if (options.reorderVertices) {
+			for (unsigned int& i : indices) {
+				if (oldToNew[i] == UINT32_MAX) {
+					oldToNew[i] = (uint32_t)newToOld.size();
+					newToOld.push_back(i);
+				}
+				i = oldToNew[i];
+			}
+		}
+		else {
+			std::vector<bool> used(vertexCount, false);
+			for (unsigned int i : indices) {
+				used[i] = true;
+			}
+			for (uint32_t v = 0; v < vertexCount; ++v) {
+				if (used[v]) {
+					oldToNew[v] = (uint32_t)newToOld.size();
+					newToOld.push_back(v);
+				}
+			}
+			for (unsigned int& i : indices) {
+				i = oldToNew[i];
+			}
+		}
+		RemapVertices(mesh, newToOld);
+		stats.vertexMilliseconds = ElapsedMilliseconds(vertexTime);
+	}
+
+	for (SubMesh& sm : subMeshes) {
+		sm.base = 0;
+	}
+	if (!mesh.subMeshes.empty()) {
+		mesh.subMeshes = subMeshes;
+	}
+	mesh.SetVertexIndices(indices);
+
+	stats.verticesAfter		= mesh.GetVertexCount();
+	stats.acmrAfter			= CalculateACMR(indices, options.acmrCacheSize);
+	stats.totalMilliseconds = ElapsedMilliseconds(startTime);
+	stats.optimised			= true;
+	return stats;
+}
+
+std::vector<MeshOptimiserStats> MeshOptimiser::Optimise(const std::vector<VulkanMesh*>& meshes) const {
+	std::vector<MeshOptimiserStats> allStats(meshes.size());
+
+	uint32_t threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+	std::vector<std::future<void>> tasks;
+	for (uint32_t t = 0; t < threadCount; ++t) {
+		tasks.push_back(std::async(std::launch::async, [&, t]() {
+			//Each thread takes every n'th mesh, so no two ever touch the same one
+			for (size_t i = t; i < meshes.size(); i += threadCount) {
+				allStats[i] = Optimise(*meshes[i]);
+			}
+		}));
+	}
+	for (auto& t : tasks) {
+		t.wait();
+	}
+	return allStats;
+}
+
+/*
+Tom Forsyth's 'Linear-Speed Vertex Cache Optimisation'. Triangles are
+greedily added one at a time, picking whichever scores highest, based on
+how recently its vertices were used, and how few triangles they have left.
+Only triangles touching the cache need rescoring after each step.
+*/
+const float FORSYTH_CACHE_DECAY		= 1.5f;
+const float FORSYTH_LAST_TRI_SCORE	= 0.75f;
+const float FORSYTH_VALENCE_SCALE	= 2.0f;
+const float FORSYTH_VALENCE_POWER	= 0.5f;
+
+static float ForsythVertexScore(int cachePosition, uint32_t remainingTris, uint32_t cacheSize) {
+	if (remainingTris == 0) {
+		return -1.0f;
+	}
+	float score = 0.0f;
+	if (cachePosition >= 0) {
+		if (cachePosition < 3) {
+			score = FORSYTH_LAST_TRI_SCORE;
+		}
+		else {
+			float scaler = 1.0f / (cacheSize - 3);
+			score = std::pow(1.0f - (cachePosition - 3) * scaler, FORSYTH_CACHE_DECAY);
+		}
+	}
+	score += FORSYTH_VALENCE_SCALE * std::pow((float)remainingTris, -FORSYTH_VALENCE_POWER);
+	return score;
+}
+
+void MeshOptimiser::ReorderTriangles(unsigned int* indices, size_t indexCount, uint32_t vertexCount) const {
+	size_t triCount = indexCount / 3;
+	if (triCount < 2) {
+		return;
+	}
+	//Work on a compact local numbering of just the vertices this range uses
+	std::vector<unsigned int> usedVertices(indices, indices + indexCount);
+	std::sort(usedVertices.begin(), usedVertices.end());
+	usedVertices.erase(std::unique(usedVertices.begin(), usedVertices.end()), usedVertices.end());
+
+	std::vector<uint32_t> localIndices(indexCount);
+	for (size_t i = 0; i < indexCount; ++i) {
+		localIndices[i] = (uint32_t)(std::lower_bound(usedVertices.begin(), usedVertices.end(), indices[i]) - usedVertices.begin());
+	}
+	size_t localVertexCount = usedVertices.size();
+
+	//Which triangles use each vertex
+	std::vector<uint32_t> triOffsets(localVertexCount + 1, 0);
+	for (uint32_t v : localIndices) {
+		triOffsets[v + 1]++;
+	}
+	for (size_t v = 0; v < localVertexCount; ++v) {
+		triOffsets[v + 1] += triOffsets[v];
+	}
+	std::vector<uint32_t> vertexTris(indexCount);
+	std::vector<uint32_t> remainingTris(localVertexCount, 0);
+	for (size_t i = 0; i < indexCount; ++i) {
+		uint32_t v = localIndices[i];
+		vertexTris[triOffsets[v] + remainingTris[v]] = (uint32_t)(i / 3);
+		remainingTris[v]++;
+	}
+
+	uint32_t cacheSize = std::max(options.cacheSize, 4u);
+
+	std::vector<int>	cachePosition(localVertexCount, -1);
+	std::vector<float>	vertexScore(localVertexCount);
+	for (size_t v = 0; v < localVertexCount; ++v) {
+		vertexScore[v] = ForsythVertexScore(-1, remainingTris[v], cacheSize);
+	}
+	std::vector<float>	triScore(triCount);
+	std::vector<bool>	triAdded(triCount, false);
+	for (size_t t = 0; t < triCount; ++t) {
+		triScore[t] = vertexScore[localIndices[t * 3]] + vertexScore[localIndices[t * 3 + 1]] + vertexScore[localIndices[t * 3 + 2]];
+	}
+
+	std::vector<uint32_t> cache;
+	std::vector<uint32_t> newCache;
+	cache.reserve(cacheSize + 3);
+	newCache.reserve(cacheSize + 3);
+
+	std::vector<unsigned int> output;
+	output.reserve(indexCount);
+
+	size_t	scanCursor	= 0;
+	int64_t bestTri		= -1;
+
+	for (size_t added = 0; added < triCount; ++added) {
+		if (bestTri < 0) {
+			//Nothing in the cache to carry on from, so take the best scoring triangle left
+			float bestScore = -1.0f;
+			for (size_t t = scanCursor; t < triCount; ++t) {
+				if (!triAdded[t] && triScore[t] > bestScore) {
+					bestScore	= triScore[t];
+					bestTri		= t;
+				}
+			}
+			while (scanCursor < triCount && triAdded[scanCursor]) {
+				scanCursor++;
+			}
+		}
+		uint32_t tri = (uint32_t)bestTri;
+		triAdded[tri] = true;
+
+		newCache.clear();
+		for (int j = 0; j < 3; ++j) {
+			uint32_t v = localIndices[tri * 3 + j];
+			output.push_back(usedVertices[v]);
+			newCache.push_back(v);
+
+			//This triangle no longer needs to be considered by its vertices
+			uint32_t* start = &vertexTris[triOffsets[v]];
+			uint32_t* end	= start + remainingTris[v];
+			std::remove(start, end, tri);
+			remainingTris[v]--;
+		}
+		for (uint32_t v : cache) {
+			if (v != newCache[0] && v != newCache[1] && v != newCache[2]) {
+				newCache.push_back(v);
+			}
+		}
+		std::swap(cache, newCache);
+
+		//Everything that was in the cache needs rescoring, including anything that just fell out of it
+		for (size_t i = 0; i < cache.size(); ++i) {
+			uint32_t v = cache[i];
+			cachePosition[v] = i < cacheSize ? (int)i : -1;
+			float newScore	= ForsythVertexScore(cachePosition[v], remainingTris[v], cacheSize);
+			float delta		= newScore - vertexScore[v];
+			vertexScore[v]	= newScore;
+			for (uint32_t k = 0; k < remainingTris[v]; ++k) {
+				triScore[vertexTris[triOffsets[v] + k]] += delta;
+			}
+		}
+		if (cache.size() > cacheSize) {
+			cache.resize(cacheSize);
+		}
+
+		bestTri = -1;
+		float bestScore = -1.0f;
+		for (uint32_t v : cache) {
+			for (uint32_t k = 0; k < remainingTris[v]; ++k) {
+				uint32_t t = vertexTris[triOffsets[v] + k];
+				if (triScore[t] > bestScore || (triScore[t] == bestScore && t < bestTri)) {
+					bestScore	= triScore[t];
+					bestTri		= t;
+				}
+			}
+		}
+	}
+	memcpy(indices, output.data(), indexCount * sizeof(unsigned int));
+}
+
+/*
+Splits the (cache ordered) triangles into clusters, and sorts them so that
+the clusters facing most directly away from the middle of the mesh come
+first - these are likely to be in front of the others, so drawing them
+first lets early depth testing reject more of what comes after.
+*/
+void MeshOptimiser::SortForOverdraw(unsigned int* indices, size_t indexCount, const std::vector<Vector3>& positions) const {
+	size_t triCount		= indexCount / 3;
+	size_t clusterSize	= std::max(options.clusterSize, 1u);
+	if (triCount <= clusterSize) {
+		return;
+	}
+	Vector3 meshCentre;
+	float	meshArea = 0.0f;
+
+	struct Cluster {
+		size_t	firstTri;
+		size_t	triCount;
+		Vector3 centre;
+		Vector3 normal;
+		float	sortKey;
+	};
+	std::vector<Cluster> clusters;
+
+	for (size_t first = 0; first < triCount; first += clusterSize) {
+		Cluster c;
+		c.firstTri	= first;
+		c.triCount	= std::min(clusterSize, triCount - first);
+
+		float clusterArea = 0.0f;
+		for (size_t t = first; t < first + c.triCount; ++t) {
+			const Vector3& a = positions[indices[t * 3]];
+			const Vector3& b = positions[indices[t * 3 + 1]];
+			const Vector3& d = positions[indices[t * 3 + 2]];
+
+			Vector3 normal	= Vector::Cross(b - a, d - a); //Length is twice the area
+			float	area	= Vector::Length(normal) * 0.5f;
+			Vector3 centre	= (a + b + d) * (1.0f / 3.0f);
+
+			c.centre		= c.centre + centre * area;
+			c.normal		= c.normal + normal;
+			clusterArea		+= area;
+		}
+		meshCentre	= meshCentre + c.centre;
+		meshArea	+= clusterArea;
+		if (clusterArea > 0.0f) {
+			c.centre = c.centre * (1.0f / clusterArea);
+		}
+		float normalLength = Vector::Length(c.normal);
+		if (normalLength > 0.0f) {
+			c.normal = c.normal * (1.0f / normalLength);
+		}
+		clusters.push_back(c);
+	}
+	if (meshArea > 0.0f) {
+		meshCentre = meshCentre * (1.0f / meshArea);
+	}
+	for (Cluster& c : clusters) {
+		c.sortKey = Vector::Dot(c.centre - meshCentre, c.normal);
+	}
+	std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) {
+		return a.sortKey > b.sortKey;
+	});
+
+	std::vector<unsigned int> output;
+	output.reserve(indexCount);
+	for (const Cluster& c : clusters) {
+		output.insert(output.end(), indices + c.firstTri * 3, indices + (c.firstTri + c.triCount) * 3);
+	}
+	//Any leftover indices that don't make up a whole triangle stay where they were
+	memcpy(indices, output.data(), output.size() * sizeof(unsigned int));
+}
@@ -0,0 +1,71 @@
+/******************************************************************************
+This file is part of the Newcastle Vulkan Tutorial Series
+
+Author:Rich Davison
+Contact:richgdavison@gmail.com
+License: MIT (see LICENSE file at the top of the source tree)
+*//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+namespace NCL::Rendering::Vulkan {
+	class VulkanMesh;
+
+	struct MeshOptimiserOptions {
+		bool		removeDuplicates	= true;
+		bool		reorderTriangles	= true;		//For the post-transform vertex cache
+		bool		sortForOverdraw		= true;		//Outward facing clusters of triangles first
+		bool		reorderVertices		= true;		//Into the order the index buffer first uses them
+
+		uint32_t	cacheSize			= 32;		//Simulated cache size used when reordering triangles
+		uint32_t	clusterSize			= 64;		//Triangles per cluster when sorting for overdraw
+		uint32_t	acmrCacheSize		= 16;		//FIFO cache size the stats are measured with
+	};
+
+	struct MeshOptimiserStats {
+		uint32_t	verticesBefore		= 0;
+		uint32_t	verticesAfter		= 0;
+		uint32_t	triangleCount		= 0;
+
+		//Average cache miss ratio - vertex shader invocations per triangle
+		float		acmrBefore			= 0.0f;
+		float		acmrAfter			= 0.0f;
+
+		float		dedupMilliseconds	= 0.0f;
+		float		triangleMilliseconds= 0.0f; //Cache and overdraw ordering
+		float		vertexMilliseconds	= 0.0f;
+		float		totalMilliseconds	= 0.0f;
+
+		bool		optimised			= false; //Only indexable triangle lists can be optimised
+	};
+
+	/*
+	MeshOptimiser: Reorganises a mesh's data on the CPU before it is uploaded,
+	to make better use of the GPU's vertex caches and fetch bandwidth:
+	-Duplicate vertices are merged
+	-Each submesh's triangles are reordered for the post-transform cache,
+	 using Forsyth's linear speed algorithm
+	-Clusters of those triangles are then sorted so that outward facing
+	 ones are drawn first, reducing overdraw
+	-Vertices are reordered into the order they are first referenced
+
+	The output only depends on the input mesh, so is the same every time,
+	no matter how many threads it was spread over. Submeshes are processed
+	in parallel, as are lists of meshes.
+	*/
+	class MeshOptimiser	{
+	public:
+		MeshOptimiser(const MeshOptimiserOptions& options = {});
+		~MeshOptimiser() {}
+
+		MeshOptimiserStats				Optimise(VulkanMesh& mesh) const;
+		std::vector<MeshOptimiserStats> Optimise(const std::vector<VulkanMesh*>& meshes) const;
+
+		static float CalculateACMR(const std::vector<unsigned int>& indices, uint32_t cacheSize);
+
+	protected:
+		void ReorderTriangles(unsigned int* indices, size_t indexCount, uint32_t vertexCount) const;
+		void SortForOverdraw(unsigned int* indices, size_t indexCount, const std::vector<Maths::Vector3>& positions) const;
+
+		MeshOptimiserOptions options;
+	};
+}
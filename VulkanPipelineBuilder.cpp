@@ -191,6 +191,11 @@ VulkanPipeline	PipelineBuilder::Build(const std::string& debugName, vk::Pipeline
 
 	FinaliseDescriptorLayouts();
 
+	//Set here rather than when first used, so a copied builder points at its own state
+	pipelineCreate.setPViewportState(&viewportCreate);
+	if (tessellationCreate.patchControlPoints > 0) {
+		pipelineCreate.setPTessellationState(&tessellationCreate);
+	}
 	pipelineCreate.setPColorBlendState(&blendCreate)
 		.setPDepthStencilState(&depthStencilCreate)
 		.setPDynamicState(&dynamicCreate)
@@ -225,6 +230,9 @@ VulkanPipeline	PipelineBuilder::Build(const std::string& debugName, vk::Pipeline
 		pipelineCreate.pNext = &renderingCreate;
 	}
 
+	if (!cache) {
+		cache = GetDefaultPipelineCache(sourceDevice);
+	}
 	output.pipeline			= sourceDevice.createGraphicsPipelineUnique(cache, pipelineCreate).value;
 
 	if (!debugName.empty()) {
@@ -78,6 +78,8 @@ namespace NCL::Rendering::Vulkan {
 		}
 
 	protected:
+		friend class PipelineRegistry;
+
 		vk::PipelineCacheCreateInfo					cacheCreate;
 		vk::PipelineInputAssemblyStateCreateInfo	inputAsmCreate;
 		vk::PipelineRasterizationStateCreateInfo	rasterCreate;
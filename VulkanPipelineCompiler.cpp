@@ -0,0 +1,142 @@
+/******************************************************************************
+This file is part of the Newcastle Vulkan Tutorial Series
+
+Author:Rich Davison
+Contact:richgdavison@gmail.com
+License: MIT (see LICENSE file at the top of the source tree)
+*//////////////////////////////////////////////////////////////////////////////
+#include "VulkanPipelineCompiler.h"
+#include <algorithm>
+
+using namespace NCL;
+using namespace Rendering;
+using namespace Vulkan;
+
+PipelineCompiler::PipelineCompiler(uint32_t threadCount) {
+	activeJobs		= 0;
+	shuttingDown	= false;
+
+	if (threadCount == 0) {
+		uint32_t hardwareThreads = std::thread::hardware_concurrency();
+		threadCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+	}
+	for (uint32_t i = 0; i < threadCount; ++i) {
+		workers.emplace_back(&PipelineCompiler::WorkerThread, this);
+	}
+}
+
+PipelineCompiler::~PipelineCompiler() {
+	{
+		std::unique_lock lock(queueMutex);
+		shuttingDown = true;
+		//Anything still waiting is abandoned, but its handles mustn't block forever
+		for (auto& queue : queues) {
+			for (auto& job : queue) {
+				job->failed.store(true, std::memory_order_release);
+				job->ready.store(true, std::memory_order_release);
+				job->promise.set_value();
+			}
+			queue.clear();
+		}
+	}
+	queueCondition.notify_all();
+	for (std::thread& t : workers) {
+		t.join();
+	}
+}
+
+PipelineHandle PipelineCompiler::Enqueue(std::function<VulkanPipeline()>&& build, const std::string& debugName, PipelinePriority priority, const VulkanPipeline* fallback) {
+	std::shared_ptr<PipelineCompileJob> job = std::make_shared<PipelineCompileJob>();
+	job->build		= std::move(build);
+	job->debugName	= debugName;
+	job->priority	= priority;
+	job->fallback	= fallback;
+	job->future		= job->promise.get_future().share();
+	{
+		std::unique_lock lock(queueMutex);
+		queues[(int)priority].push_back(job);
+	}
+	queueCondition.notify_one();
+	return PipelineHandle(job);
+}
+
+void PipelineCompiler::Reprioritise(const PipelineHandle& handle, PipelinePriority priority) {
+	if (!handle.job) {
+		return;
+	}
+	std::unique_lock lock(queueMutex);
+	auto& oldQueue = queues[(int)handle.job->priority];
+	auto i = std::find(oldQueue.begin(), oldQueue.end(), handle.job);
+	if (i == oldQueue.end()) {
+		return; //Already started
+	}
+	oldQueue.erase(i);
+	handle.job->priority = priority;
+	queues[(int)priority].push_back(handle.job);
+}
+
+std::shared_ptr<PipelineCompileJob> PipelineCompiler::PopJob() {
+	for (int i = (int)PipelinePriority::MAX_PRIORITY - 1; i >= 0; --i) {
+		if (!queues[i].empty()) {
+			std::shared_ptr<PipelineCompileJob> job = queues[i].front();
+			queues[i].pop_front();
+			return job;
+		}
+	}
+	return nullptr;
+}
+
+void PipelineCompiler::WorkerThread() {
+	while (true) {
+		std::shared_ptr<PipelineCompileJob> job;
+		{
+			std::unique_lock lock(queueMutex);
+			queueCondition.wait(lock, [&] {
+				return shuttingDown || GetQueuedCount() > 0;
+			});
+			if (shuttingDown) {
+				return;
+			}
+			job = PopJob();
+			activeJobs++;
+		}
+		//If nobody holds a handle to this compile any more, there's no point doing it
+		if (job.use_count() > 1) {
+			try {
+				job->pipeline = job->build();
+			}
+			catch (const std::exception& e) {
+				std::cout << __FUNCTION__ << " failed to compile pipeline " << job->debugName << ": " << e.what() << "\n";
+				job->failed.store(true, std::memory_order_release);
+			}
+		}
+		job->build = nullptr; //Releases the builder snapshot
+		job->ready.store(true, std::memory_order_release);
+		job->promise.set_value();
+		{
+			std::unique_lock lock(queueMutex);
+			activeJobs--;
+		}
+		idleCondition.notify_all();
+	}
+}
+
+void PipelineCompiler::WaitForIdle() {
+	std::unique_lock lock(queueMutex);
+	idleCondition.wait(lock, [&] {
+		return GetQueuedCount() == 0 && activeJobs == 0;
+	});
+}
+
+uint32_t PipelineCompiler::GetPendingCount() const {
+	std::unique_lock lock(queueMutex);
+	return GetQueuedCount() + activeJobs;
+}
+
+uint32_t PipelineCompiler::GetQueuedCount() const {
+	size_t count = 0;
+	for (const auto& queue : queues) {
+		count += queue.size();
+	}
+	return (uint32_t)count;
+}
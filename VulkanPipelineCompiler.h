@@ -0,0 +1,147 @@
+/******************************************************************************
+This file is part of the Newcastle Vulkan Tutorial Series
+
+Author:Rich Davison
+Contact:richgdavison@gmail.com
+License: MIT (see LICENSE file at the top of the source tree)
+*//////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "VulkanPipeline.h"
+#include <atomic>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+namespace NCL::Rendering::Vulkan {
+	enum class PipelinePriority {
+		Low,
+		Normal,
+		High,	//Needed on screen right now
+		MAX_PRIORITY
+	};
+
+	struct PipelineCompileJob {
+		std::function<VulkanPipeline()>	build;
+		std::string						debugName;
+		PipelinePriority				priority;
+
+		const VulkanPipeline*			fallback;
+		VulkanPipeline					pipeline;
+
+		std::atomic<bool>				ready	= false;
+		std::atomic<bool>				failed	= false;
+		std::promise<void>				promise;
+		std::shared_future<void>		future;
+	};
+
+	/*
+	PipelineHandle: The result of a pipeline compile. Until the compile
+	has finished, Get returns the fallback pipeline given when the compile
+	was requested, so a handle can be bound every frame without caring
+	whether its pipeline is done or not. If the only handle to a compile
+	is destroyed before it starts, the compile is skipped.
+	*/
+	class PipelineHandle {
+	public:
+		PipelineHandle() {}
+
+		bool	IsValid() const {
+			return job != nullptr;
+		}
+		bool	IsReady() const {
+			return job && job->ready.load(std::memory_order_acquire);
+		}
+		bool	HasFailed() const {
+			return job && job->failed.load(std::memory_order_acquire);
+		}
+		//Blocks until the compile is done
+		void	Wait() const {
+			if (job) {
+				job->future.wait();
+			}
+		}
+		std::shared_future<void> GetFuture() const {
+			return job ? job->future : std::shared_future<void>();
+		}
+
+		//The compiled pipeline if it is ready, otherwise the fallback, which may be null
+		const VulkanPipeline* Get() const {
+			if (!job) {
+				return nullptr;
+			}
+			if (IsReady() && !HasFailed()) {
+				return &job->pipeline;
+			}
+			return job->fallback;
+		}
+
+	protected:
+		friend class PipelineCompiler;
+		PipelineHandle(std::shared_ptr<PipelineCompileJob> inJob) : job(inJob) {}
+
+		std::shared_ptr<PipelineCompileJob> job;
+	};
+
+	/*
+	PipelineCompiler: Compiles pipelines on a pool of worker threads, so
+	that new materials don't cause a hitch on the thread that needs them.
+	Compile takes a copy of a fully set up pipeline builder, and returns a
+	handle straight away, which can be polled each frame. Higher priority
+	compiles are always started first, and compiles of the same priority
+	start in the order they were requested.
+
+	All of the builders use the device's default pipeline cache unless one
+	is given, and as pipeline caches are internally synchronised, every
+	worker shares that one cache. Anything a builder refers to rather than
+	copies - shaders, layouts, vertex input state - must stay alive until
+	its compile has finished.
+	*/
+	class PipelineCompiler	{
+	public:
+		//A thread count of 0 uses every hardware thread but one
+		PipelineCompiler(uint32_t threadCount = 0);
+		~PipelineCompiler();
+
+		//The fallback is returned by the handle until the real pipeline is ready, and should
+		//have a compatible layout with anything bound alongside it
+		template<class T>
+		PipelineHandle Compile(const T& builder, const std::string& debugName = "", PipelinePriority priority = PipelinePriority::Normal,
+			const VulkanPipeline* fallback = nullptr, vk::PipelineCache cache = {}) {
+			std::shared_ptr<T> snapshot = std::make_shared<T>(builder);
+			return Enqueue([snapshot, debugName, cache]() {
+				return snapshot->Build(debugName, cache);
+			}, debugName, priority, fallback);
+		}
+
+		//Moves a waiting compile to a different priority, for when something is suddenly needed on screen
+		void		Reprioritise(const PipelineHandle& handle, PipelinePriority priority);
+
+		//Blocks until every compile requested so far has finished
+		void		WaitForIdle();
+
+		//Compiles waiting to start, or in progress
+		uint32_t	GetPendingCount() const;
+		uint32_t	GetThreadCount() const {
+			return (uint32_t)workers.size();
+		}
+
+	protected:
+		PipelineHandle	Enqueue(std::function<VulkanPipeline()>&& build, const std::string& debugName, PipelinePriority priority, const VulkanPipeline* fallback);
+		void			WorkerThread();
+		std::shared_ptr<PipelineCompileJob>	PopJob();
+		uint32_t		GetQueuedCount() const; //queueMutex must be held
+
+		std::vector<std::thread>	workers;
+
+		mutable std::mutex			queueMutex;
+		std::condition_variable		queueCondition;
+		std::condition_variable		idleCondition;
+
+		std::deque<std::shared_ptr<PipelineCompileJob>> queues[(int)PipelinePriority::MAX_PRIORITY];
+
+		uint32_t	activeJobs;
+		bool		shuttingDown;
+	};
+}
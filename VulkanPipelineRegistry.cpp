@@ -0,0 +1,271 @@
+/******************************************************************************
+This file is part of the Newcastle Vulkan Tutorial Series
+
+Author:Rich Davison
+Contact:richgdavison@gmail.com
+License: MIT (see LICENSE file at the top of the source tree)
+*//////////////////////////////////////////////////////////////////////////////
+#include "VulkanPipelineRegistry.h"
+#include "VulkanPipelineBuilder.h"
+#include "VulkanComputePipelineBuilder.h"
+#include "VulkanUtils.h"
+
+using namespace NCL;
+using namespace Rendering;
+using namespace Vulkan;
+
+//Only used for types with no padding or pointers, so that equal state always makes equal bytes
+template<typename T>
+static void AppendKey(std::string& key, const T& value) {
+	static_assert(std::is_trivially_copyable_v<T>);
+	key.append((const char*)&value, sizeof(T));
+}
+
+static void AppendKey(std::string& key, const char* text) {
+	std::string_view view(text ? text : "");
+	AppendKey(key, view.size());
+	key.append(view);
+}
+
+template<typename T>
+static void AppendKeyArray(std::string& key, const T* values, uint32_t count) {
+	AppendKey(key, count);
+	for (uint32_t i = 0; i < count; ++i) {
+		AppendKey(key, values[i]);
+	}
+}
+
+static void AppendStage(std::string& key, const vk::PipelineShaderStageCreateInfo& stage) {
+	AppendKey(key, stage.flags);
+	AppendKey(key, stage.stage);
+	AppendKey(key, GetVulkanHandle(stage.module));
+	AppendKey(key, stage.pName);
+
+	const vk::SpecializationInfo* spec = stage.pSpecializationInfo;
+	AppendKey(key, spec ? spec->mapEntryCount : 0u);
+	if (spec) {
+		for (uint32_t i = 0; i < spec->mapEntryCount; ++i) {
+			AppendKey(key, spec->pMapEntries[i].constantID);
+			AppendKey(key, spec->pMapEntries[i].offset);
+			AppendKey(key, (uint64_t)spec->pMapEntries[i].size);
+		}
+		AppendKey(key, (uint64_t)spec->dataSize);
+		key.append((const char*)spec->pData, spec->dataSize);
+	}
+}
+
+static void AppendLayouts(std::string& key, const std::vector<vk::DescriptorSetLayout>& setLayouts, const std::vector<vk::PushConstantRange>& pushConstants) {
+	AppendKey(key, (uint32_t)setLayouts.size());
+	for (const auto& l : setLayouts) {
+		AppendKey(key, GetVulkanHandle(l));
+	}
+	AppendKeyArray(key, pushConstants.data(), (uint32_t)pushConstants.size());
+}
+
+static void AppendStencil(std::string& key, const vk::StencilOpState& s) {
+	AppendKey(key, s.failOp);
+	AppendKey(key, s.passOp);
+	AppendKey(key, s.depthFailOp);
+	AppendKey(key, s.compareOp);
+	AppendKey(key, s.compareMask);
+	AppendKey(key, s.writeMask);
+	AppendKey(key, s.reference);
+}
+
+PipelineRegistry::PipelineRegistry(vk::Device device) {
+	sourceDevice = device;
+}
+
+std::string PipelineRegistry::MakeKey(const PipelineBuilder& b) const {
+	std::string key;
+	key.reserve(512);
+
+	AppendKey(key, vk::PipelineBindPoint::eGraphics);
+	AppendKey(key, b.pipelineCreate.flags);
+	AppendKey(key, b.pipelineCreate.stageCount);
+	for (uint32_t i = 0; i < b.pipelineCreate.stageCount; ++i) {
+		AppendStage(key, b.pipelineCreate.pStages[i]);
+	}
+	AppendKey(key, GetVulkanHandle(b.pipelineCreate.renderPass));
+	AppendKey(key, b.pipelineCreate.subpass);
+
+	if (b.externalLayout) {
+		AppendKey(key, GetVulkanHandle(b.externalLayout));
+	}
+	else {
+		AppendLayouts(key, b.allLayouts, b.allPushConstants);
+	}
+
+	AppendKeyArray(key, b.vertexCreate.pVertexBindingDescriptions	, b.vertexCreate.vertexBindingDescriptionCount);
+	AppendKeyArray(key, b.vertexCreate.pVertexAttributeDescriptions	, b.vertexCreate.vertexAttributeDescriptionCount);
+
+	AppendKey(key, b.inputAsmCreate.topology);
+	AppendKey(key, b.inputAsmCreate.primitiveRestartEnable);
+	AppendKey(key, b.tessellationCreate.patchControlPoints);
+
+	const vk::PipelineRasterizationStateCreateInfo& r = b.rasterCreate;
+	AppendKey(key, r.depthClampEnable);
+	AppendKey(key, r.rasterizerDiscardEnable);
+	AppendKey(key, r.polygonMode);
+	AppendKey(key, r.cullMode);
+	AppendKey(key, r.frontFace);
+	AppendKey(key, r.depthBiasEnable);
+	AppendKey(key, r.depthBiasConstantFactor);
+	AppendKey(key, r.depthBiasClamp);
+	AppendKey(key, r.depthBiasSlopeFactor);
+	AppendKey(key, r.lineWidth);
+
+	const vk::PipelineMultisampleStateCreateInfo& m = b.sampleCreate;
+	AppendKey(key, m.rasterizationSamples);
+	AppendKey(key, m.sampleShadingEnable);
+	AppendKey(key, m.minSampleShading);
+	AppendKey(key, m.alphaToCoverageEnable);
+	AppendKey(key, m.alphaToOneEnable);
+	AppendKey(key, m.pSampleMask ? *m.pSampleMask : ~0u);
+
+	const vk::PipelineDepthStencilStateCreateInfo& d = b.depthStencilCreate;
+	AppendKey(key, d.depthTestEnable);
+	AppendKey(key, d.depthWriteEnable);
+	AppendKey(key, d.depthCompareOp);
+	AppendKey(key, d.depthBoundsTestEnable);
+	AppendKey(key, d.stencilTestEnable);
+	AppendStencil(key, d.front);
+	AppendStencil(key, d.back);
+	AppendKey(key, d.minDepthBounds);
+	AppendKey(key, d.maxDepthBounds);
+
+	AppendKey(key, b.blendCreate.logicOpEnable);
+	AppendKey(key, b.blendCreate.logicOp);
+	AppendKeyArray(key, b.blendAttachStates.data(), (uint32_t)b.blendAttachStates.size());
+
+	AppendKeyArray(key, b.allColourRenderingFormats.data(), (uint32_t)b.allColourRenderingFormats.size());
+	AppendKey(key, b.depthRenderingFormat);
+
+	AppendKey(key, b.ignoreDynamicDefaults);
+	AppendKeyArray(key, b.dynamicStates.data(), (uint32_t)b.dynamicStates.size());
+
+	return key;
+}
+
+std::string PipelineRegistry::MakeKey(const ComputePipelineBuilder& b) const {
+	std::string key;
+	key.reserve(128);
+
+	AppendKey(key, vk::PipelineBindPoint::eCompute);
+	AppendKey(key, b.pipelineCreate.flags);
+	AppendStage(key, b.pipelineCreate.stage);
+
+	if (b.layout) {
+		AppendKey(key, GetVulkanHandle(b.layout));
+	}
+	else {
+		AppendLayouts(key, b.allLayouts, b.allPushConstants);
+	}
+	return key;
+}
+
+SharedPipeline PipelineRegistry::FindPipeline(const std::string& key) {
+	std::unique_lock lock(registryMutex);
+	auto i = pipelines.find(key);
+	if (i != pipelines.end()) {
+		if (SharedPipeline existing = i->second.lock()) {
+			stats.pipelineHits++;
+			return existing;
+		}
+	}
+	stats.pipelineMisses++;
+	return nullptr;
+}
+
+SharedPipeline PipelineRegistry::AddPipeline(const std::string& key, VulkanPipeline&& built, vk::PipelineLayout layout, SharedPipelineLayout layoutOwner) {
+	std::unique_lock lock(registryMutex);
+	//Another thread may have built the same pipeline in the meantime, in which case ours is thrown away
+	auto i = pipelines.find(key);
+	if (i != pipelines.end()) {
+		if (SharedPipeline existing = i->second.lock()) {
+			return existing;
+		}
+	}
+	std::shared_ptr<RegisteredPipeline> entry = std::make_shared<RegisteredPipeline>();
+	entry->pipeline		= std::move(built.pipeline);
+	entry->layout		= layout;
+	entry->layoutOwner	= layoutOwner;
+
+	pipelines[key] = entry;
+	return entry;
+}
+
+SharedPipeline PipelineRegistry::Build(const PipelineBuilder& builder, const std::string& debugName, vk::PipelineCache cache) {
+	PipelineBuilder copy(builder); //Build changes the builder, so the caller's one is left alone
+	copy.FinaliseDescriptorLayouts();
+
+	std::string key = MakeKey(copy);
+	if (SharedPipeline existing = FindPipeline(key)) {
+		return existing;
+	}
+	SharedPipelineLayout sharedLayout;
+	if (!copy.externalLayout) {
+		sharedLayout		= GetLayout(copy.allLayouts, copy.allPushConstants, debugName);
+		copy.externalLayout = **sharedLayout;
+	}
+	vk::PipelineLayout layout = copy.externalLayout;
+	return AddPipeline(key, copy.Build(debugName, cache), layout, sharedLayout);
+}
+
+SharedPipeline PipelineRegistry::Build(const ComputePipelineBuilder& builder, const std::string& debugName, vk::PipelineCache cache) {
+	ComputePipelineBuilder copy(builder);
+	copy.FinaliseDescriptorLayouts();
+
+	std::string key = MakeKey(copy);
+	if (SharedPipeline existing = FindPipeline(key)) {
+		return existing;
+	}
+	SharedPipelineLayout sharedLayout;
+	if (!copy.layout) {
+		sharedLayout = GetLayout(copy.allLayouts, copy.allPushConstants, debugName);
+		copy.WithLayout(**sharedLayout);
+	}
+	vk::PipelineLayout layout = copy.layout;
+	return AddPipeline(key, copy.Build(debugName, cache), layout, sharedLayout);
+}
+
+SharedPipelineLayout PipelineRegistry::GetLayout(const std::vector<vk::DescriptorSetLayout>& setLayouts, const std::vector<vk::PushConstantRange>& pushConstants, const std::string& debugName) {
+	std::string key;
+	AppendLayouts(key, setLayouts, pushConstants);
+
+	std::unique_lock lock(registryMutex);
+	auto i = layouts.find(key);
+	if (i != layouts.end()) {
+		if (SharedPipelineLayout existing = i->second.lock()) {
+			stats.layoutHits++;
+			return existing;
+		}
+	}
+	stats.layoutMisses++;
+
+	vk::PipelineLayoutCreateInfo createInfo = vk::PipelineLayoutCreateInfo()
+		.setSetLayouts(setLayouts)
+		.setPushConstantRanges(pushConstants);
+
+	SharedPipelineLayout newLayout = std::make_shared<const vk::UniquePipelineLayout>(sourceDevice.createPipelineLayoutUnique(createInfo));
+	if (!debugName.empty()) {
+		SetDebugName(sourceDevice, vk::ObjectType::ePipelineLayout, GetVulkanHandle(**newLayout), debugName);
+	}
+	layouts[key] = newLayout;
+	return newLayout;
+}
+
+void PipelineRegistry::Purge() {
+	std::unique_lock lock(registryMutex);
+	std::erase_if(pipelines, [](const auto& entry) {
+		return entry.second.expired();
+	});
+	std::erase_if(layouts, [](const auto& entry) {
+		return entry.second.expired();
+	});
+}
+
+PipelineRegistryStats PipelineRegistry::GetStats() const {
+	std::unique_lock lock(registryMutex);
+	return stats;
+}
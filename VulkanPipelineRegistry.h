@@ -0,0 +1,87 @@
+/******************************************************************************
+This file is part of the Newcastle Vulkan Tutorial Series
+
+Author:Rich Davison
+Contact:richgdavison@gmail.com
+License: MIT (see LICENSE file at the top of the source tree)
+*//////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "VulkanPipeline.h"
+#include <mutex>
+#include <unordered_map>
+
+namespace NCL::Rendering::Vulkan {
+	class PipelineBuilder;
+	class ComputePipelineBuilder;
+
+	using SharedPipelineLayout = std::shared_ptr<const vk::UniquePipelineLayout>;
+
+	//A pipeline that may be in use by many call sites. Its layout may be too
+	struct RegisteredPipeline {
+		vk::UniquePipeline		pipeline;
+		vk::PipelineLayout		layout;
+		SharedPipelineLayout	layoutOwner; //Empty if the layout was given to the builder
+
+		operator vk::Pipeline() const {
+			return *pipeline;
+		}
+		operator vk::PipelineLayout() const {
+			return layout;
+		}
+	};
+	using SharedPipeline = std::shared_ptr<const RegisteredPipeline>;
+
+	struct PipelineRegistryStats {
+		uint32_t pipelineHits	= 0;
+		uint32_t pipelineMisses	= 0;
+		uint32_t layoutHits		= 0;
+		uint32_t layoutMisses	= 0;
+	};
+
+	/*
+	PipelineRegistry: Stops identical pipelines from being built more than
+	once. Every piece of builder state that affects the final pipeline -
+	shader modules and entry points, vertex input, raster, blend, depth and
+	stencil state, rendering formats, dynamic state and layout - is written
+	into a canonical key, and if a pipeline has already been built with
+	that key, it is shared rather than built again. Pipeline layouts are
+	shared in the same way, by their descriptor set layouts and push
+	constant ranges.
+
+	The registry only holds weak references, so a pipeline is destroyed
+	once the last call site using it lets go. Shaders are identified by
+	their module handles, so the same shader file loaded twice will still
+	produce two pipelines. Safe to use from multiple threads.
+	*/
+	class PipelineRegistry	{
+	public:
+		PipelineRegistry(vk::Device device);
+		~PipelineRegistry() {}
+
+		SharedPipeline	Build(const PipelineBuilder& builder, const std::string& debugName = "", vk::PipelineCache cache = {});
+		SharedPipeline	Build(const ComputePipelineBuilder& builder, const std::string& debugName = "", vk::PipelineCache cache = {});
+
+		SharedPipelineLayout GetLayout(const std::vector<vk::DescriptorSetLayout>& setLayouts, const std::vector<vk::PushConstantRange>& pushConstants, const std::string& debugName = "");
+
+		//Removes entries for pipelines and layouts that are no longer in use
+		void			Purge();
+
+		PipelineRegistryStats GetStats() const;
+
+	protected:
+		std::string		MakeKey(const PipelineBuilder& builder) const;
+		std::string		MakeKey(const ComputePipelineBuilder& builder) const;
+
+		SharedPipeline	FindPipeline(const std::string& key);
+		SharedPipeline	AddPipeline(const std::string& key, VulkanPipeline&& pipeline, vk::PipelineLayout layout, SharedPipelineLayout layoutOwner);
+
+		vk::Device		sourceDevice;
+
+		mutable std::mutex	registryMutex;
+
+		std::unordered_map<std::string, std::weak_ptr<const RegisteredPipeline>>	pipelines;
+		std::unordered_map<std::string, std::weak_ptr<const vk::UniquePipelineLayout>>	layouts;
+
+		PipelineRegistryStats stats;
+	};
+}
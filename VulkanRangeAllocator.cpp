@@ -0,0 +1,88 @@
+/******************************************************************************
+This file is part of the Newcastle Vulkan Tutorial Series
+
+Author:Rich Davison
+Contact:richgdavison@gmail.com
+License: MIT (see LICENSE file at the top of the source tree)
+*//////////////////////////////////////////////////////////////////////////////
+#include "VulkanRangeAllocator.h"
+
+using namespace NCL;
+using namespace Rendering;
+using namespace Vulkan;
+
+RangeAllocator::RangeAllocator(size_t inCapacity) {
+	Reset(inCapacity);
+}
+
+void RangeAllocator::Reset(size_t inCapacity) {
+	capacity	= inCapacity;
+	freeSpace	= inCapacity;
+	freeRanges.clear();
+	if (capacity > 0) {
+		freeRanges[0] = capacity;
+	}
+}
+
+bool RangeAllocator::Allocate(size_t size, size_t alignment, size_t& outOffset) {
+	if (size == 0 || size > freeSpace) {
+		return false;
+	}
+	alignment = std::max(alignment, (size_t)1);
+
+	//First fit - keeps allocations packed towards the start of the range
+	for (auto i = freeRanges.begin(); i != freeRanges.end(); ++i) {
+		size_t rangeStart	= i->first;
+		size_t rangeSize	= i->second;
+		size_t alignedStart = ((rangeStart + alignment - 1) / alignment) * alignment;
+		size_t padding		= alignedStart - rangeStart;
+
+		if (padding + size > rangeSize) {
+			continue;
+		}
+		freeRanges.erase(i);
+		//Keep whatever's left either side of the allocation
+		if (padding > 0) {
+			freeRanges[rangeStart] = padding;
+		}
+		size_t remaining = rangeSize - padding - size;
+		if (remaining > 0) {
+			freeRanges[alignedStart + size] = remaining;
+		}
+		freeSpace -= size;
+		outOffset = alignedStart;
+		return true;
+	}
+	return false;
+}
+
+void RangeAllocator::Free(size_t offset, size_t size) {
+	if (size == 0) {
+		return;
+	}
+	freeSpace += size;
+
+	auto next = freeRanges.lower_bound(offset);
+	//Merge with the following range if they touch
+	if (next != freeRanges.end() && offset + size == next->first) {
+		size += next->second;
+		next = freeRanges.erase(next);
+	}
+	//And the previous one
+	if (next != freeRanges.begin()) {
+		auto prev = std::prev(next);
+		if (prev->first + prev->second == offset) {
+			prev->second += size;
+			return;
+		}
+	}
+	freeRanges[offset] = size;
+}
+
+size_t RangeAllocator::GetLargestFreeRange() const {
+	size_t largest = 0;
+	for (const auto& i : freeRanges) {
+		largest = std::max(largest, i.second);
+	}
+	return largest;
+}
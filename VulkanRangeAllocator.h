@@ -0,0 +1,42 @@
+/******************************************************************************
+This file is part of the Newcastle Vulkan Tutorial Series
+
+Author:Rich Davison
+Contact:richgdavison@gmail.com
+License: MIT (see LICENSE file at the top of the source tree)
+*//////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+namespace NCL::Rendering::Vulkan {
+	/*
+	RangeAllocator: Hands out ranges of some fixed size address space, such
+	as a region of a buffer. It only deals in numbers - it's up to the user
+	to decide what the ranges are used for, and to track their sizes so that
+	they can be freed again. Freed ranges are merged with their neighbours.
+	*/
+	class RangeAllocator	{
+	public:
+		RangeAllocator(size_t capacity = 0);
+		~RangeAllocator() {}
+
+		//Returns false if there's no free range big enough
+		bool	Allocate(size_t size, size_t alignment, size_t& outOffset);
+		void	Free(size_t offset, size_t size);
+
+		void	Reset(size_t capacity);
+
+		size_t	GetCapacity() const {
+			return capacity;
+		}
+		size_t	GetFreeSpace() const {
+			return freeSpace;
+		}
+		size_t	GetLargestFreeRange() const;
+
+	protected:
+		std::map<size_t, size_t> freeRanges; //Offset to size
+
+		size_t capacity;
+		size_t freeSpace;
+	};
+}
@@ -104,6 +104,10 @@ VulkanRayTracingPipelineBuilder& VulkanRayTracingPipelineBuilder::WithShader(Vul
 }
 
 VulkanPipeline VulkanRayTracingPipelineBuilder::Build(const std::string& debugName, vk::PipelineCache cache) {
+	if (!cache) {
+		cache = GetDefaultPipelineCache(sourceDevice);
+	}
+	shaderStages.clear();
 	for (const auto& i : entries) {
 		vk::PipelineShaderStageCreateInfo stageInfo;
 
@@ -10,6 +10,12 @@ License: MIT (see LICENSE file at the top of the source tree)
 #include "VulkanTexture.h"
 #include "VulkanTextureBuilder.h"
 #include "VulkanDescriptorSetLayoutBuilder.h"
+#include "VulkanDescriptorSetLayoutCache.h"
+#include "VulkanDescriptorAllocator.h"
+#include "VulkanDescriptorBufferRing.h"
+#include "VulkanBufferBuilder.h"
+#include "VulkanStagingRingBuffer.h"
+#include "VulkanUploadScheduler.h"
 
 #include "VulkanUtils.h"
 
@@ -20,6 +26,10 @@ using namespace NCL::Win32Code;
 
 #define VMA_IMPLEMENTATION
 #include "vma/vk_mem_alloc.h"
+#include <future>
+#include <fstream>
+#include <filesystem>
+#include <thread>
 
 using namespace NCL;
 using namespace Rendering;
@@ -44,50 +54,95 @@ VulkanRenderer::VulkanRenderer(Window& window, const VulkanInitialisation& vkIni
 	InitGPUDevice(vkInit);
 	InitMemoryAllocator(vkInit);
 
+	stagingBuffer = std::make_unique<StagingRingBuffer>(device, memoryAllocator, vkInit.stagingBufferSize);
+
 	InitCommandPools();
+	InitFramesInFlight();
+
+	if (vkInit.asyncUploads) {
+		uploadScheduler = std::make_unique<UploadScheduler>(device, memoryAllocator, 
+			queues[CommandType::Copy], queueFamilies[CommandType::Copy], queueFamilies[CommandType::Graphics], vkInit.asyncUploadStagingSize);
+	}
 	InitDefaultDescriptorPool();
+
+	layoutCache = std::make_unique<DescriptorSetLayoutCache>(device);
+	SetDescriptorSetLayoutCache(device, layoutCache.get());
 	InitDefaultDescriptorSetLayouts();
 
+	descriptorAllocator = std::make_unique<DescriptorAllocator>(device, true, 128, "Persistent Descriptor Pool");
+
+	if (vkInit.descriptorBufferSize > 0) {
+		vk::PhysicalDeviceDescriptorBufferPropertiesEXT descriptorBufferProps;
+		vk::PhysicalDeviceProperties2 props2 = {
+			.pNext = &descriptorBufferProps
+		};
+		gpu.getProperties2(&props2);
+		SetDescriptorSizes(device, descriptorBufferProps);
+
+		descriptorBufferRing = std::make_unique<DescriptorBufferRing>(device, memoryAllocator, vkInit.descriptorBufferSize, (uint32_t)framesInFlight.size());
+	}
+
 	OnWindowResize(window.GetScreenSize().x, window.GetScreenSize().y);
 
-	pipelineCache = device.createPipelineCache(vk::PipelineCacheCreateInfo());
+	InitPipelineCache();
 
-	frameCmds = swapChainList[currentSwap]->cmdBuffer;
+	frameCmds = framesInFlight[currentFrame].cmdBuffer;
 }
 
 VulkanRenderer::~VulkanRenderer() {
 	device.waitIdle();
+	uploadScheduler.reset();
+	stagingBuffer.reset();
 	depthBuffer.reset();
+	headlessImages.clear();
 
-	for (auto& i : swapChainList) {
-		device.destroyImageView(i->colourView);
-	};
+	if (!vkInit.headless) {
+		for (auto& i : swapChainList) {
+			device.destroyImageView(i->colourView);
+		};
+	}
 
 	for (unsigned int i = 0; i < numFrameBuffers; ++i) {
 		device.destroyFramebuffer(frameBuffers[i]);
-		device.destroySemaphore(swapSemaphores[i]);
-		device.destroyFence(swapFences[i]);
 	}
-
-	for (unsigned int i = 0; i < DefaultSetLayouts::MAX_SIZE; ++i) {
-		if (defaultLayouts[i]) {
-			device.destroyDescriptorSetLayout(defaultLayouts[i]);
+	for (auto& i : renderFinishedSemaphores) {
+		device.destroySemaphore(i);
+	}
+	for (auto& i : framesInFlight) {
+		device.destroySemaphore(i.acquireSemaphore);
+		device.destroyFence(i.completeFence);
+		for (auto& t : i.threadCommands) {
+			device.destroyCommandPool(t.pool);
 		}
+		i.descriptorAllocator.reset();
 	}
+	descriptorAllocator.reset();
+	descriptorBufferRing.reset();
+
+	//Destroys the default layouts too
+	SetDescriptorSetLayoutCache(device, nullptr);
+	layoutCache.reset();
 
 	vmaDestroyAllocator(memoryAllocator);
 	device.destroyDescriptorPool(defaultDescriptorPool);
-	device.destroySwapchainKHR(swapChain);
+	//Headless renderers never load the swapchain or surface extensions
+	if (swapChain) {
+		device.destroySwapchainKHR(swapChain);
+	}
 
 	device.destroyCommandPool(commandPools[CommandType::Graphics]);
 	device.destroyCommandPool(commandPools[CommandType::Copy]);
 	device.destroyCommandPool(commandPools[CommandType::AsyncCompute]);
 
 	device.destroyRenderPass(defaultRenderPass);
+	SavePipelineCache();
+	SetDefaultPipelineCache(device, {});
 	device.destroyPipelineCache(pipelineCache);
 	device.destroy(); //Destroy everything except instance before this gets destroyed!
 
-	instance.destroySurfaceKHR(surface);
+	if (surface) {
+		instance.destroySurfaceKHR(surface);
+	}
 	instance.destroy();
 
 	delete[] frameBuffers;
@@ -219,6 +274,12 @@ bool VulkanRenderer::InitGPUDevice(const VulkanInitialisation& vkInit) {
 }
 
 bool VulkanRenderer::InitSurface() {
+	if (vkInit.headless) {
+		//No window to present to, we render straight into our own images
+		surfaceFormat	= vkInit.headlessColourFormat;
+		surfaceSpace	= vk::ColorSpaceKHR::eSrgbNonlinear;
+		return true;
+	}
 #ifdef _WIN32
 	Win32Window* window = (Win32Window*)&hostWindow;
 
@@ -246,6 +307,9 @@ bool VulkanRenderer::InitSurface() {
 }
 
 uint32_t VulkanRenderer::InitBufferChain(vk::CommandBuffer  cmdBuffer) {
+	if (vkInit.headless) {
+		return InitHeadlessChain(cmdBuffer);
+	}
 	vk::SwapchainKHR oldChain					= swapChain;
 	std::vector<FrameState*> oldSwapChainList	= swapChainList;
 	swapChainList.clear();
@@ -310,14 +374,11 @@ uint32_t VulkanRenderer::InitBufferChain(vk::CommandBuffer  cmdBuffer) {
 
 	auto images = device.getSwapchainImagesKHR(swapChain);
 
-	if (!swapFences.empty()) {
-		device.resetFences(swapFences);
-	}
-
-	for (int i = swapSemaphores.size(); i < images.size(); i++) {
-		swapSemaphores.push_back(device.createSemaphore({}));
-		swapFences.push_back(device.createFence({}));
+	for (int i = renderFinishedSemaphores.size(); i < images.size(); i++) {
+		renderFinishedSemaphores.push_back(device.createSemaphore({}));
 	}
+	swapImageFences.clear();
+	swapImageFences.resize(images.size());
 
 	for (auto& i : images) {
 		FrameState* chain = new FrameState();
@@ -336,19 +397,6 @@ uint32_t VulkanRenderer::InitBufferChain(vk::CommandBuffer  cmdBuffer) {
 
 		swapChainList.push_back(chain);
 
-		auto buffers = device.allocateCommandBuffers(	
-			{
-				.commandPool = commandPools[CommandType::Graphics],
-				.level = vk::CommandBufferLevel::ePrimary,
-				.commandBufferCount = 1
-			}
-		);
-		 
-		chain->cmdBuffer = buffers[0];
-
-		chain->acquireSempaphore = swapSemaphores[swapCycle];
-		chain->acquireFence		 = swapFences[swapCycle];
-
 		chain->defaultViewport		= defaultViewport;
 		chain->defaultScissor		= defaultScissor;
 		chain->defaultScreenRect	= defaultScreenRect;
@@ -359,10 +407,208 @@ uint32_t VulkanRenderer::InitBufferChain(vk::CommandBuffer  cmdBuffer) {
 		chain->depthView	= depthBuffer->GetDefaultView();
 		chain->depthFormat	= depthBuffer->GetFormat();
 	}
-	swapCycle = 1;
 	return (int)images.size();
 }
 
+uint32_t VulkanRenderer::InitHeadlessChain(vk::CommandBuffer  cmdBuffer) {
+	for (auto& i : swapChainList) {
+		delete i;
+	}
+	swapChainList.clear();
+	headlessImages.clear();
+
+	uint32_t imageCount = std::max(vkInit.headlessImageCount, 1u);
+
+	swapImageFences.clear();
+	swapImageFences.resize(imageCount);
+
+	for (uint32_t i = 0; i < imageCount; ++i) {
+		headlessImages.push_back(TextureBuilder(GetDevice(), GetMemoryAllocator())
+			.UsingPool(GetCommandPool(CommandType::Graphics))
+			.UsingQueue(GetQueue(CommandType::Graphics))
+			.WithDimension(hostWindow.GetScreenSize().x, hostWindow.GetScreenSize().y)
+			.WithAspects(vk::ImageAspectFlagBits::eColor)
+			.WithFormat(surfaceFormat)
+			.WithLayout(vk::ImageLayout::eColorAttachmentOptimal)
+			.WithUsages(vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eSampled)
+			.WithPipeFlags(vk::PipelineStageFlagBits2::eColorAttachmentOutput)
+			.WithMips(false)
+			.Build("Headless Colour Image " + std::to_string(i))
+		);
+
+		FrameState* chain = new FrameState();
+
+		chain->colourImage	= headlessImages.back()->GetImage();
+		chain->colourView	= headlessImages.back()->GetDefaultView();
+		chain->colourFormat = surfaceFormat;
+
+		chain->defaultViewport		= defaultViewport;
+		chain->defaultScissor		= defaultScissor;
+		chain->defaultScreenRect	= defaultScreenRect;
+
+		chain->depthImage	= depthBuffer->GetImage();
+		chain->depthView	= depthBuffer->GetDefaultView();
+		chain->depthFormat	= depthBuffer->GetFormat();
+
+		swapChainList.push_back(chain);
+	}
+	currentSwap = imageCount - 1;
+	return imageCount;
+}
+
+void	VulkanRenderer::InitFramesInFlight() {
+	uint32_t frameCount = std::max(vkInit.framesInFlight, 1u);
+
+	auto buffers = device.allocateCommandBuffers(
+		{
+			.commandPool = commandPools[CommandType::Graphics],
+			.level = vk::CommandBufferLevel::ePrimary,
+			.commandBufferCount = frameCount
+		}
+	);
+
+	framesInFlight.resize(frameCount);
+	for (uint32_t i = 0; i < frameCount; ++i) {
+		framesInFlight[i].cmdBuffer			= buffers[i];
+		//Starts signalled, so the first wait on each frame returns immediately
+		framesInFlight[i].completeFence		= device.createFence({ .flags = vk::FenceCreateFlagBits::eSignaled });
+		framesInFlight[i].acquireSemaphore	= device.createSemaphore({});
+
+		SetDebugName(device, vk::ObjectType::eCommandBuffer, GetVulkanHandle(buffers[i]), "Frame cmds " + std::to_string(i));
+
+		framesInFlight[i].descriptorAllocator = std::make_unique<DescriptorAllocator>(device, false, 128, "Frame Descriptor Pool " + std::to_string(i));
+	}
+
+	recordingThreadCount = vkInit.recordingThreads > 0 ? vkInit.recordingThreads : std::max(std::thread::hardware_concurrency(), 1u);
+	for (uint32_t i = 0; i < frameCount; ++i) {
+		framesInFlight[i].threadCommands.resize(recordingThreadCount);
+		for (auto& t : framesInFlight[i].threadCommands) {
+			//Reset all at once at the start of the frame, rather than per buffer
+			t.pool = device.createCommandPool(
+				{
+					.flags = vk::CommandPoolCreateFlagBits::eTransient,
+					.queueFamilyIndex = queueFamilies[CommandType::Graphics]
+				}
+			);
+		}
+	}
+}
+
+/*
+The cache data is prefixed with a header describing the device and driver
+that made it, along with a hash of the data, so a cache from a different
+GPU or driver, or a partly written file, is thrown away rather than given
+to the driver.
+*/
+struct PipelineCacheFileHeader {
+	uint32_t	magic;
+	uint32_t	headerVersion;
+	uint32_t	vendorID;
+	uint32_t	deviceID;
+	uint32_t	driverVersion;
+	uint8_t		pipelineCacheUUID[VK_UUID_SIZE];
+	uint64_t	dataSize;
+	uint64_t	dataHash;
+};
+
+const uint32_t PIPELINE_CACHE_MAGIC		= 0x504C434E; //'NCLP'
+const uint32_t PIPELINE_CACHE_VERSION	= 1;
+
+static uint64_t HashCacheData(const char* data, size_t size) {
+	uint64_t hash = 14695981039346656037ull; //FNV-1a
+	for (size_t i = 0; i < size; ++i) {
+		hash = (hash ^ (uint8_t)data[i]) * 1099511628211ull;
+	}
+	return hash;
+}
+
+static PipelineCacheFileHeader MakeCacheHeader(const vk::PhysicalDeviceProperties& props) {
+	PipelineCacheFileHeader header = {};
+	header.magic			= PIPELINE_CACHE_MAGIC;
+	header.headerVersion	= PIPELINE_CACHE_VERSION;
+	header.vendorID			= props.vendorID;
+	header.deviceID			= props.deviceID;
+	header.driverVersion	= props.driverVersion;
+	memcpy(header.pipelineCacheUUID, props.pipelineCacheUUID.data(), VK_UUID_SIZE);
+	return header;
+}
+
+void	VulkanRenderer::InitPipelineCache() {
+	std::vector<char> cacheData;
+
+	std::ifstream file(vkInit.pipelineCacheFile, std::ios::binary);
+	if (!vkInit.pipelineCacheFile.empty() && file) {
+		PipelineCacheFileHeader expected	= MakeCacheHeader(deviceProperties);
+		PipelineCacheFileHeader header		= {};
+		file.read((char*)&header, sizeof(header));
+
+		bool valid = file.gcount() == sizeof(header) &&
+			header.magic			== expected.magic			&&
+			header.headerVersion	== expected.headerVersion	&&
+			header.vendorID			== expected.vendorID		&&
+			header.deviceID			== expected.deviceID		&&
+			header.driverVersion	== expected.driverVersion	&&
+			memcmp(header.pipelineCacheUUID, expected.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+
+		if (valid) {
+			//Don't trust the stored size until we know the file really holds that much
+			std::streampos dataStart = file.tellg();
+			file.seekg(0, std::ios::end);
+			std::streamoff remaining = file.tellg() - dataStart;
+			file.seekg(dataStart);
+			valid = remaining >= 0 && header.dataSize <= (uint64_t)remaining;
+		}
+		if (valid) {
+			cacheData.resize(header.dataSize);
+			file.read(cacheData.data(), header.dataSize);
+			valid = file.gcount() == (std::streamsize)header.dataSize && HashCacheData(cacheData.data(), cacheData.size()) == header.dataHash;
+		}
+		if (!valid) {
+			std::cout << __FUNCTION__ << " Pipeline cache " << vkInit.pipelineCacheFile << " is from a different device or driver, or is damaged. Ignoring it\n";
+			cacheData.clear();
+		}
+	}
+	pipelineCache = device.createPipelineCache(
+		{
+			.initialDataSize	= cacheData.size(),
+			.pInitialData		= cacheData.data()
+		}
+	);
+	SetDefaultPipelineCache(device, pipelineCache);
+}
+
+bool	VulkanRenderer::SavePipelineCache() {
+	if (vkInit.pipelineCacheFile.empty() || !pipelineCache) {
+		return false;
+	}
+	std::vector<uint8_t> cacheData = device.getPipelineCacheData(pipelineCache);
+
+	PipelineCacheFileHeader header = MakeCacheHeader(deviceProperties);
+	header.dataSize = cacheData.size();
+	header.dataHash = HashCacheData((const char*)cacheData.data(), cacheData.size());
+
+	//Written to a temporary file first, so a crash part way through can't leave a broken cache behind
+	std::string tempFile = vkInit.pipelineCacheFile + ".tmp";
+	{
+		std::ofstream file(tempFile, std::ios::binary | std::ios::trunc);
+		file.write((const char*)&header, sizeof(header));
+		file.write((const char*)cacheData.data(), cacheData.size());
+		file.flush();
+		if (!file) {
+			std::cout << __FUNCTION__ << " Failed to write pipeline cache " << tempFile << "\n";
+			return false;
+		}
+	}
+	std::error_code error;
+	std::filesystem::rename(tempFile, vkInit.pipelineCacheFile, error);
+	if (error) {
+		std::cout << __FUNCTION__ << " Failed to replace pipeline cache " << vkInit.pipelineCacheFile << ": " << error.message() << "\n";
+		std::filesystem::remove(tempFile, error);
+		return false;
+	}
+	return true;
+}
+
 void	VulkanRenderer::InitCommandPools() {	
 	for (uint32_t i = 0; i < CommandType::MAX_COMMAND_TYPES; ++i) {
 		commandPools[i] = device.createCommandPool(
@@ -399,7 +645,7 @@ bool VulkanRenderer::InitDeviceQueueIndices() {
 	int copyBits	= INT_MAX;
 
 	for (unsigned int i = 0; i < deviceQueueProps.size(); ++i) {
-		supportsPresent = gpu.getSurfaceSupportKHR(i, surface);
+		supportsPresent = surface ? gpu.getSurfaceSupportKHR(i, surface) : false;
 
 		int queueBitCount = std::popcount((uint32_t)deviceQueueProps[i].queueFlags);
 
@@ -426,6 +672,10 @@ bool VulkanRenderer::InitDeviceQueueIndices() {
 		return false;
 	}
 
+	if (vkInit.headless) {
+		queueFamilies[CommandType::Present] = queueFamilies[CommandType::Graphics];
+	}
+
 	if (queueFamilies[CommandType::AsyncCompute] == -1) {
 		queueFamilies[CommandType::AsyncCompute] = queueFamilies[CommandType::Graphics];
 	}
@@ -434,7 +684,7 @@ bool VulkanRenderer::InitDeviceQueueIndices() {
 	}
 
 	if (queueFamilies[CommandType::Copy] == -1) {
-		queueFamilies[CommandType::Copy] = queueFamilies[CommandType::Copy];
+		queueFamilies[CommandType::Copy] = queueFamilies[CommandType::Graphics];
 	}
 	else {
 		std::cout << __FUNCTION__ << " Device supports async copy!\n";
@@ -502,20 +752,36 @@ void VulkanRenderer::CompleteResize() {
 }
 
 void VulkanRenderer::WaitForSwapImage() {
+	//The GPU waits on the acquire semaphore at submission, we just
+	//need to get the image into a layout we can render to
 	TransitionUndefinedToColour(frameCmds, swapChainList[currentSwap]->colourImage);
-
-	if (!hostWindow.IsMinimised()) {
-		vk::Result waitResult = device.waitForFences(swapChainList[currentSwap]->acquireFence, true, ~0);
-	}
 }
 
 void	VulkanRenderer::AcquireSwapImage() {
-	device.resetFences(swapChainList[currentSwap]->acquireFence);
+	FrameInFlight& frame = framesInFlight[currentFrame];
 
-	currentSwap = device.acquireNextImageKHR(swapChain, UINT64_MAX, swapSemaphores[swapCycle], swapFences[swapCycle]).value;	//Get swap image
+	//Don't reuse this frame's command buffer until the GPU is done with it
+	vk::Result waitResult = device.waitForFences(frame.completeFence, true, UINT64_MAX);
 
-	swapChainList[currentSwap]->acquireSempaphore = swapSemaphores[swapCycle];
-	swapChainList[currentSwap]->acquireFence = swapFences[swapCycle];
+	if (vkInit.headless) {
+		currentSwap = (currentSwap + 1) % numFrameBuffers;
+	}
+	else {
+		currentSwap = device.acquireNextImageKHR(swapChain, UINT64_MAX, frame.acquireSemaphore, {}).value;	//Get swap image
+	}
+
+	//There may be more frames in flight than images, in which case another
+	//frame could still be using the image we've just been given
+	if (swapImageFences[currentSwap] && swapImageFences[currentSwap] != frame.completeFence) {
+		waitResult = device.waitForFences(swapImageFences[currentSwap], true, UINT64_MAX);
+	}
+	swapImageFences[currentSwap] = frame.completeFence;
+
+	device.resetFences(frame.completeFence);
+
+	swapChainList[currentSwap]->cmdBuffer			= frame.cmdBuffer;
+	swapChainList[currentSwap]->acquireSempaphore	= vkInit.headless ? vk::Semaphore() : frame.acquireSemaphore;
+	swapChainList[currentSwap]->acquireFence		= frame.completeFence;
 
 	swapChainList[currentSwap]->defaultViewport		= defaultViewport;
 	swapChainList[currentSwap]->defaultScissor		= defaultScissor;
@@ -524,8 +790,6 @@ void	VulkanRenderer::AcquireSwapImage() {
 	swapChainList[currentSwap]->colourFormat = surfaceFormat;
 	swapChainList[currentSwap]->depthFormat  = depthBuffer->GetFormat();
 
-	swapCycle = (swapCycle + 1) % swapSemaphores.size();
-
 	defaultBeginInfo = vk::RenderPassBeginInfo()
 		.setRenderPass(defaultRenderPass)
 		.setFramebuffer(frameBuffers[currentSwap])
@@ -536,11 +800,26 @@ void	VulkanRenderer::AcquireSwapImage() {
 
 void	VulkanRenderer::BeginFrame() {
 	AcquireSwapImage();
-	frameCmds = swapChainList[currentSwap]->cmdBuffer;
+	stagingBuffer->Reclaim();
+	frameCmds = framesInFlight[currentFrame].cmdBuffer;
 	frameCmds.reset({});
 
+	//This frame's fence has been waited on, so its secondaries are finished with
+	for (auto& t : framesInFlight[currentFrame].threadCommands) {
+		device.resetCommandPool(t.pool);
+		t.usedSecondaries = 0;
+	}
+	framesInFlight[currentFrame].descriptorAllocator->Reset();
+	if (descriptorBufferRing) {
+		descriptorBufferRing->BeginFrame(currentFrame);
+	}
+
 	frameCmds.begin(vk::CommandBufferBeginInfo());
 
+	if (uploadScheduler) {
+		frameUploadWait = uploadScheduler->RecordAcquireBarriers(frameCmds);
+	}
+
 	if (!vkInit.skipDynamicState) {
 		frameCmds.setViewport(0, 1, &defaultViewport);
 		frameCmds.setScissor(0, 1, &defaultScissor);
@@ -550,7 +829,7 @@ void	VulkanRenderer::BeginFrame() {
 		WaitForSwapImage();
 	}
 	if (vkInit.autoBeginDynamicRendering) {
-		BeginDefaultRendering(frameCmds);
+		BeginDefaultRendering(frameCmds, vkInit.parallelDefaultRendering ? vk::RenderingFlagBits::eContentsSecondaryCommandBuffers : vk::RenderingFlags());
 	}
 }
 
@@ -563,35 +842,142 @@ void	VulkanRenderer::EndFrame() {
 		frameCmds.endRendering();
 	}
 
-	if (hostWindow.IsMinimised()) {
-		CmdBufferEndSubmitWait(frameCmds, device, queues[CommandType::Graphics]);
+	FrameInFlight& frame = framesInFlight[currentFrame];
+
+	std::vector<vk::SemaphoreSubmitInfo> waitInfos;
+	std::vector<vk::SemaphoreSubmitInfo> signalInfos;
+
+	if (!vkInit.headless) {
+		//Folded into the frame's commands, rather than a separate submission
+		TransitionColourToPresent(frameCmds, swapChainList[currentSwap]->colourImage);
+
+		waitInfos.push_back({
+			.semaphore	= frame.acquireSemaphore,
+			.stageMask	= vk::PipelineStageFlagBits2::eColorAttachmentOutput
+		});
+		if (!hostWindow.IsMinimised()) {
+			signalInfos.push_back({
+				.semaphore	= renderFinishedSemaphores[currentSwap],
+				.stageMask	= vk::PipelineStageFlagBits2::eAllCommands
+			});
+		}
 	}
-	else {
-		CmdBufferEndSubmit(frameCmds, queues[CommandType::Graphics]);
+	if (frameUploadWait > 0) {
+		waitInfos.push_back({
+			.semaphore	= uploadScheduler->GetTimelineSemaphore(),
+			.value		= frameUploadWait,
+			.stageMask	= vk::PipelineStageFlagBits2::eAllCommands
+		});
+		frameUploadWait = 0;
 	}
-}
+	frameCmds.end();
 
-void VulkanRenderer::SwapBuffers() {
-	if (!hostWindow.IsMinimised()) {
-		vk::CommandPool gfxPool		= commandPools[CommandType::Graphics];
-		vk::Queue		gfxQueue	= queues[CommandType::Graphics];
+	vk::CommandBufferSubmitInfo cmdInfo = {
+		.commandBuffer = frameCmds
+	};
 
-		vk::UniqueCommandBuffer cmds = CmdBufferCreateBegin(device, gfxPool, "Window swap cmds");
+	vk::SubmitInfo2 submitInfo = {
+		.waitSemaphoreInfoCount		= (uint32_t)waitInfos.size(),
+		.pWaitSemaphoreInfos		= waitInfos.data(),
+		.commandBufferInfoCount		= 1,
+		.pCommandBufferInfos		= &cmdInfo,
+		.signalSemaphoreInfoCount	= (uint32_t)signalInfos.size(),
+		.pSignalSemaphoreInfos		= signalInfos.data()
+	};
 
-		TransitionColourToPresent(*cmds, swapChainList[currentSwap]->colourImage);
+	queues[CommandType::Graphics].submit2(submitInfo, frame.completeFence);
 
-		CmdBufferEndSubmitWait(*cmds, device, gfxQueue);
+	//Anything staged by commands recorded into this frame can be reused once the queue has passed this point
+	if (stagingBuffer->HasUnfencedAllocations()) {
+		vk::Result fenceResult = queues[CommandType::Graphics].submit(0, nullptr, stagingBuffer->FenceAllocations());
+	}
+	//Get whatever streaming work was queued up during the frame moving
+	if (uploadScheduler) {
+		uploadScheduler->Flush();
+	}
+}
 
-		vk::Result presentResult = gfxQueue.presentKHR(
+void VulkanRenderer::SwapBuffers() {
+	if (!hostWindow.IsMinimised() && !vkInit.headless) {
+		vk::Result presentResult = queues[CommandType::Graphics].presentKHR(
 			{
 				.waitSemaphoreCount = 1,
-				.pWaitSemaphores = &swapChainList[currentSwap]->acquireSempaphore,
+				.pWaitSemaphores = &renderFinishedSemaphores[currentSwap],
 				.swapchainCount = 1,
 				.pSwapchains = &swapChain,
 				.pImageIndices = &currentSwap
 			}
 		);	
 	}
+	currentFrame = (currentFrame + 1) % framesInFlight.size();
+}
+
+bool VulkanRenderer::ReadbackFrame(std::vector<uint8_t>& outData) {
+	if (!MessageAssert(vkInit.headless, "Frame readback is only supported by headless renderers!")) {
+		return false;
+	}
+	FrameState& frame = *swapChainList[currentSwap];
+
+	if (swapImageFences[currentSwap] && device.waitForFences(swapImageFences[currentSwap], true, UINT64_MAX) != vk::Result::eSuccess) {
+		return false;
+	}
+
+	size_t texelSize = 4;
+	switch (frame.colourFormat) {
+		case vk::Format::eR16G16B16A16Sfloat:	texelSize = 8;	break;
+		case vk::Format::eR32G32B32A32Sfloat:	texelSize = 16; break;
+		default: break;
+	}
+
+	uint32_t width	= defaultScreenRect.extent.width;
+	uint32_t height = defaultScreenRect.extent.height;
+	size_t dataSize = width * height * texelSize;
+
+	VulkanBuffer readbackBuffer = BufferBuilder(device, memoryAllocator)
+		.WithBufferUsage(vk::BufferUsageFlagBits::eTransferDst)
+		.WithHostVisibility()
+		.Build(dataSize, "Frame Readback Buffer");
+
+	vk::UniqueCommandBuffer cmds = CmdBufferCreateBegin(device, commandPools[CommandType::Graphics], "Frame readback cmds");
+
+	ImageTransitionBarrier(*cmds, frame.colourImage, 
+		vk::ImageLayout::eColorAttachmentOptimal, vk::ImageLayout::eTransferSrcOptimal, 
+		vk::ImageAspectFlagBits::eColor, 
+		vk::PipelineStageFlagBits2::eColorAttachmentOutput, vk::PipelineStageFlagBits2::eTransfer);
+
+	cmds->copyImageToBuffer(frame.colourImage, vk::ImageLayout::eTransferSrcOptimal, readbackBuffer.buffer,
+		vk::BufferImageCopy{
+			.imageSubresource = {
+				.aspectMask = vk::ImageAspectFlagBits::eColor,
+				.mipLevel	= 0,
+				.layerCount = 1
+			},
+			.imageExtent{width, height, 1}
+		}
+	);
+
+	ImageTransitionBarrier(*cmds, frame.colourImage,
+		vk::ImageLayout::eTransferSrcOptimal, vk::ImageLayout::eColorAttachmentOptimal,
+		vk::ImageAspectFlagBits::eColor,
+		vk::PipelineStageFlagBits2::eTransfer, vk::PipelineStageFlagBits2::eColorAttachmentOutput);
+
+	vk::MemoryBarrier2 hostBarrier = {
+		.srcStageMask	= vk::PipelineStageFlagBits2::eTransfer,
+		.srcAccessMask	= vk::AccessFlagBits2::eTransferWrite,
+		.dstStageMask	= vk::PipelineStageFlagBits2::eHost,
+		.dstAccessMask	= vk::AccessFlagBits2::eHostRead
+	};
+	cmds->pipelineBarrier2({ .memoryBarrierCount = 1, .pMemoryBarriers = &hostBarrier });
+
+	CmdBufferEndSubmitWait(*cmds, device, queues[CommandType::Graphics]);
+
+	vmaInvalidateAllocation(memoryAllocator, readbackBuffer.allocationHandle, 0, VK_WHOLE_SIZE);
+
+	outData.resize(dataSize);
+	memcpy(outData.data(), readbackBuffer.Map(), dataSize);
+	readbackBuffer.Unmap();
+
+	return true;
 }
 
 void	VulkanRenderer::InitDefaultRenderPass() {
@@ -700,19 +1086,19 @@ void	VulkanRenderer::InitDefaultDescriptorPool(uint32_t maxSets) {
 void VulkanRenderer::InitDefaultDescriptorSetLayouts() {
 	defaultLayouts[DefaultSetLayouts::Single_Texture] = DescriptorSetLayoutBuilder(GetDevice())
 		.WithImageSamplers(0, 1, vk::ShaderStageFlagBits::eAll)
-		.Build("Default Single Texture Layout").release();
+		.BuildCached("Default Single Texture Layout");
 
 	defaultLayouts[DefaultSetLayouts::Single_UBO] = DescriptorSetLayoutBuilder(GetDevice())
 		.WithUniformBuffers(0, 1, vk::ShaderStageFlagBits::eAll)
-		.Build("Default Single UBO Layout").release();
+		.BuildCached("Default Single UBO Layout");
 
 	defaultLayouts[DefaultSetLayouts::Single_SSBO] = DescriptorSetLayoutBuilder(GetDevice())
 		.WithStorageBuffers(0, 1, vk::ShaderStageFlagBits::eAll)
-		.Build("Default Single SSBO Layout").release();
+		.BuildCached("Default Single SSBO Layout");
 
 	defaultLayouts[DefaultSetLayouts::Single_Storage_Image] = DescriptorSetLayoutBuilder(GetDevice())
 		.WithStorageImages(0, 1, vk::ShaderStageFlagBits::eAll)
-		.Build("Default Single Storage Image Layout").release();
+		.BuildCached("Default Single Storage Image Layout");
 
 	//defaultLayouts[InbuiltDescriptorSetLayouts::Single_TLAS] = DescriptorSetLayoutBuilder(GetDevice())
 	//	.WithSamplers(1, vk::ShaderStageFlagBits::eAll)
@@ -725,7 +1111,7 @@ void	VulkanRenderer::BeginDefaultRenderPass(vk::CommandBuffer  cmds) {
 	//cmds.setScissor(0, 1, &defaultScissor);
 }
 
-void	VulkanRenderer::BeginDefaultRendering(vk::CommandBuffer  cmds) {
+void	VulkanRenderer::BeginDefaultRendering(vk::CommandBuffer  cmds, vk::RenderingFlags flags) {
 	vk::RenderingInfoKHR renderInfo;
 	renderInfo.layerCount = 1;
 
@@ -748,10 +1134,108 @@ void	VulkanRenderer::BeginDefaultRendering(vk::CommandBuffer  cmds) {
 		//.setPStencilAttachment(&depthAttachment);
 
 	renderInfo.setRenderArea(defaultScreenRect);
+	renderInfo.setFlags(flags);
+
+	//The depth buffer is shared by every frame in flight, so the previous frame
+	//must be done writing and reading it before this one clears it
+	ImageTransitionBarrier(cmds, depthBuffer->GetImage(), {
+		.srcStageMask	= vk::PipelineStageFlagBits2::eLateFragmentTests | vk::PipelineStageFlagBits2::eFragmentShader | vk::PipelineStageFlagBits2::eComputeShader,
+		.srcAccessMask	= vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
+		.dstStageMask	= vk::PipelineStageFlagBits2::eEarlyFragmentTests | vk::PipelineStageFlagBits2::eLateFragmentTests,
+		.dstAccessMask	= vk::AccessFlagBits2::eDepthStencilAttachmentRead | vk::AccessFlagBits2::eDepthStencilAttachmentWrite,
+		.oldLayout		= vk::ImageLayout::eDepthStencilAttachmentOptimal,
+		.newLayout		= vk::ImageLayout::eDepthStencilAttachmentOptimal,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.subresourceRange = { vk::ImageAspectFlagBits::eDepth | vk::ImageAspectFlagBits::eStencil, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS }
+	});
 
 	cmds.beginRendering(renderInfo);
-	cmds.setViewport(0, 1, &defaultViewport);
-	cmds.setScissor(0, 1, &defaultScissor);
+	//Secondaries set their own dynamic state
+	if (!(flags & vk::RenderingFlagBits::eContentsSecondaryCommandBuffers)) {
+		cmds.setViewport(0, 1, &defaultViewport);
+		cmds.setScissor(0, 1, &defaultScissor);
+	}
+}
+
+vk::CommandBuffer VulkanRenderer::GetSecondaryCommandBuffer(uint32_t threadIndex) {
+	assert(threadIndex < recordingThreadCount);
+	ThreadCommands& t = framesInFlight[currentFrame].threadCommands[threadIndex];
+
+	if (t.usedSecondaries == t.secondaries.size()) {
+		auto buffers = device.allocateCommandBuffers(
+			{
+				.commandPool		= t.pool,
+				.level				= vk::CommandBufferLevel::eSecondary,
+				.commandBufferCount = 8
+			}
+		);
+		t.secondaries.insert(t.secondaries.end(), buffers.begin(), buffers.end());
+	}
+	return t.secondaries[t.usedSecondaries++];
+}
+
+vk::CommandBufferInheritanceRenderingInfo VulkanRenderer::GetDefaultRenderingInheritance() const {
+	return {
+		.colorAttachmentCount		= 1,
+		.pColorAttachmentFormats	= &surfaceFormat,
+		.depthAttachmentFormat		= depthBuffer->GetFormat(),
+		.rasterizationSamples		= vk::SampleCountFlagBits::e1
+	};
+}
+
+vk::CommandBuffer VulkanRenderer::BeginSecondaryRendering(uint32_t threadIndex) {
+	return BeginSecondaryRendering(threadIndex, GetDefaultRenderingInheritance());
+}
+
+vk::CommandBuffer VulkanRenderer::BeginSecondaryRendering(uint32_t threadIndex, const vk::CommandBufferInheritanceRenderingInfo& renderingInfo) {
+	vk::CommandBuffer cmds = GetSecondaryCommandBuffer(threadIndex);
+
+	vk::CommandBufferInheritanceInfo inheritance = {
+		.pNext = &renderingInfo
+	};
+	cmds.begin(
+		{
+			.flags = vk::CommandBufferUsageFlagBits::eRenderPassContinue | vk::CommandBufferUsageFlagBits::eOneTimeSubmit,
+			.pInheritanceInfo = &inheritance
+		}
+	);
+	//Dynamic state isn't inherited from the primary
+	if (!vkInit.skipDynamicState) {
+		cmds.setViewport(0, 1, &defaultViewport);
+		cmds.setScissor(0, 1, &defaultScissor);
+	}
+	return cmds;
+}
+
+void VulkanRenderer::RecordParallel(uint32_t jobCount, const ParallelRecordFunc& recordFunc) {
+	RecordParallel(frameCmds, jobCount, GetDefaultRenderingInheritance(), recordFunc);
+}
+
+void VulkanRenderer::RecordParallel(vk::CommandBuffer primary, uint32_t jobCount, const vk::CommandBufferInheritanceRenderingInfo& renderingInfo, const ParallelRecordFunc& recordFunc) {
+	if (jobCount == 0) {
+		return;
+	}
+	uint32_t threadCount = std::min(jobCount, recordingThreadCount);
+	std::vector<vk::CommandBuffer> jobBuffers(jobCount);
+
+	//Each thread only touches its own pool, and its own jobs' entries
+	auto RecordJobs = [&](uint32_t threadIndex) {
+		for (uint32_t job = threadIndex; job < jobCount; job += threadCount) {
+			jobBuffers[job] = BeginSecondaryRendering(threadIndex, renderingInfo);
+			recordFunc(jobBuffers[job], job);
+			jobBuffers[job].end();
+		}
+	};
+	std::vector<std::future<void>> workers;
+	for (uint32_t i = 1; i < threadCount; ++i) {
+		workers.push_back(std::async(std::launch::async, RecordJobs, i));
+	}
+	RecordJobs(0); //This thread does a share too
+	for (auto& w : workers) {
+		w.wait();
+	}
+	primary.executeCommands(jobBuffers);
 }
 
 VkBool32 VulkanRenderer::DebugCallbackFunction(
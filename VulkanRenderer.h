@@ -20,6 +20,11 @@ namespace NCL::Rendering::Vulkan {
 	class VulkanCompute;
 	class VulkanTexture;
 	struct VulkanBuffer;
+	class StagingRingBuffer;
+	class UploadScheduler;
+	class DescriptorSetLayoutCache;
+	class DescriptorAllocator;
+	class DescriptorBufferRing;
 
 	namespace CommandType {
 		enum Type : uint32_t {
@@ -46,7 +51,7 @@ namespace NCL::Rendering::Vulkan {
 		vk::CommandBuffer	cmdBuffer;
 
 		vk::Semaphore		acquireSempaphore;
-		vk::Fence			acquireFence;
+		vk::Fence			acquireFence;	//Signalled once this frame's commands have completed
 
 		vk::Image			colourImage;
 		vk::ImageView		colourView;
@@ -70,6 +75,9 @@ namespace NCL::Rendering::Vulkan {
 		int majorVersion = 1;
 		int minorVersion = 1;
 
+		//How many frames the CPU may record ahead of the GPU
+		uint32_t			framesInFlight = 2;
+
 		std::vector<void*> features;
 
 		VmaAllocatorCreateFlags vmaFlags = {};
@@ -84,6 +92,29 @@ namespace NCL::Rendering::Vulkan {
 		bool				autoBeginDynamicRendering = true;
 		bool				useOpenGLCoordinates = false;
 		bool				skipDynamicState = false;
+
+		//Renders into a ring of offscreen images rather than a window swapchain
+		bool				headless = false;
+		uint32_t			headlessImageCount = 3;
+		vk::Format			headlessColourFormat = vk::Format::eR8G8B8A8Unorm;
+
+		//Size of the persistently mapped ring that mesh and texture uploads stage through
+		size_t				stagingBufferSize = 64 * 1024 * 1024;
+
+		//Creates an UploadScheduler on the copy queue. Needs the timelineSemaphore feature enabled
+		bool				asyncUploads = false;
+		size_t				asyncUploadStagingSize = 32 * 1024 * 1024;
+
+		//Pipeline cache loaded at startup and saved on shutdown. Left empty, the cache isn't kept between runs
+		std::string			pipelineCacheFile = "VulkanPipelineCache.bin";
+
+		//A command pool is made per recording thread, per frame in flight. 0 uses every hardware thread
+		uint32_t			recordingThreads = 0;
+		//Begins the default rendering for secondary command buffers, so it must be drawn to via RecordParallel
+		bool				parallelDefaultRendering = false;
+
+		//Per frame in flight. Non-zero creates a DescriptorBufferRing, which needs VK_EXT_descriptor_buffer enabled
+		size_t				descriptorBufferSize = 0;
 	};
 
 	class VulkanRenderer : public RendererBase {
@@ -127,6 +158,19 @@ namespace NCL::Rendering::Vulkan {
 			return defaultDescriptorPool;
 		}
 
+		//Grows as needed. Sets from here are freed individually, via AllocateUnique
+		DescriptorAllocator& GetDescriptorAllocator() {
+			return *descriptorAllocator;
+		}
+		//Sets from here only last until this frame in flight comes round again
+		DescriptorAllocator& GetFrameDescriptorAllocator() {
+			return *framesInFlight[currentFrame].descriptorAllocator;
+		}
+		//Only exists if VulkanInitialisation::descriptorBufferSize was set
+		DescriptorBufferRing* GetDescriptorBufferRing() const {
+			return descriptorBufferRing.get();
+		}
+
 		FrameState const& GetFrameState() const {
 			return *(swapChainList[currentSwap]);
 		}
@@ -135,12 +179,53 @@ namespace NCL::Rendering::Vulkan {
 			return defaultLayouts[layout];
 		}
 
+		//Every pipeline builder uses this cache unless given another
+		vk::PipelineCache GetPipelineCache() const {
+			return pipelineCache;
+		}
+		//Writes the pipeline cache out to VulkanInitialisation::pipelineCacheFile, which is also done on shutdown
+		bool	SavePipelineCache();
+
+		StagingRingBuffer& GetStagingBuffer() const {
+			return *stagingBuffer;
+		}
+
+		//Only valid if VulkanInitialisation::asyncUploads was set
+		UploadScheduler* GetUploadScheduler() const {
+			return uploadScheduler.get();
+		}
+
 		UniqueVulkanTexture const & GetDepthBuffer() const {
 			return depthBuffer;
 		}
 
+		bool IsHeadless() const {
+			return vkInit.headless;
+		}
+
+		//Copies the most recently rendered headless frame into host memory
+		bool	ReadbackFrame(std::vector<uint8_t>& outData);
+
 		void	BeginDefaultRenderPass(vk::CommandBuffer cmds);
-		void	BeginDefaultRendering(vk::CommandBuffer  cmds);
+		void	BeginDefaultRendering(vk::CommandBuffer  cmds, vk::RenderingFlags flags = {});
+
+		uint32_t GetRecordingThreadCount() const {
+			return recordingThreadCount;
+		}
+		//A secondary command buffer from a recording thread's pool for the current frame. Each thread
+		//index must only be used by one thread at a time, and the buffer is reset when the frame is reused
+		vk::CommandBuffer	GetSecondaryCommandBuffer(uint32_t threadIndex);
+		//Gets and begins a secondary command buffer that continues a dynamic rendering, the default one if not specified
+		vk::CommandBuffer	BeginSecondaryRendering(uint32_t threadIndex);
+		vk::CommandBuffer	BeginSecondaryRendering(uint32_t threadIndex, const vk::CommandBufferInheritanceRenderingInfo& renderingInfo);
+		vk::CommandBufferInheritanceRenderingInfo GetDefaultRenderingInheritance() const;
+
+		using ParallelRecordFunc = std::function<void(vk::CommandBuffer, uint32_t)>;
+		//Calls recordFunc once per job, spread over the recording threads, each into its own secondary
+		//command buffer, which are then executed in job order. The primary must be within a rendering begun
+		//with the eContentsSecondaryCommandBuffers flag, as the default rendering is with parallelDefaultRendering
+		void	RecordParallel(uint32_t jobCount, const ParallelRecordFunc& recordFunc);
+		void	RecordParallel(vk::CommandBuffer primary, uint32_t jobCount, const vk::CommandBufferInheritanceRenderingInfo& renderingInfo, const ParallelRecordFunc& recordFunc);
 
 		void BeginFrame()		override;
 		void RenderFrame()		override;
@@ -186,6 +271,9 @@ namespace NCL::Rendering::Vulkan {
 		bool	InitSurface();
 		void	InitMemoryAllocator(const VulkanInitialisation& vkInit);
 		uint32_t	InitBufferChain(vk::CommandBuffer  cmdBuffer);
+		uint32_t	InitHeadlessChain(vk::CommandBuffer  cmdBuffer);
+		void		InitFramesInFlight();
+		void		InitPipelineCache();
 
 		static VkBool32 DebugCallbackFunction(
 			VkDebugUtilsMessageSeverityFlagBitsEXT           messageSeverity,
@@ -219,13 +307,41 @@ namespace NCL::Rendering::Vulkan {
 
 		std::vector<FrameState*> swapChainList;
 		uint32_t				currentSwap = 0;
-		uint32_t				swapCycle = 0;
 		vk::Framebuffer* frameBuffers = nullptr;
 
-		std::vector<vk::Semaphore>	swapSemaphores;
-		std::vector<vk::Fence>		swapFences;
+		//Command pools aren't thread safe, so each recording thread gets its own
+		struct ThreadCommands {
+			vk::CommandPool					pool;
+			std::vector<vk::CommandBuffer>	secondaries;
+			uint32_t						usedSecondaries = 0;
+		};
+
+		//Everything the CPU needs to record a frame while others are still on the GPU
+		struct FrameInFlight {
+			vk::CommandBuffer	cmdBuffer;
+			vk::Fence			completeFence;
+			vk::Semaphore		acquireSemaphore;
+			std::vector<ThreadCommands> threadCommands;
+			std::unique_ptr<DescriptorAllocator> descriptorAllocator;
+		};
+		std::vector<FrameInFlight>	framesInFlight;
+		uint32_t					currentFrame = 0;
+		uint32_t					recordingThreadCount = 1;
+
+		std::vector<vk::Semaphore>	renderFinishedSemaphores;	//One per swap image
+		std::vector<vk::Fence>		swapImageFences;			//Fence of the frame last using each swap image
 
 		vk::SwapchainKHR	swapChain;
 		VmaAllocator		memoryAllocator;
+
+		std::vector<UniqueVulkanTexture> headlessImages;
+
+		std::unique_ptr<StagingRingBuffer> stagingBuffer;
+
+		std::unique_ptr<UploadScheduler>	uploadScheduler;
+		std::unique_ptr<DescriptorSetLayoutCache>	layoutCache;
+		std::unique_ptr<DescriptorAllocator>		descriptorAllocator;
+		std::unique_ptr<DescriptorBufferRing>		descriptorBufferRing;
+		uint64_t							frameUploadWait = 0; //Upload timeline value this frame's commands must wait for
 	};
 }
\ No newline at end of file
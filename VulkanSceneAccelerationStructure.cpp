@@ -0,0 +1,350 @@
+/******************************************************************************
+This file is part of the Newcastle Vulkan Tutorial Series
+
+Author:Rich Davison
+Contact:richgdavison@gmail.com
+License: MIT (see LICENSE file at the top of the source tree)
+*//////////////////////////////////////////////////////////////////////////////
+#include "VulkanSceneAccelerationStructure.h"
+#include "VulkanBufferBuilder.h"
+#include "VulkanUtils.h"
+#include <algorithm>
+#include <future>
+#include <thread>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define USE_SSE_INSTANCE_PACKING
+#endif
+
+using namespace NCL;
+using namespace Rendering;
+using namespace Vulkan;
+
+//One bit per instance buffer in the dirty masks
+const uint32_t MAX_INSTANCE_BUFFERS = 8;
+
+//Below this, it's not worth waking up any extra threads
+const size_t MIN_INSTANCES_PER_THREAD = 16384;
+
+void Vulkan::PackInstanceTransform(const Matrix4& m, vk::TransformMatrixKHR& out) {
+#ifdef USE_SSE_INSTANCE_PACKING
+	//Load the columns, transpose them into rows, and keep the top 3
+	__m128 r0 = _mm_loadu_ps(&m.array[0][0]);
+	__m128 r1 = _mm_loadu_ps(&m.array[1][0]);
+	__m128 r2 = _mm_loadu_ps(&m.array[2][0]);
+	__m128 r3 = _mm_loadu_ps(&m.array[3][0]);
+	_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+	_mm_storeu_ps(&out.matrix[0][0], r0);
+	_mm_storeu_ps(&out.matrix[1][0], r1);
+	_mm_storeu_ps(&out.matrix[2][0], r2);
+#else
+	for (int row = 0; row < 3; ++row) {
+		for (int col = 0; col < 4; ++col) {
+			out.matrix[row][col] = m.array[col][row];
+		}
+	}
+#endif
+}
+
+void Vulkan::ParallelPackInstances(size_t count, const std::function<void(size_t first, size_t last)>& packFunc) {
+	size_t threadCount = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), count / MIN_INSTANCES_PER_THREAD + 1);
+	if (threadCount <= 1) {
+		packFunc(0, count);
+		return;
+	}
+	//Contiguous chunks, so each thread writes whole cache lines of its own
+	size_t perThread = (count + threadCount - 1) / threadCount;
+	std::vector<std::future<void>> tasks;
+	for (size_t t = 1; t < threadCount; ++t) {
+		size_t first	= t * perThread;
+		size_t last		= std::min(count, first + perThread);
+		if (first < last) {
+			tasks.push_back(std::async(std::launch::async, [&packFunc, first, last]() {
+				packFunc(first, last);
+			}));
+		}
+	}
+	packFunc(0, std::min(perThread, count));
+	for (auto& t : tasks) {
+		t.wait();
+	}
+}
+
+static vk::AccelerationStructureGeometryKHR InstanceGeometry(vk::DeviceAddress instanceData) {
+	vk::AccelerationStructureGeometryKHR geometry;
+	geometry.geometryType = vk::GeometryTypeKHR::eInstances;
+	geometry.geometry = vk::AccelerationStructureGeometryInstancesDataKHR();
+	geometry.geometry.instances.data = instanceData;
+	return geometry;
+}
+
+SceneAccelerationStructure::SceneAccelerationStructure(vk::Device device, VmaAllocator allocator, uint32_t inMaxInstances, uint32_t framesInFlight,
+	vk::BuildAccelerationStructureFlagsKHR flags, const std::string& debugName) {
+	sourceDevice	= device;
+	sourceAllocator = allocator;
+	maxInstances	= std::max(inMaxInstances, 1u);
+	buildFlags		= flags | vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate;
+
+	activeCount			= 0;
+	builtCount			= 0;
+	currentBuffer		= 0;
+	updateCount			= 0;
+	hasChanges			= false;
+	needsRebuild		= true;
+	hasBeenBuilt		= false;
+	lastWasRebuild		= false;
+	refitsSinceRebuild	= 0;
+	movedSinceRebuild	= 0;
+	maxRefits			= 64;
+	maxMovedFraction	= 0.5f;
+
+	MessageAssert(framesInFlight <= MAX_INSTANCE_BUFFERS, "SceneAccelerationStructure supports at most 8 frames in flight!");
+	framesInFlight = std::clamp(framesInFlight, 1u, MAX_INSTANCE_BUFFERS);
+
+	size_t instanceDataSize = maxInstances * sizeof(vk::AccelerationStructureInstanceKHR);
+	for (uint32_t i = 0; i < framesInFlight; ++i) {
+		instanceBuffers.push_back(BufferBuilder(device, allocator)
+			.WithBufferUsage(vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR)
+			.WithDeviceAddress()
+			.WithHostVisibility()
+			.WithPersistentMapping()
+			.Build(instanceDataSize, debugName + " Instances " + std::to_string(i)));
+	}
+	dirtyInstances.resize(framesInFlight);
+
+	//Everything is sized for the maximum instance count, so is never reallocated
+	vk::AccelerationStructureGeometryKHR geometry = InstanceGeometry(0);
+	vk::AccelerationStructureBuildGeometryInfoKHR geomInfo = {
+		.type			= vk::AccelerationStructureTypeKHR::eTopLevel,
+		.flags			= buildFlags,
+		.mode			= vk::BuildAccelerationStructureModeKHR::eBuild,
+		.geometryCount	= 1,
+		.pGeometries	= &geometry
+	};
+	vk::AccelerationStructureBuildSizesInfoKHR sizesInfo;
+	device.getAccelerationStructureBuildSizesKHR(vk::AccelerationStructureBuildTypeKHR::eDevice, &geomInfo, &maxInstances, &sizesInfo);
+
+	tlasBuffer = BufferBuilder(device, allocator)
+		.WithDeviceAddress()
+		.WithBufferUsage(vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR)
+		.Build(sizesInfo.accelerationStructureSize, debugName + " Buffer");
+
+	scratchBuffer = BufferBuilder(device, allocator)
+		.WithDeviceAddress()
+		.WithBufferUsage(vk::BufferUsageFlagBits::eStorageBuffer)
+		.Build(std::max(sizesInfo.buildScratchSize, sizesInfo.updateScratchSize), debugName + " Scratch");
+
+	tlas = device.createAccelerationStructureKHRUnique(
+		{
+			.buffer = tlasBuffer.buffer,
+			.size	= sizesInfo.accelerationStructureSize,
+			.type	= vk::AccelerationStructureTypeKHR::eTopLevel
+		}
+	);
+	tlasAddress = device.getAccelerationStructureAddressKHR({ .accelerationStructure = *tlas });
+
+	if (!debugName.empty()) {
+		SetDebugName(device, vk::ObjectType::eAccelerationStructureKHR, GetVulkanHandle(*tlas), debugName);
+	}
+}
+
+uint32_t SceneAccelerationStructure::AddInstance(vk::DeviceAddress blasAddress, const Matrix4& transform, uint32_t customIndex, uint32_t mask,
+	uint32_t hitID, vk::GeometryInstanceFlagsKHR instanceFlags) {
+	uint32_t instanceID = INVALID_INSTANCE;
+	if (!freeInstances.empty()) {
+		instanceID = freeInstances.back();
+		freeInstances.pop_back();
+	}
+	else if (instances.size() < maxInstances) {
+		instanceID = (uint32_t)instances.size();
+		instances.emplace_back();
+		dirtyMasks.push_back(0);
+		movedAtUpdate.push_back(0);
+	}
+	else {
+		std::cout << __FUNCTION__ << " scene acceleration structure is full!\n";
+		return INVALID_INSTANCE;
+	}
+	vk::AccelerationStructureInstanceKHR& instance = instances[instanceID];
+	PackInstanceTransform(transform, instance.transform);
+	instance.instanceCustomIndex					= customIndex;
+	instance.mask									= mask;
+	instance.instanceShaderBindingTableRecordOffset = hitID;
+	instance.flags									= (VkGeometryInstanceFlagsKHR)instanceFlags;
+	instance.accelerationStructureReference			= blasAddress;
+
+	activeCount++;
+	needsRebuild = true;	//Refits can't make an instance active
+	MarkDirty(instanceID);
+	return instanceID;
+}
+
+void SceneAccelerationStructure::RemoveInstance(uint32_t instanceID) {
+	if (instanceID >= instances.size() || instances[instanceID].accelerationStructureReference == 0) {
+		return;
+	}
+	//A null reference makes the instance inactive, so the slot can stay in the instance buffer
+	instances[instanceID].accelerationStructureReference = 0;
+	freeInstances.push_back(instanceID);
+
+	activeCount--;
+	needsRebuild = true;
+	MarkDirty(instanceID);
+}
+
+void SceneAccelerationStructure::SetTransform(uint32_t instanceID, const Matrix4& transform) {
+	assert(instanceID < instances.size());
+	PackInstanceTransform(transform, instances[instanceID].transform);
+	if (movedAtUpdate[instanceID] != updateCount + 1) {
+		movedAtUpdate[instanceID] = updateCount + 1;
+		movedSinceRebuild++;
+	}
+	MarkDirty(instanceID);
+}
+
+void SceneAccelerationStructure::SetTransforms(const uint32_t* instanceIDs, const Matrix4* transforms, uint32_t count) {
+	ParallelPackInstances(count, [&](size_t first, size_t last) {
+		for (size_t i = first; i < last; ++i) {
+			assert(instanceIDs[i] < instances.size());
+			PackInstanceTransform(transforms[i], instances[instanceIDs[i]].transform);
+		}
+	});
+	for (uint32_t i = 0; i < count; ++i) {
+		uint32_t instanceID = instanceIDs[i];
+		if (movedAtUpdate[instanceID] != updateCount + 1) {
+			movedAtUpdate[instanceID] = updateCount + 1;
+			movedSinceRebuild++;
+		}
+		MarkDirty(instanceID);
+	}
+}
+
+void SceneAccelerationStructure::SetMask(uint32_t instanceID, uint32_t mask) {
+	assert(instanceID < instances.size());
+	instances[instanceID].mask = mask;
+	MarkDirty(instanceID);
+}
+
+void SceneAccelerationStructure::SetHitGroup(uint32_t instanceID, uint32_t hitID) {
+	assert(instanceID < instances.size());
+	instances[instanceID].instanceShaderBindingTableRecordOffset = hitID;
+	MarkDirty(instanceID);
+}
+
+void SceneAccelerationStructure::SetBLAS(uint32_t instanceID, vk::DeviceAddress blasAddress) {
+	assert(instanceID < instances.size());
+	//Inactive slots stay inactive, as they're on the free list
+	if (instances[instanceID].accelerationStructureReference == 0 || blasAddress == 0) {
+		return;
+	}
+	instances[instanceID].accelerationStructureReference = blasAddress;
+	needsRebuild = true;
+	MarkDirty(instanceID);
+}
+
+void SceneAccelerationStructure::RemapBLAS(const BLASAddressRemap& remap) {
+	for (uint32_t i = 0; i < instances.size(); ++i) {
+		auto moved = remap.find(instances[i].accelerationStructureReference);
+		if (moved != remap.end()) {
+			SetBLAS(i, moved->second);
+		}
+	}
+}
+
+void SceneAccelerationStructure::SetRebuildHeuristic(uint32_t inMaxRefits, float inMaxMovedFraction) {
+	maxRefits			= inMaxRefits;
+	maxMovedFraction	= inMaxMovedFraction;
+}
+
+void SceneAccelerationStructure::MarkDirty(uint32_t instanceID) {
+	uint8_t allBuffers = (uint8_t)((1u << instanceBuffers.size()) - 1);
+	uint8_t newBuffers = allBuffers & ~dirtyMasks[instanceID];
+	for (uint32_t i = 0; i < instanceBuffers.size(); ++i) {
+		if (newBuffers & (1 << i)) {
+			dirtyInstances[i].push_back(instanceID);
+		}
+	}
+	dirtyMasks[instanceID] = allBuffers;
+	hasChanges = true;
+}
+
+bool SceneAccelerationStructure::ShouldRebuild() const {
+	if (needsRebuild || !hasBeenBuilt || instances.size() != builtCount) {
+		return true;
+	}
+	if (refitsSinceRebuild >= maxRefits) {
+		return true;
+	}
+	return movedSinceRebuild > maxMovedFraction * std::max(activeCount, 1u);
+}
+
+bool SceneAccelerationStructure::Update(vk::CommandBuffer cmdBuffer) {
+	//A forced rebuild still happens even if no instances have changed
+	if ((!hasChanges && !needsRebuild) || instances.empty()) {
+		return false;
+	}
+	currentBuffer = (currentBuffer + 1) % instanceBuffers.size();
+
+	//Bring this frame's instance buffer up to date with everything that changed since it was last used
+	vk::AccelerationStructureInstanceKHR* instanceData = (vk::AccelerationStructureInstanceKHR*)instanceBuffers[currentBuffer].Data();
+	uint8_t bufferBit = (uint8_t)(1 << currentBuffer);
+	for (uint32_t id : dirtyInstances[currentBuffer]) {
+		instanceData[id] = instances[id];
+		dirtyMasks[id] &= ~bufferBit;
+	}
+	dirtyInstances[currentBuffer].clear();
+
+	bool rebuild = ShouldRebuild();
+
+	vk::AccelerationStructureGeometryKHR geometry = InstanceGeometry(instanceBuffers[currentBuffer].deviceAddress);
+	vk::AccelerationStructureBuildGeometryInfoKHR geomInfo = {
+		.type						= vk::AccelerationStructureTypeKHR::eTopLevel,
+		.flags						= buildFlags,
+		.mode						= rebuild ? vk::BuildAccelerationStructureModeKHR::eBuild : vk::BuildAccelerationStructureModeKHR::eUpdate,
+		.srcAccelerationStructure	= rebuild ? vk::AccelerationStructureKHR() : *tlas,
+		.dstAccelerationStructure	= *tlas,
+		.geometryCount				= 1,
+		.pGeometries				= &geometry
+	};
+	geomInfo.scratchData.deviceAddress = scratchBuffer.deviceAddress;
+
+	vk::AccelerationStructureBuildRangeInfoKHR rangeInfo = {
+		.primitiveCount = (uint32_t)instances.size()
+	};
+	const vk::AccelerationStructureBuildRangeInfoKHR* rangeInfoPtr = &rangeInfo;
+
+	//Earlier traces must be done with the TLAS, and earlier builds with the scratch memory
+	vk::MemoryBarrier2 beforeBuild = {
+		.srcStageMask	= vk::PipelineStageFlagBits2::eAllCommands,
+		.srcAccessMask	= vk::AccessFlagBits2::eAccelerationStructureReadKHR | vk::AccessFlagBits2::eAccelerationStructureWriteKHR,
+		.dstStageMask	= vk::PipelineStageFlagBits2::eAccelerationStructureBuildKHR,
+		.dstAccessMask	= vk::AccessFlagBits2::eAccelerationStructureReadKHR | vk::AccessFlagBits2::eAccelerationStructureWriteKHR
+	};
+	cmdBuffer.pipelineBarrier2({ .memoryBarrierCount = 1, .pMemoryBarriers = &beforeBuild });
+
+	cmdBuffer.buildAccelerationStructuresKHR(1, &geomInfo, &rangeInfoPtr);
+
+	vk::MemoryBarrier2 afterBuild = {
+		.srcStageMask	= vk::PipelineStageFlagBits2::eAccelerationStructureBuildKHR,
+		.srcAccessMask	= vk::AccessFlagBits2::eAccelerationStructureWriteKHR,
+		.dstStageMask	= vk::PipelineStageFlagBits2::eAllCommands,
+		.dstAccessMask	= vk::AccessFlagBits2::eAccelerationStructureReadKHR
+	};
+	cmdBuffer.pipelineBarrier2({ .memoryBarrierCount = 1, .pMemoryBarriers = &afterBuild });
+
+	if (rebuild) {
+		builtCount			= (uint32_t)instances.size();
+		refitsSinceRebuild	= 0;
+		movedSinceRebuild	= 0;
+		needsRebuild		= false;
+		hasBeenBuilt		= true;
+	}
+	else {
+		refitsSinceRebuild++;
+	}
+	lastWasRebuild	= rebuild;
+	hasChanges		= false;
+	updateCount++;
+	return true;
+}
@@ -0,0 +1,125 @@
+/******************************************************************************
+This file is part of the Newcastle Vulkan Tutorial Series
+
+Author:Rich Davison
+Contact:richgdavison@gmail.com
+License: MIT (see LICENSE file at the top of the source tree)
+*//////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "VulkanBuffers.h"
+#include <unordered_map>
+
+namespace NCL::Rendering::Vulkan {
+	//Old BLAS address to new, for when BLASes have been moved
+	using BLASAddressRemap = std::unordered_map<vk::DeviceAddress, vk::DeviceAddress>;
+
+	//VkTransformMatrixKHR is 3 rows of 4, row major, while our matrices are column major. Uses SSE where available
+	void PackInstanceTransform(const Matrix4& transform, vk::TransformMatrixKHR& out);
+	//Calls packFunc over contiguous ranges of [0, count), spread across threads if there are enough instances to be worth it
+	void ParallelPackInstances(size_t count, const std::function<void(size_t first, size_t last)>& packFunc);
+
+	/*
+	SceneAccelerationStructure: A TLAS that lives for as long as the scene
+	does. The instance buffers, scratch memory and the TLAS itself are sized
+	for a maximum instance count up front, and are then reused every frame.
+
+	Moving an instance only marks it as dirty. Update then copies just the
+	dirty instances into this frame's instance buffer, and records either a
+	refit (eUpdate, in place) or a full rebuild. A rebuild happens when
+	instances have been added or removed, as refits can't change which
+	instances are active, or when the heuristic says the tree has been
+	refit too often, or had too many of its instances moved, to still trace
+	well. Instance IDs are stable; removed slots are made inactive, and
+	reused by later adds.
+
+	There is an instance buffer per frame in flight, so the CPU never writes
+	to one the GPU could still be reading. Update records barriers on both
+	sides of the build, so the TLAS can be traced straight after it.
+	*/
+	class SceneAccelerationStructure	{
+	public:
+		static const uint32_t INVALID_INSTANCE = ~0u;
+
+		SceneAccelerationStructure(vk::Device device, VmaAllocator allocator, uint32_t maxInstances, uint32_t framesInFlight,
+			vk::BuildAccelerationStructureFlagsKHR flags = vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace,
+			const std::string& debugName = "Scene TLAS");
+		~SceneAccelerationStructure() {}
+
+		uint32_t	AddInstance(vk::DeviceAddress blasAddress, const Matrix4& transform, uint32_t customIndex = 0, uint32_t mask = 0xFF,
+			uint32_t hitID = 0, vk::GeometryInstanceFlagsKHR instanceFlags = vk::GeometryInstanceFlagBitsKHR::eTriangleFacingCullDisable);
+		void		RemoveInstance(uint32_t instanceID);
+
+		//These can all be refit, rather than needing a rebuild
+		void		SetTransform(uint32_t instanceID, const Matrix4& transform);
+		//Packs the transforms in parallel. Each instance ID must only appear once
+		void		SetTransforms(const uint32_t* instanceIDs, const Matrix4* transforms, uint32_t count);
+		void		SetMask(uint32_t instanceID, uint32_t mask);
+		void		SetHitGroup(uint32_t instanceID, uint32_t hitID);
+
+		//Changing which BLAS an instance uses needs a rebuild
+		void		SetBLAS(uint32_t instanceID, vk::DeviceAddress blasAddress);
+		//Points every instance using a moved BLAS at its new address
+		void		RemapBLAS(const BLASAddressRemap& remap);
+
+		//Rebuild after this many refits in a row, or once this fraction of instances have moved since the last rebuild
+		void		SetRebuildHeuristic(uint32_t maxRefits, float maxMovedFraction);
+		void		ForceRebuild() {
+			needsRebuild = true;
+		}
+
+		//Returns true if anything was recorded
+		bool		Update(vk::CommandBuffer cmdBuffer);
+
+		vk::AccelerationStructureKHR GetTLAS() const {
+			return *tlas;
+		}
+		vk::DeviceAddress GetTLASAddress() const {
+			return tlasAddress;
+		}
+		uint32_t	GetInstanceCount() const {
+			return (uint32_t)instances.size();
+		}
+		uint32_t	GetActiveInstanceCount() const {
+			return activeCount;
+		}
+		bool		LastUpdateWasRebuild() const {
+			return lastWasRebuild;
+		}
+
+	protected:
+		void		MarkDirty(uint32_t instanceID);
+		bool		ShouldRebuild() const;
+
+		vk::Device		sourceDevice;
+		VmaAllocator	sourceAllocator;
+		vk::BuildAccelerationStructureFlagsKHR buildFlags;
+
+		std::vector<vk::AccelerationStructureInstanceKHR>	instances;
+		std::vector<uint32_t>			freeInstances;
+		std::vector<uint8_t>			dirtyMasks;		//A bit per instance buffer still needing the instance copied in
+		std::vector<uint32_t>			movedAtUpdate;	//So an instance moved many times between updates only counts once
+
+		std::vector<VulkanBuffer>				instanceBuffers;
+		std::vector<std::vector<uint32_t>>		dirtyInstances;	//Per instance buffer
+		uint32_t								currentBuffer;
+
+		VulkanBuffer						tlasBuffer;
+		VulkanBuffer						scratchBuffer;
+		vk::UniqueAccelerationStructureKHR	tlas;
+		vk::DeviceAddress					tlasAddress;
+
+		uint32_t	maxInstances;
+		uint32_t	activeCount;
+		uint32_t	builtCount;		//Instance count of the last build, which refits must match
+
+		uint32_t	updateCount;
+		bool		hasChanges;
+		bool		needsRebuild;
+		bool		hasBeenBuilt;
+		bool		lastWasRebuild;
+		uint32_t	refitsSinceRebuild;
+		uint32_t	movedSinceRebuild;
+		uint32_t	maxRefits;
+		float		maxMovedFraction;
+	};
+}
@@ -62,14 +62,25 @@ void VulkanShader::AddBinaryShaderModule(ShaderStages::Type stage, vk::UniqueSha
 	entryPoints[stage]		= entryPoint;
 }
 
+void VulkanShader::AddTaskShaderModule(vk::UniqueShaderModule& shaderModule, const std::string& entryPoint) {
+	shaderModule.swap(taskModule);
+	taskEntryPoint = entryPoint;
+}
+
 void VulkanShader::Init() {
-	stageCount = 0;
+	stageCount = taskModule ? 1 : 0;
 	for (int i = 0; i < ShaderStages::MAX_SIZE; ++i) {
 		if (shaderModules[i]) {
 			stageCount++;
 		}
 	}
 	uint32_t doneCount = 0;
+	if (taskModule) {
+		infos[doneCount].stage	= vk::ShaderStageFlagBits::eTaskEXT;
+		infos[doneCount].module = *taskModule;
+		infos[doneCount].pName	= taskEntryPoint.c_str();
+		doneCount++;
+	}
 	for (int i = 0; i < ShaderStages::MAX_SIZE; ++i) {
 		if (shaderModules[i]) {
 			infos[doneCount].stage	= rasterStages[i];
@@ -18,7 +18,7 @@ namespace NCL::Rendering::Vulkan {
 		vk::ShaderStageFlagBits::eGeometry,
 		vk::ShaderStageFlagBits::eTessellationControl,
 		vk::ShaderStageFlagBits::eTessellationEvaluation,
-		vk::ShaderStageFlagBits::eMeshNV
+		vk::ShaderStageFlagBits::eMeshEXT
 	};
 
 	/*
@@ -39,6 +39,8 @@ namespace NCL::Rendering::Vulkan {
 	protected:
 		void AddBinaryShaderModule(ShaderStages::Type stage, vk::UniqueShaderModule& shaderModule, const std::string& entryPoint = "main");
 		void AddBinaryShaderModule(const std::string& fromFile, ShaderStages::Type stage, vk::Device device, const std::string& entryPoint = "main");
+		//There's no ShaderStages entry for task shaders, so they're stored separately
+		void AddTaskShaderModule(vk::UniqueShaderModule& shaderModule, const std::string& entryPoint = "main");
 
 		void Init();
 
@@ -47,7 +49,10 @@ namespace NCL::Rendering::Vulkan {
 		vk::UniqueShaderModule shaderModules[ShaderStages::MAX_SIZE];
 		std::string entryPoints[ShaderStages::MAX_SIZE];
 
+		vk::UniqueShaderModule	taskModule;
+		std::string				taskEntryPoint;
+
 		uint32_t stageCount;
-		vk::PipelineShaderStageCreateInfo infos[ShaderStages::MAX_SIZE];
+		vk::PipelineShaderStageCreateInfo infos[ShaderStages::MAX_SIZE + 1];
 	};
 }
\ No newline at end of file
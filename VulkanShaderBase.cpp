@@ -6,6 +6,8 @@ Contact:richgdavison@gmail.com
 License: MIT (see LICENSE file at the top of the source tree)
 *//////////////////////////////////////////////////////////////////////////////
 #include "VulkanShaderBase.h"
+#include "VulkanDescriptorSetLayoutCache.h"
+#include "VulkanUtils.h"
 extern "C" {
 #include "Spirv-reflect/Spirv_reflect.h"
 }
@@ -16,7 +18,7 @@ using namespace Vulkan;
 void	VulkanShaderBase::FillDescriptorSetLayouts(std::vector<vk::DescriptorSetLayout>& layouts) const {
 	layouts.resize(std::max(allLayouts.size(), layouts.size()));
 	for (int i = 0; i < allLayouts.size(); ++i) {
-		layouts[i] = *allLayouts[i];
+		layouts[i] = allLayouts[i];
 	}
 }
 
@@ -28,7 +30,7 @@ void	VulkanShaderBase::FillPushConstants(std::vector<vk::PushConstantRange>& con
 vk::DescriptorSetLayout VulkanShaderBase::GetLayout(uint32_t index) const {
 	assert(index < allLayouts.size());
 	assert(!allLayouts.empty());
-	return *allLayouts[index];
+	return allLayouts[index];
 }
 
 std::vector<vk::DescriptorSetLayoutBinding> VulkanShaderBase::GetLayoutBinding(uint32_t index) const {
@@ -40,7 +42,11 @@ std::vector<vk::DescriptorSetLayoutBinding> VulkanShaderBase::GetLayoutBinding(u
 
 void VulkanShaderBase::AddDescriptorSetLayoutState(std::vector<std::vector<vk::DescriptorSetLayoutBinding>>& data, std::vector<vk::UniqueDescriptorSetLayout>& layouts) {
 	allLayoutsBindings = std::move(data);
-	allLayouts = std::move(layouts);
+	allLayouts.clear();
+	for (const auto& l : layouts) {
+		allLayouts.push_back(*l);
+	}
+	ownedLayouts = std::move(layouts);
 }
 
 void VulkanShaderBase::AddPushConstantState(std::vector<vk::PushConstantRange>& data) {
@@ -124,9 +130,16 @@ void VulkanShaderBase::AddReflectionData(uint32_t dataSize, const void* data, vk
 }
 
 void VulkanShaderBase::BuildLayouts(vk::Device device) {
+	//Shared with every other shader and builder with the same bindings, if the device has a cache
+	DescriptorSetLayoutCache* cache = GetDescriptorSetLayoutCache(device);
 	for (const auto& i : allLayoutsBindings) {
+		if (cache) {
+			allLayouts.push_back(cache->GetLayout(i));
+			continue;
+		}
 		vk::DescriptorSetLayoutCreateInfo createInfo;
 		createInfo.setBindings(i);
-		allLayouts.push_back(device.createDescriptorSetLayoutUnique(createInfo));
+		ownedLayouts.push_back(device.createDescriptorSetLayoutUnique(createInfo));
+		allLayouts.push_back(*ownedLayouts.back());
 	}
 }
\ No newline at end of file
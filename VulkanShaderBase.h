@@ -39,7 +39,8 @@ namespace NCL::Rendering::Vulkan {
 		}
 
 		std::vector<std::vector<vk::DescriptorSetLayoutBinding>> allLayoutsBindings;
-		std::vector<vk::UniqueDescriptorSetLayout> allLayouts;
+		std::vector<vk::DescriptorSetLayout>		allLayouts;
+		std::vector<vk::UniqueDescriptorSetLayout>	ownedLayouts; //Only used if the device has no layout cache
 
 		std::vector<vk::PushConstantRange> pushConstants;
 	};
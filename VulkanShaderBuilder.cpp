@@ -41,6 +41,13 @@ ShaderBuilder& ShaderBuilder::WithMeshBinary(const string& name, const std::stri
 	return AddBinary(ShaderStages::Mesh, name, entry);
 }
 
+ShaderBuilder& ShaderBuilder::WithTaskBinary(const string& name, const std::string& entry) {
+	assert(MessageAssert(taskFile.empty(), "Multiple task shaders attached to shader object!"));
+	taskFile		= name;
+	taskEntryPoint	= entry;
+	return *this;
+}
+
 ShaderBuilder& ShaderBuilder::WithVertexBinary(const string& name, const std::string& entry) {
 	return AddBinary(ShaderStages::Vertex, name, entry);
 }
@@ -61,41 +68,51 @@ ShaderBuilder& ShaderBuilder::WithTessEvalBinary(const string& name, const std::
 	return AddBinary(ShaderStages::TessEval, name, entry);
 }
 
+vk::UniqueShaderModule ShaderBuilder::LoadModule(const std::string& file, vk::ShaderStageFlagBits stage, VulkanShader* shader, const std::string& debugName) {
+	char* data;
+	size_t dataSize = 0;
+	Assets::ReadBinaryFile(Assets::SHADERDIR + "VK/" + file, &data, dataSize);
+
+	vk::UniqueShaderModule module;
+
+	if (dataSize > 0) {
+		module = sourceDevice.createShaderModuleUnique(
+			{
+				.flags = {},
+				.codeSize = dataSize,
+				.pCode = (uint32_t*)data
+			}
+			//vk::ShaderModuleCreateInfo(vk::ShaderModuleCreateFlags(), dataSize, (uint32_t*)data)		
+		);
+		shader->AddReflectionData(dataSize, data, stage);
+	}
+	else {
+		std::cout << __FUNCTION__ << " Problem loading shader file " << file << "!\n";
+	}
+
+	if (module && !debugName.empty()) {
+		SetDebugName(sourceDevice, vk::ObjectType::eShaderModule, GetVulkanHandle(*module), debugName);
+	}
+	return module;
+}
+
 UniqueVulkanShader ShaderBuilder::Build(const std::string& debugName) {
 	VulkanShader* newShader = new VulkanShader();
 	//mesh and 'traditional' pipeline are mutually exclusive
 	assert(MessageAssert(!(!shaderFiles[ShaderStages::Mesh].empty() && !shaderFiles[ShaderStages::Vertex].empty()),
 		"Cannot use traditional vertex pipeline with mesh shaders!"));
+	assert(MessageAssert(taskFile.empty() || !shaderFiles[ShaderStages::Mesh].empty(),
+		"Task shaders need a mesh shader to launch!"));
+
+	if (!taskFile.empty()) {
+		vk::UniqueShaderModule module = LoadModule(taskFile, vk::ShaderStageFlagBits::eTaskEXT, newShader, debugName);
+		newShader->AddTaskShaderModule(module, taskEntryPoint);
+	}
 
 	for (int i = 0; i < ShaderStages::MAX_SIZE; ++i) {
 		if (!shaderFiles[i].empty()) {
-
-			char* data;
-			size_t dataSize = 0;
-			Assets::ReadBinaryFile(Assets::SHADERDIR + "VK/" + shaderFiles[i], &data, dataSize);
-
-			vk::UniqueShaderModule module;
-
-			if (dataSize > 0) {
-				module = sourceDevice.createShaderModuleUnique(
-					{
-						.flags = {},
-						.codeSize = dataSize,
-						.pCode = (uint32_t*)data
-					}
-					//vk::ShaderModuleCreateInfo(vk::ShaderModuleCreateFlags(), dataSize, (uint32_t*)data)		
-				);
-				newShader->AddReflectionData(dataSize, data, rasterStages[i]);
-			}
-			else {
-				std::cout << __FUNCTION__ << " Problem loading shader file " << shaderFiles[i] << "!\n";
-			}
-
+			vk::UniqueShaderModule module = LoadModule(shaderFiles[i], rasterStages[i], newShader, debugName);
 			newShader->AddBinaryShaderModule(static_cast<ShaderStages::Type>(i), module, entryPoints[i]);
-
-			if (!debugName.empty()) {
-				SetDebugName(sourceDevice, vk::ObjectType::eShaderModule, GetVulkanHandle(*newShader->shaderModules[i]), debugName);
-			}
 		}
 	};
 
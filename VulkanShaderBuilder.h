@@ -21,6 +21,8 @@ namespace NCL::Rendering::Vulkan {
 		~ShaderBuilder()	{};
 
 		ShaderBuilder& WithMeshBinary(const std::string& name, const std::string& entry = "main");
+		//Optional stage before the mesh shader, deciding how many mesh workgroups to launch
+		ShaderBuilder& WithTaskBinary(const std::string& name, const std::string& entry = "main");
 
 		ShaderBuilder& WithVertexBinary(const std::string& name, const std::string& entry = "main");
 		ShaderBuilder& WithFragmentBinary(const std::string& name, const std::string& entry = "main");
@@ -32,8 +34,12 @@ namespace NCL::Rendering::Vulkan {
 
 		UniqueVulkanShader Build(const std::string& debugName = "");
 	protected:
+		vk::UniqueShaderModule LoadModule(const std::string& file, vk::ShaderStageFlagBits stage, VulkanShader* shader, const std::string& debugName);
+
 		std::string shaderFiles[ShaderStages::MAX_SIZE];
 		std::string entryPoints[ShaderStages::MAX_SIZE];
+		std::string taskFile;
+		std::string taskEntryPoint;
 		vk::Device	sourceDevice;
 	};
 }
\ No newline at end of file
@@ -0,0 +1,174 @@
+/******************************************************************************
+This file is part of the Newcastle Vulkan Tutorial Series
+
+Author:Rich Davison
+Contact:richgdavison@gmail.com
+License: MIT (see LICENSE file at the top of the source tree)
+*//////////////////////////////////////////////////////////////////////////////
+#include "VulkanStagingRingBuffer.h"
+#include "VulkanBufferBuilder.h"
+#include "VulkanUtils.h"
+#include <algorithm>
+
+using namespace NCL;
+using namespace Rendering;
+using namespace Vulkan;
+
+StagingRingBuffer::StagingRingBuffer(vk::Device device, VmaAllocator allocator, size_t byteSize) {
+	sourceDevice	= device;
+	capacity		= byteSize;
+	head			= 0;
+	usedBytes		= 0;
+	lastOwner		= 0;
+
+	buffer = BufferBuilder(device, allocator)
+		.WithBufferUsage(vk::BufferUsageFlagBits::eTransferSrc)
+		.WithHostVisibility()
+		.WithPersistentMapping()
+		.Build(byteSize, "Staging Ring Buffer");
+
+	mappedData = (char*)buffer.Data();
+}
+
+StagingRingBuffer::~StagingRingBuffer() {
+	WaitForIdle();
+	//Anything left over was never submitted, or is stuck behind something that wasn't
+	for (const FencedRegion& region : inFlightRegions) {
+		if (region.fence && std::find(freeFences.begin(), freeFences.end(), region.fence) == freeFences.end()) {
+			freeFences.push_back(region.fence);
+		}
+	}
+	for (vk::Fence f : freeFences) {
+		sourceDevice.destroyFence(f);
+	}
+}
+
+StagingAllocation StagingRingBuffer::Allocate(size_t byteCount, size_t alignment, StagingOwner owner) {
+	if (byteCount == 0 || byteCount > capacity) {
+		stats.failedCount++;
+		return {};
+	}
+	size_t start		= ((head + alignment - 1) / alignment) * alignment;
+	bool   wrapping		= start + byteCount > capacity;
+	if (wrapping) {
+		start = 0; //The unused tail end of the ring is given up until it comes back around
+	}
+	size_t bytesNeeded = wrapping ? (capacity - head) + byteCount : (start - head) + byteCount;
+
+	bool stalled = false;
+	while (usedBytes + bytesNeeded > capacity) {
+		if (inFlightRegions.empty() || !inFlightRegions.front().fence) {
+			//Whatever is left belongs to allocations that haven't been submitted yet
+			stats.failedCount++;
+			return {};
+		}
+		if (sourceDevice.waitForFences(1, &inFlightRegions.front().fence, true, UINT64_MAX) != vk::Result::eSuccess) {
+			std::cout << __FUNCTION__ << " failed waiting on staging fence!\n";
+			return {};
+		}
+		stalled = true;
+		Reclaim();
+	}
+	if (stalled) {
+		stats.stallCount++;
+	}
+	if (wrapping) {
+		stats.wrapCount++;
+	}
+	head		= start + byteCount;
+	usedBytes	+= bytesNeeded;
+
+	if (!inFlightRegions.empty() && !inFlightRegions.back().fence && inFlightRegions.back().owner == owner) {
+		inFlightRegions.back().byteCount += bytesNeeded;
+	}
+	else {
+		inFlightRegions.push_back({ nullptr, bytesNeeded, owner });
+	}
+
+	stats.allocationCount++;
+	stats.bytesStreamed	+= byteCount;
+	stats.peakBytesInUse = std::max(stats.peakBytesInUse, usedBytes);
+
+	return StagingAllocation{
+		.buffer = buffer.buffer,
+		.offset = start,
+		.size	= byteCount,
+		.data	= mappedData + start
+	};
+}
+
+StagingAllocation StagingRingBuffer::Allocate(const void* data, size_t byteCount, size_t alignment, StagingOwner owner) {
+	StagingAllocation allocation = Allocate(byteCount, alignment, owner);
+	if (allocation) {
+		memcpy(allocation.data, data, byteCount);
+	}
+	return allocation;
+}
+
+bool StagingRingBuffer::HasUnfencedAllocations(StagingOwner owner) const {
+	for (const FencedRegion& region : inFlightRegions) {
+		if (!region.fence && region.owner == owner) {
+			return true;
+		}
+	}
+	return false;
+}
+
+vk::Fence StagingRingBuffer::FenceAllocations(StagingOwner owner) {
+	vk::Fence fence;
+	if (freeFences.empty()) {
+		fence = sourceDevice.createFence({});
+	}
+	else {
+		fence = freeFences.back();
+		freeFences.pop_back();
+	}
+	//Other owners' regions may sit in between, they keep waiting for their own fence
+	bool fencedAny = false;
+	for (FencedRegion& region : inFlightRegions) {
+		if (!region.fence && region.owner == owner) {
+			region.fence = fence;
+			fencedAny = true;
+		}
+	}
+	if (!fencedAny) {
+		inFlightRegions.push_back({ fence, 0, owner }); //So the fence still gets recycled
+	}
+	return fence;
+}
+
+void StagingRingBuffer::Reclaim() {
+	while (!inFlightRegions.empty()) {
+		FencedRegion region = inFlightRegions.front();
+		if (!region.fence || sourceDevice.getFenceStatus(region.fence) != vk::Result::eSuccess) {
+			break;
+		}
+		usedBytes -= region.byteCount;
+		inFlightRegions.pop_front();
+
+		//A fence can cover several regions, so it's only recycled once the last of them is gone
+		bool fenceInUse = false;
+		for (const FencedRegion& other : inFlightRegions) {
+			fenceInUse |= other.fence == region.fence;
+		}
+		if (!fenceInUse) {
+			sourceDevice.resetFences(region.fence);
+			freeFences.push_back(region.fence);
+		}
+	}
+	if (usedBytes == 0) {
+		head = 0; //Nothing is in use, so we may as well start from the beginning again
+	}
+}
+
+void StagingRingBuffer::WaitForIdle() {
+	for (const FencedRegion& region : inFlightRegions) {
+		if (!region.fence) {
+			continue;
+		}
+		if (sourceDevice.waitForFences(1, &region.fence, true, UINT64_MAX) != vk::Result::eSuccess) {
+			std::cout << __FUNCTION__ << " failed waiting on staging fence!\n";
+		}
+	}
+	Reclaim();
+}
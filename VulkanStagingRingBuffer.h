@@ -0,0 +1,110 @@
+/******************************************************************************
+This file is part of the Newcastle Vulkan Tutorial Series
+
+Author:Rich Davison
+Contact:richgdavison@gmail.com
+License: MIT (see LICENSE file at the top of the source tree)
+*//////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "VulkanBuffers.h"
+#include <deque>
+
+namespace NCL::Rendering::Vulkan {
+	//A region of the staging ring. The memory is only valid until the
+	//fence it was submitted with has been signalled
+	struct StagingAllocation {
+		vk::Buffer		buffer;
+		vk::DeviceSize	offset	= 0;
+		vk::DeviceSize	size	= 0;
+		char*			data	= nullptr;
+
+		operator bool() const {
+			return data != nullptr;
+		}
+	};
+
+	//Identifies who is going to submit the commands that read an allocation.
+	//Owner 0 is shared by everything recorded into the renderer's frame commands
+	using StagingOwner = uint32_t;
+
+	struct StagingStats {
+		size_t bytesStreamed	= 0;
+		size_t allocationCount	= 0;
+		size_t stallCount		= 0; //Allocations that had to wait on the GPU for space
+		size_t wrapCount		= 0; //Times the ring has wrapped back to its start
+		size_t failedCount		= 0; //Allocations that could not fit in the ring at all
+		size_t peakBytesInUse	= 0;
+	};
+
+	/*
+	StagingRingBuffer: A persistently mapped, host visible buffer that upload
+	code can carve temporary staging memory out of, rather than creating and
+	destroying a new buffer for every asset. Allocations are made linearly,
+	and are batched up by owner until FenceAllocations is called for that
+	owner, which hands back a fence that MUST be used by the queue submission
+	that reads from them. The space is then reclaimed once that fence has been
+	signalled. Code that submits its own command buffers should get an owner
+	from NewOwner, so that it doesn't fence allocations recorded into command
+	buffers that haven't been submitted yet.
+
+	If an allocation cannot be made (it's larger than the whole ring, or the
+	ring is full of allocations that haven't been fenced yet), an empty
+	StagingAllocation is returned, and the caller should use a dedicated
+	staging buffer instead.
+	*/
+	class StagingRingBuffer	{
+	public:
+		StagingRingBuffer(vk::Device device, VmaAllocator allocator, size_t byteSize);
+		~StagingRingBuffer();
+
+		StagingAllocation	Allocate(size_t byteCount, size_t alignment = 16, StagingOwner owner = 0);
+		StagingAllocation	Allocate(const void* data, size_t byteCount, size_t alignment = 16, StagingOwner owner = 0);
+
+		StagingOwner	NewOwner() {
+			return ++lastOwner;
+		}
+
+		bool		HasUnfencedAllocations(StagingOwner owner = 0) const;
+		vk::Fence	FenceAllocations(StagingOwner owner = 0);
+
+		//Frees up any regions whose fences have been signalled, without blocking
+		void		Reclaim();
+		void		WaitForIdle();
+
+		size_t		GetCapacity() const {
+			return capacity;
+		}
+		size_t		GetBytesInUse() const {
+			return usedBytes;
+		}
+
+		const StagingStats& GetStats() const {
+			return stats;
+		}
+		void	ResetStats() {
+			stats = {};
+		}
+
+	protected:
+		struct FencedRegion {
+			vk::Fence		fence;	//Null until its owner calls FenceAllocations
+			size_t			byteCount;
+			StagingOwner	owner;
+		};
+		vk::Device		sourceDevice;
+		VulkanBuffer	buffer;
+		char*			mappedData;
+
+		size_t	capacity;
+		size_t	head;			//Where the next allocation will start
+		size_t	usedBytes;		//Everything from the oldest region up to head
+
+		StagingOwner lastOwner;
+
+		//Kept in ring order, space can only be reclaimed from the front
+		std::deque<FencedRegion>	inFlightRegions;
+		std::vector<vk::Fence>		freeFences;
+
+		StagingStats stats;
+	};
+}
@@ -9,6 +9,8 @@ License: MIT (see LICENSE file at the top of the source tree)
 #include "VulkanTexture.h"
 #include "VulkanUtils.h"
 #include "VulkanBufferBuilder.h"
+#include "VulkanStagingRingBuffer.h"
+#include "VulkanUploadScheduler.h"
 #include "TextureLoader.h"
 
 using namespace NCL;
@@ -28,6 +30,10 @@ TextureBuilder::TextureBuilder(vk::Device inDevice, VmaAllocator inAllocator) {
     pipeFlags   = vk::PipelineStageFlagBits2::eFragmentShader;
 
     layerCount      = 1;
+
+    stagingRing     = nullptr;
+    uploadScheduler = nullptr;
+    uploadTicket    = 0;
 }
 
 TextureBuilder& TextureBuilder::WithFormat(vk::Format inFormat) {
@@ -89,6 +95,16 @@ TextureBuilder& TextureBuilder::UsingPool(vk::CommandPool inPool) {
     return *this;
 }
 
+TextureBuilder& TextureBuilder::WithStagingBuffer(StagingRingBuffer* ring) {
+    stagingRing = ring;
+    return *this;
+}
+
+TextureBuilder& TextureBuilder::WithUploadScheduler(UploadScheduler* scheduler) {
+    uploadScheduler = scheduler;
+    return *this;
+}
+
 UniqueVulkanTexture TextureBuilder::Build(const std::string& debugName) {
     vk::UniqueCommandBuffer	uniqueBuffer;
     vk::CommandBuffer	    usingBuffer;
@@ -120,7 +136,7 @@ UniqueVulkanTexture TextureBuilder::BuildFromData(void* dataSrc, size_t byteCoun
         usages |= vk::ImageUsageFlagBits::eTransferDst;
     }
 
-    UniqueVulkanTexture tex = GenerateTexture(usingBuffer, requestedSize, false, debugName);
+    UniqueVulkanTexture tex = GenerateTexture(usingBuffer, requestedSize, false, debugName, true);
 
     //ImageTransitionBarrier(usingBuffer, tex->GetImage(), vk::ImageLayout::eUndefined, layout, aspects, vk::PipelineStageFlagBits::eTopOfPipe, pipeFlags);
 
@@ -167,7 +183,12 @@ void TextureBuilder::EndTexture(const std::string& debugName, vk::UniqueCommandB
 
     //If we're in charge of our own buffers, we just stop and wait for completion now
     if (uniqueBuffer) {
-        CmdBufferEndSubmitWait(usingBuffer, sourceDevice, queue);
+        if (job.ringStaged) {
+            CmdBufferEndSubmitWait(usingBuffer, sourceDevice, queue, stagingRing->FenceAllocations(job.ringOwner));
+        }
+        else {
+            CmdBufferEndSubmitWait(usingBuffer, sourceDevice, queue);
+        }
         for (int i = 0; i < job.faceCount; ++i) {
             if (job.dataOwnership[i]) {
                 TextureLoader::DeleteTextureData(job.dataSrcs[i]);
@@ -202,7 +223,7 @@ UniqueVulkanTexture TextureBuilder::BuildFromFile(const std::string& filename) {
         usages |= vk::ImageUsageFlagBits::eTransferSrc;
     }
 
-    UniqueVulkanTexture tex = GenerateTexture(usingBuffer, dimensions, false, filename);
+    UniqueVulkanTexture tex = GenerateTexture(usingBuffer, dimensions, false, filename, true);
 
     TextureJob job;
     job.faceCount = 1;
@@ -270,7 +291,7 @@ UniqueVulkanTexture TextureBuilder::BuildCubemapFromFile(
     job.faceByteCount = dimensions[0].x * dimensions[0].y * dimensions[0].z * channels[0] * sizeof(char);
     job.dimensions = dimensions[0];
 
-    UniqueVulkanTexture tex = GenerateTexture(usingBuffer, dimensions[0], true, debugName);
+    UniqueVulkanTexture tex = GenerateTexture(usingBuffer, dimensions[0], true, debugName, true);
     job.image = tex->GetImage();
 
     UploadTextureData(usingBuffer, job);
@@ -296,7 +317,7 @@ UniqueVulkanTexture TextureBuilder::BuildCubemap(const std::string& debugName) {
     return tex;
 }
 
-UniqueVulkanTexture	TextureBuilder::GenerateTexture(vk::CommandBuffer cmdBuffer, Vector3ui dimensions, bool isCube, const std::string& debugName) {
+UniqueVulkanTexture	TextureBuilder::GenerateTexture(vk::CommandBuffer cmdBuffer, Vector3ui dimensions, bool isCube, const std::string& debugName, bool hasData) {
     VulkanTexture* t = new VulkanTexture();
 
     uint32_t mipCount = VulkanTexture::GetMaxMips(dimensions);
@@ -344,29 +365,65 @@ UniqueVulkanTexture	TextureBuilder::GenerateTexture(vk::CommandBuffer cmdBuffer,
 	SetDebugName(sourceDevice, vk::ObjectType::eImage    , GetVulkanHandle(t->image)       , debugName);
 	SetDebugName(sourceDevice, vk::ObjectType::eImageView, GetVulkanHandle(*t->defaultView), debugName);
 
-	ImageTransitionBarrier(cmdBuffer, t->image, vk::ImageLayout::eUndefined, layout, aspects, vk::PipelineStageFlagBits2::eTopOfPipe, pipeFlags);
-
+    //The upload scheduler does its own transitions on another queue, which this could otherwise land after
+    if (!(hasData && UsesUploadScheduler())) {
+        ImageTransitionBarrier(cmdBuffer, t->image, vk::ImageLayout::eUndefined, layout, aspects, vk::PipelineStageFlagBits2::eTopOfPipe, pipeFlags);
+    }
     return UniqueVulkanTexture(t);
 }
 
 void TextureBuilder::UploadTextureData(vk::CommandBuffer cmdBuffer, TextureJob& job) {
     int allocationSize = job.faceByteCount * job.faceCount;
 
-    job.stagingBuffer = BufferBuilder(sourceDevice, sourceAllocator)
-        .WithBufferUsage(vk::BufferUsageFlagBits::eTransferSrc)
-        .WithHostVisibility()
-        .Build(allocationSize, "Staging Buffer");
+    if (UsesUploadScheduler()) {
+        const void* data = job.dataSrcs[0];
+        std::vector<char> packedFaces;
+        if (job.faceCount > 1) {
+            packedFaces.resize(allocationSize);
+            for (int i = 0; i < job.faceCount; ++i) {
+                memcpy(packedFaces.data() + (i * job.faceByteCount), job.dataSrcs[i], job.faceByteCount);
+            }
+            data = packedFaces.data();
+        }
+        uploadTicket = uploadScheduler->UploadImage(job.image, data, allocationSize,
+            { job.dimensions.x, job.dimensions.y, job.dimensions.z }, job.faceCount,
+            job.endLayout, pipeFlags, DefaultAccessFlags2(job.endLayout), vk::ImageAspectFlagBits::eColor);
+        return;
+    }
+
+    StagingAllocation staging;
+    if (stagingRing) {
+        //If recording into an external command buffer, these are fenced along with the renderer's frame
+        if (!this->cmdBuffer) {
+            job.ringOwner = stagingRing->NewOwner();
+        }
+        staging = stagingRing->Allocate(allocationSize, 16, job.ringOwner);
+    }
+    job.ringStaged = staging;
+
+    if (!job.ringStaged) {
+        job.stagingBuffer = BufferBuilder(sourceDevice, sourceAllocator)
+            .WithBufferUsage(vk::BufferUsageFlagBits::eTransferSrc)
+            .WithHostVisibility()
+            .Build(allocationSize, "Staging Buffer");
+
+        staging.buffer  = job.stagingBuffer.buffer;
+        staging.data    = (char*)job.stagingBuffer.Map();
+    }
 
     //our buffer now has memory! Copy some texture date to it...
-    char* gpuPtr = (char*)job.stagingBuffer.Map();
+    char* gpuPtr = staging.data;
     for (int i = 0; i < job.faceCount; ++i) {
         memcpy(gpuPtr, job.dataSrcs[i], job.faceByteCount);
         gpuPtr += job.faceByteCount;
     }
-    job.stagingBuffer.Unmap();
+    if (!job.ringStaged) {
+        job.stagingBuffer.Unmap();
+    }
 
-    Vulkan::UploadTextureData(cmdBuffer, job.stagingBuffer.buffer, job.image, vk::ImageLayout::eUndefined, job.endLayout,
+    Vulkan::UploadTextureData(cmdBuffer, staging.buffer, job.image, vk::ImageLayout::eUndefined, job.endLayout,
         vk::BufferImageCopy{
+            .bufferOffset = staging.offset,
             .imageSubresource = {
                 .aspectMask = vk::ImageAspectFlagBits::eColor,
                 .mipLevel = 0,
@@ -8,8 +8,11 @@ License: MIT (see LICENSE file at the top of the source tree)
 #pragma once
 #include "SmartTypes.h"
 #include "VulkanBuffers.h"
+#include "VulkanStagingRingBuffer.h"
 
 namespace NCL::Rendering::Vulkan {
+	class UploadScheduler;
+
 	class TextureBuilder	{
 	public:
 		TextureBuilder(vk::Device device, VmaAllocator allocator);
@@ -25,6 +28,16 @@ namespace NCL::Rendering::Vulkan {
 		TextureBuilder& UsingQueue(vk::Queue queue);
 		TextureBuilder& UsingPool(vk::CommandPool pool);
 
+		//Texture data is staged through this ring where it fits, rather than a new buffer per texture
+		TextureBuilder& WithStagingBuffer(StagingRingBuffer* ring);
+		//Texture data without mips to generate is uploaded via the scheduler's transfer queue instead.
+		//Those textures can't be used until the scheduler says the ticket from GetUploadTicket is ready
+		TextureBuilder& WithUploadScheduler(UploadScheduler* scheduler);
+
+		uint64_t GetUploadTicket() const {
+			return uploadTicket;
+		}
+
 		TextureBuilder& WithMips(bool state);
 		TextureBuilder& WithDimension(uint32_t width, uint32_t height, uint32_t depth = 1);
 		TextureBuilder& WithLayerCount(uint32_t layers);
@@ -63,6 +76,8 @@ namespace NCL::Rendering::Vulkan {
 			vk::ImageAspectFlags aspect;
 
 			VulkanBuffer	stagingBuffer;
+			bool			ringStaged = false; //Data came from the staging ring instead of stagingBuffer
+			StagingOwner	ringOwner = 0;
 
 			size_t			faceByteCount;
 
@@ -82,6 +97,8 @@ namespace NCL::Rendering::Vulkan {
 				image = other.image;
 				workFence = other.workFence;
 				stagingBuffer = std::move(other.stagingBuffer);
+				ringStaged = other.ringStaged;
+				ringOwner = other.ringOwner;
 			}
 
 			TextureJob(TextureJob&& other) {
@@ -89,13 +106,19 @@ namespace NCL::Rendering::Vulkan {
 				image = other.image;
 				workFence = other.workFence;
 				stagingBuffer = std::move(other.stagingBuffer);
+				ringStaged = other.ringStaged;
+				ringOwner = other.ringOwner;
 			}
 		};
 
 		void BeginTexture(const std::string& debugName, vk::UniqueCommandBuffer& uniqueBuffer, vk::CommandBuffer& usingBuffer);
 		void EndTexture(const std::string& debugName, vk::UniqueCommandBuffer& uniqueBuffer, vk::CommandBuffer& usingBuffer, TextureJob& job, UniqueVulkanTexture& t);
 
-		UniqueVulkanTexture	GenerateTexture(vk::CommandBuffer cmdBuffer, Maths::Vector3ui dimensions, bool isCube, const std::string& debugName);
+		UniqueVulkanTexture	GenerateTexture(vk::CommandBuffer cmdBuffer, Maths::Vector3ui dimensions, bool isCube, const std::string& debugName, bool hasData = false);
+
+		bool UsesUploadScheduler() const {
+			return uploadScheduler && !generateMips;
+		}
 
 		void UploadTextureData(vk::CommandBuffer buffer, TextureJob& job);
 
@@ -116,6 +139,10 @@ namespace NCL::Rendering::Vulkan {
 		vk::CommandPool		pool;
 		vk::CommandBuffer	cmdBuffer;
 
+		StagingRingBuffer*	stagingRing;
+		UploadScheduler*	uploadScheduler;
+		uint64_t			uploadTicket;
+
 		std::vector<TextureJob> activeJobs;
 	};
 }
\ No newline at end of file
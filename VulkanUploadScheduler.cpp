@@ -0,0 +1,330 @@
+/******************************************************************************
+This file is part of the Newcastle Vulkan Tutorial Series
+
+Author:Rich Davison
+Contact:richgdavison@gmail.com
+License: MIT (see LICENSE file at the top of the source tree)
+*//////////////////////////////////////////////////////////////////////////////
+#include "VulkanUploadScheduler.h"
+#include "VulkanBufferBuilder.h"
+#include "VulkanUtils.h"
+
+using namespace NCL;
+using namespace Rendering;
+using namespace Vulkan;
+
+UploadScheduler::UploadScheduler(vk::Device device, VmaAllocator allocator, vk::Queue inCopyQueue, uint32_t inCopyFamily, uint32_t inGraphicsFamily, size_t stagingSize)
+	: stagingRing(device, allocator, stagingSize) {
+	sourceDevice	= device;
+	sourceAllocator = allocator;
+	copyQueue		= inCopyQueue;
+	copyFamily		= inCopyFamily;
+	graphicsFamily	= inGraphicsFamily;
+
+	nextTimelineValue	= 1;
+	acquiredValue		= 0;
+
+	flushByteThreshold	= stagingSize / 4;
+	flushCopyThreshold	= 256;
+
+	pool = device.createCommandPool(
+		{
+			.flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer | vk::CommandPoolCreateFlagBits::eTransient,
+			.queueFamilyIndex = copyFamily
+		}
+	);
+
+	vk::SemaphoreTypeCreateInfo timelineInfo = {
+		.semaphoreType	= vk::SemaphoreType::eTimeline,
+		.initialValue	= 0
+	};
+	timeline = device.createSemaphore({ .pNext = &timelineInfo });
+	SetDebugName(device, vk::ObjectType::eSemaphore, GetVulkanHandle(timeline), "Upload Timeline");
+}
+
+UploadScheduler::~UploadScheduler() {
+	WaitForIdle();
+	submittedBatches.clear();
+	sourceDevice.destroyCommandPool(pool);
+	sourceDevice.destroySemaphore(timeline);
+}
+
+UploadScheduler::UploadBatch& UploadScheduler::CurrentBatch() {
+	if (!currentBatch.cmdBuffer) {
+		if (freeCmdBuffers.empty()) {
+			currentBatch.cmdBuffer = sourceDevice.allocateCommandBuffers(
+				{
+					.commandPool		= pool,
+					.level				= vk::CommandBufferLevel::ePrimary,
+					.commandBufferCount = 1
+				}
+			)[0];
+			SetDebugName(sourceDevice, vk::ObjectType::eCommandBuffer, GetVulkanHandle(currentBatch.cmdBuffer), "Upload Batch");
+		}
+		else {
+			currentBatch.cmdBuffer = freeCmdBuffers.back();
+			freeCmdBuffers.pop_back();
+		}
+		currentBatch.cmdBuffer.begin({ .flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
+	}
+	return currentBatch;
+}
+
+StagingAllocation UploadScheduler::AllocateStaging(size_t byteCount, size_t alignment) {
+	StagingAllocation staging = stagingRing.Allocate(byteCount, alignment);
+
+	if (!staging && currentBatch.copyCount > 0) {
+		//The ring is full of data for the current batch, which needs to be submitted to free it up
+		Flush();
+		staging = stagingRing.Allocate(byteCount, alignment);
+	}
+	if (!staging) {
+		UploadBatch& batch = CurrentBatch();
+		batch.dedicatedStaging.push_back(BufferBuilder(sourceDevice, sourceAllocator)
+			.WithBufferUsage(vk::BufferUsageFlagBits::eTransferSrc)
+			.WithHostVisibility()
+			.WithPersistentMapping()
+			.Build(byteCount, "Upload Staging Buffer")
+		);
+		VulkanBuffer& buffer = batch.dedicatedStaging.back();
+		staging = {
+			.buffer = buffer.buffer,
+			.offset = 0,
+			.size	= byteCount,
+			.data	= (char*)buffer.Data()
+		};
+		stats.dedicatedStaging++;
+	}
+	return staging;
+}
+
+uint64_t UploadScheduler::CopyBuffer(const StagingAllocation& src, vk::Buffer dst, vk::DeviceSize dstOffset, vk::PipelineStageFlags2 dstStages, vk::AccessFlags2 dstAccess) {
+	return CopyBuffer(src, dst, { { .srcOffset = src.offset, .dstOffset = dstOffset, .size = src.size } }, dstStages, dstAccess);
+}
+
+uint64_t UploadScheduler::CopyBuffer(const StagingAllocation& src, vk::Buffer dst, const std::vector<vk::BufferCopy>& regions, vk::PipelineStageFlags2 dstStages, vk::AccessFlags2 dstAccess) {
+	if (regions.empty()) {
+		return nextTimelineValue - 1;
+	}
+	UploadBatch& batch = CurrentBatch();
+	batch.cmdBuffer.copyBuffer(src.buffer, dst, regions);
+
+	//Buffers in the same family are made visible by the timeline semaphore wait alone
+	if (IsOwnershipTransfer()) {
+		for (const vk::BufferCopy& region : regions) {
+			vk::BufferMemoryBarrier2 release = {
+				.srcStageMask			= vk::PipelineStageFlagBits2::eCopy,
+				.srcAccessMask			= vk::AccessFlagBits2::eTransferWrite,
+				.srcQueueFamilyIndex	= copyFamily,
+				.dstQueueFamilyIndex	= graphicsFamily,
+				.buffer					= dst,
+				.offset					= region.dstOffset,
+				.size					= region.size
+			};
+			vk::BufferMemoryBarrier2 acquire = release;
+			acquire.srcStageMask	= vk::PipelineStageFlagBits2::eNone;
+			acquire.srcAccessMask	= vk::AccessFlagBits2::eNone;
+			acquire.dstStageMask	= dstStages;
+			acquire.dstAccessMask	= dstAccess;
+
+			batch.bufferReleases.push_back(release);
+			batch.bufferAcquires.push_back(acquire);
+		}
+	}
+	//Only one chance to flush, so the staging memory can't be reclaimed before every region has read it
+	return EndCopy(src.size);
+}
+
+uint64_t UploadScheduler::UploadBuffer(vk::Buffer dst, vk::DeviceSize dstOffset, const void* data, size_t byteCount, vk::PipelineStageFlags2 dstStages, vk::AccessFlags2 dstAccess) {
+	StagingAllocation staging = AllocateStaging(byteCount);
+	memcpy(staging.data, data, byteCount);
+	return CopyBuffer(staging, dst, dstOffset, dstStages, dstAccess);
+}
+
+uint64_t UploadScheduler::UploadImage(vk::Image image, const void* data, size_t byteCount, vk::Extent3D extent, uint32_t layerCount,
+	vk::ImageLayout endLayout, vk::PipelineStageFlags2 dstStages, vk::AccessFlags2 dstAccess, vk::ImageAspectFlags aspect) {
+	StagingAllocation staging = AllocateStaging(byteCount);
+	memcpy(staging.data, data, byteCount);
+
+	UploadBatch& batch = CurrentBatch();
+
+	ImageTransitionBarrier(batch.cmdBuffer, image, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal, aspect,
+		vk::PipelineStageFlagBits2::eNone, vk::PipelineStageFlagBits2::eCopy, 0, 1, 0, layerCount);
+
+	vk::BufferImageCopy region = {
+		.bufferOffset = staging.offset,
+		.imageSubresource = {
+			.aspectMask		= aspect,
+			.mipLevel		= 0,
+			.baseArrayLayer = 0,
+			.layerCount		= layerCount
+		},
+		.imageExtent = extent
+	};
+	batch.cmdBuffer.copyBufferToImage(staging.buffer, image, vk::ImageLayout::eTransferDstOptimal, region);
+
+	//The final layout transition happens on the copy queue either way
+	vk::ImageMemoryBarrier2 release = {
+		.srcStageMask			= vk::PipelineStageFlagBits2::eCopy,
+		.srcAccessMask			= vk::AccessFlagBits2::eTransferWrite,
+		.oldLayout				= vk::ImageLayout::eTransferDstOptimal,
+		.newLayout				= endLayout,
+		.srcQueueFamilyIndex	= IsOwnershipTransfer() ? copyFamily		: VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex	= IsOwnershipTransfer() ? graphicsFamily	: VK_QUEUE_FAMILY_IGNORED,
+		.image					= image,
+		.subresourceRange = {
+			.aspectMask		= aspect,
+			.baseMipLevel	= 0,
+			.levelCount		= 1,
+			.baseArrayLayer = 0,
+			.layerCount		= layerCount
+		}
+	};
+	batch.imageReleases.push_back(release);
+
+	if (IsOwnershipTransfer()) {
+		vk::ImageMemoryBarrier2 acquire = release;
+		acquire.srcStageMask	= vk::PipelineStageFlagBits2::eNone;
+		acquire.srcAccessMask	= vk::AccessFlagBits2::eNone;
+		acquire.dstStageMask	= dstStages;
+		acquire.dstAccessMask	= dstAccess;
+		batch.imageAcquires.push_back(acquire);
+	}
+	return EndCopy(byteCount);
+}
+
+uint64_t UploadScheduler::EndCopy(size_t byteCount) {
+	currentBatch.byteCount += byteCount;
+	currentBatch.copyCount++;
+
+	stats.bytesUploaded += byteCount;
+	stats.copyCount++;
+
+	uint64_t ticket = nextTimelineValue;
+	if (currentBatch.byteCount >= flushByteThreshold || currentBatch.copyCount >= flushCopyThreshold) {
+		Flush();
+	}
+	return ticket;
+}
+
+uint64_t UploadScheduler::Flush() {
+	if (!currentBatch.cmdBuffer) {
+		return nextTimelineValue - 1;
+	}
+	if (!currentBatch.bufferReleases.empty() || !currentBatch.imageReleases.empty()) {
+		currentBatch.cmdBuffer.pipelineBarrier2(
+			{
+				.bufferMemoryBarrierCount	= (uint32_t)currentBatch.bufferReleases.size(),
+				.pBufferMemoryBarriers		= currentBatch.bufferReleases.data(),
+				.imageMemoryBarrierCount	= (uint32_t)currentBatch.imageReleases.size(),
+				.pImageMemoryBarriers		= currentBatch.imageReleases.data()
+			}
+		);
+	}
+	currentBatch.cmdBuffer.end();
+	currentBatch.timelineValue = nextTimelineValue++;
+
+	vk::SemaphoreSubmitInfo signalInfo = {
+		.semaphore	= timeline,
+		.value		= currentBatch.timelineValue,
+		.stageMask	= vk::PipelineStageFlagBits2::eAllCommands
+	};
+	vk::CommandBufferSubmitInfo cmdInfo = {
+		.commandBuffer = currentBatch.cmdBuffer
+	};
+	vk::SubmitInfo2 submitInfo = {
+		.commandBufferInfoCount		= 1,
+		.pCommandBufferInfos		= &cmdInfo,
+		.signalSemaphoreInfoCount	= 1,
+		.pSignalSemaphoreInfos		= &signalInfo
+	};
+	copyQueue.submit2(submitInfo, stagingRing.FenceAllocations());
+
+	stats.batchCount++;
+
+	uint64_t submittedValue = currentBatch.timelineValue;
+	currentBatch.bufferReleases.clear();
+	currentBatch.imageReleases.clear();
+	submittedBatches.push_back(std::move(currentBatch));
+	currentBatch = {};
+
+	RetireBatches();
+	return submittedValue;
+}
+
+uint64_t UploadScheduler::RecordAcquireBarriers(vk::CommandBuffer cmdBuffer) {
+	uint64_t completedValue = sourceDevice.getSemaphoreCounterValue(timeline);
+	uint64_t waitValue		= 0;
+
+	std::vector<vk::BufferMemoryBarrier2>	bufferBarriers;
+	std::vector<vk::ImageMemoryBarrier2>	imageBarriers;
+
+	for (UploadBatch& batch : submittedBatches) {
+		if (batch.timelineValue > completedValue) {
+			break;
+		}
+		if (batch.acquired) {
+			continue;
+		}
+		bufferBarriers.insert(bufferBarriers.end(), batch.bufferAcquires.begin(), batch.bufferAcquires.end());
+		imageBarriers.insert(imageBarriers.end(), batch.imageAcquires.begin(), batch.imageAcquires.end());
+		batch.acquired	= true;
+		waitValue		= batch.timelineValue;
+	}
+	if (!bufferBarriers.empty() || !imageBarriers.empty()) {
+		cmdBuffer.pipelineBarrier2(
+			{
+				.bufferMemoryBarrierCount	= (uint32_t)bufferBarriers.size(),
+				.pBufferMemoryBarriers		= bufferBarriers.data(),
+				.imageMemoryBarrierCount	= (uint32_t)imageBarriers.size(),
+				.pImageMemoryBarriers		= imageBarriers.data()
+			}
+		);
+	}
+	if (waitValue > 0) {
+		acquiredValue = waitValue;
+	}
+	RetireBatches();
+	return waitValue;
+}
+
+void UploadScheduler::RetireBatches() {
+	uint64_t completedValue = sourceDevice.getSemaphoreCounterValue(timeline);
+
+	while (!submittedBatches.empty()) {
+		UploadBatch& batch = submittedBatches.front();
+		if (batch.timelineValue > completedValue || !batch.acquired) {
+			break;
+		}
+		batch.cmdBuffer.reset();
+		freeCmdBuffers.push_back(batch.cmdBuffer);
+		submittedBatches.pop_front();
+	}
+	stagingRing.Reclaim();
+}
+
+bool UploadScheduler::IsComplete(uint64_t ticket) const {
+	return sourceDevice.getSemaphoreCounterValue(timeline) >= ticket;
+}
+
+void UploadScheduler::WaitForUpload(uint64_t ticket) {
+	if (ticket >= nextTimelineValue) {
+		Flush();
+	}
+	vk::SemaphoreWaitInfo waitInfo = {
+		.semaphoreCount = 1,
+		.pSemaphores	= &timeline,
+		.pValues		= &ticket
+	};
+	if (sourceDevice.waitSemaphores(waitInfo, UINT64_MAX) != vk::Result::eSuccess) {
+		std::cout << __FUNCTION__ << " failed waiting on upload timeline!\n";
+	}
+}
+
+void UploadScheduler::WaitForIdle() {
+	uint64_t lastValue = Flush();
+	if (lastValue > 0) {
+		WaitForUpload(lastValue);
+	}
+	stagingRing.WaitForIdle();
+}
@@ -0,0 +1,139 @@
+/******************************************************************************
+This file is part of the Newcastle Vulkan Tutorial Series
+
+Author:Rich Davison
+Contact:richgdavison@gmail.com
+License: MIT (see LICENSE file at the top of the source tree)
+*//////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "VulkanBuffers.h"
+#include "VulkanStagingRingBuffer.h"
+#include <deque>
+
+namespace NCL::Rendering::Vulkan {
+	struct UploadStats {
+		size_t bytesUploaded	= 0;
+		size_t copyCount		= 0;
+		size_t batchCount		= 0;
+		size_t dedicatedStaging = 0; //Uploads too large for the staging ring
+	};
+
+	/*
+	UploadScheduler: Records buffer and image copies into batches, which are
+	submitted to the transfer queue a few at a time rather than once per
+	asset. Each batch signals a timeline semaphore with an increasing value,
+	which is returned from every upload call as a 'ticket' - once the
+	semaphore reaches that value, the data is on the GPU.
+
+	Completed batches are then handed over to the graphics queue via
+	RecordAcquireBarriers, which records any queue family ownership transfers,
+	and returns the timeline value that command buffer's submission must wait
+	on. Only batches that have already completed are acquired, so a frame
+	never has to wait on the transfer queue. Once IsReady returns true for a
+	ticket, commands recorded after that point may use the uploaded data.
+
+	Requires the timelineSemaphore and synchronization2 features. Not thread
+	safe - uploads should all come from a single thread.
+	*/
+	class UploadScheduler	{
+	public:
+		UploadScheduler(vk::Device device, VmaAllocator allocator, vk::Queue copyQueue, uint32_t copyFamily, uint32_t graphicsFamily, size_t stagingSize = 32 * 1024 * 1024);
+		~UploadScheduler();
+
+		//Staging memory to write into, which should be passed to CopyBuffer before allocating more
+		StagingAllocation	AllocateStaging(size_t byteCount, size_t alignment = 16);
+
+		uint64_t	CopyBuffer(const StagingAllocation& src, vk::Buffer dst, vk::DeviceSize dstOffset,
+						vk::PipelineStageFlags2 dstStages, vk::AccessFlags2 dstAccess);
+		//Copies several regions out of one staging allocation, all in the same batch. The source
+		//offsets are from the start of src.buffer, and must lie within the allocation
+		uint64_t	CopyBuffer(const StagingAllocation& src, vk::Buffer dst, const std::vector<vk::BufferCopy>& regions,
+						vk::PipelineStageFlags2 dstStages, vk::AccessFlags2 dstAccess);
+
+		uint64_t	UploadBuffer(vk::Buffer dst, vk::DeviceSize dstOffset, const void* data, size_t byteCount,
+						vk::PipelineStageFlags2 dstStages	= vk::PipelineStageFlagBits2::eAllCommands,
+						vk::AccessFlags2 dstAccess			= vk::AccessFlagBits2::eMemoryRead);
+
+		//Uploads the top mip level of each layer, with the layers tightly packed in data
+		uint64_t	UploadImage(vk::Image image, const void* data, size_t byteCount, vk::Extent3D extent, uint32_t layerCount = 1,
+						vk::ImageLayout endLayout			= vk::ImageLayout::eShaderReadOnlyOptimal,
+						vk::PipelineStageFlags2 dstStages	= vk::PipelineStageFlagBits2::eFragmentShader,
+						vk::AccessFlags2 dstAccess			= vk::AccessFlagBits2::eShaderSampledRead,
+						vk::ImageAspectFlags aspect			= vk::ImageAspectFlagBits::eColor);
+
+		//Submits the current batch, returning the timeline value it will signal
+		uint64_t	Flush();
+
+		//Returns the timeline value the command buffer's submission should wait on, or 0 if nothing was acquired
+		uint64_t	RecordAcquireBarriers(vk::CommandBuffer cmdBuffer);
+
+		bool		IsComplete(uint64_t ticket) const;
+		bool		IsReady(uint64_t ticket) const {
+			return ticket <= acquiredValue;
+		}
+		void		WaitForUpload(uint64_t ticket);
+		void		WaitForIdle();
+
+		vk::Semaphore GetTimelineSemaphore() const {
+			return timeline;
+		}
+
+		//Batches are automatically flushed once they contain this many bytes or copies
+		void SetFlushThresholds(size_t byteCount, uint32_t copyCount) {
+			flushByteThreshold = byteCount;
+			flushCopyThreshold = copyCount;
+		}
+
+		const UploadStats& GetStats() const {
+			return stats;
+		}
+		const StagingStats& GetStagingStats() const {
+			return stagingRing.GetStats();
+		}
+
+	protected:
+		struct UploadBatch {
+			vk::CommandBuffer	cmdBuffer;
+			uint64_t			timelineValue = 0;
+			size_t				byteCount = 0;
+			uint32_t			copyCount = 0;
+			bool				acquired = false;
+
+			std::vector<vk::BufferMemoryBarrier2>	bufferReleases;
+			std::vector<vk::ImageMemoryBarrier2>	imageReleases;
+			std::vector<vk::BufferMemoryBarrier2>	bufferAcquires;
+			std::vector<vk::ImageMemoryBarrier2>	imageAcquires;
+			std::vector<VulkanBuffer>				dedicatedStaging;
+		};
+
+		UploadBatch&	CurrentBatch();
+		uint64_t		EndCopy(size_t byteCount);
+		void			RetireBatches();
+
+		bool IsOwnershipTransfer() const {
+			return copyFamily != graphicsFamily;
+		}
+
+		vk::Device			sourceDevice;
+		VmaAllocator		sourceAllocator;
+		vk::Queue			copyQueue;
+		uint32_t			copyFamily;
+		uint32_t			graphicsFamily;
+
+		vk::CommandPool		pool;
+		vk::Semaphore		timeline;
+		uint64_t			nextTimelineValue;	//Signalled by the batch currently being recorded
+		uint64_t			acquiredValue;
+
+		StagingRingBuffer	stagingRing;
+
+		UploadBatch					currentBatch;
+		std::deque<UploadBatch>		submittedBatches;
+		std::vector<vk::CommandBuffer> freeCmdBuffers;
+
+		size_t		flushByteThreshold;
+		uint32_t	flushCopyThreshold;
+
+		UploadStats	stats;
+	};
+}
@@ -8,12 +8,16 @@ License: MIT (see LICENSE file at the top of the source tree)
 #include "VulkanUtils.h"
 #include "VulkanTexture.h"
 #include "VulkanBuffers.h"
+#include "VulkanDescriptorSetLayoutCache.h"
 
 using namespace NCL;
 using namespace Rendering;
 using namespace Vulkan;
 
 std::map<vk::Device, vk::DescriptorSetLayout > nullDescriptors;
+std::map<vk::Device, vk::PipelineCache > defaultPipelineCaches;
+std::map<vk::Device, DescriptorSetLayoutCache* > layoutCaches;
+std::map<vk::Device, vk::PhysicalDeviceDescriptorBufferPropertiesEXT > descriptorBufferProperties;
 
 vk::DynamicLoader NCL::Rendering::Vulkan::dynamicLoader;
 
@@ -46,6 +50,47 @@ vk::DescriptorSetLayout Vulkan::GetNullDescriptor(vk::Device device) {
 	return nullDescriptors[device];
 }
 
+void Vulkan::SetDefaultPipelineCache(vk::Device device, vk::PipelineCache cache) {
+	defaultPipelineCaches[device] = cache;
+}
+
+vk::PipelineCache Vulkan::GetDefaultPipelineCache(vk::Device device) {
+	auto i = defaultPipelineCaches.find(device);
+	return i == defaultPipelineCaches.end() ? vk::PipelineCache() : i->second;
+}
+
+void Vulkan::SetDescriptorSetLayoutCache(vk::Device device, DescriptorSetLayoutCache* cache) {
+	layoutCaches[device] = cache;
+}
+
+DescriptorSetLayoutCache* Vulkan::GetDescriptorSetLayoutCache(vk::Device device) {
+	auto i = layoutCaches.find(device);
+	return i == layoutCaches.end() ? nullptr : i->second;
+}
+
+void Vulkan::SetDescriptorSizes(vk::Device device, vk::PhysicalDeviceDescriptorBufferPropertiesEXT& props) {
+	descriptorBufferProperties[device] = props;
+	descriptorBufferProperties[device].pNext = nullptr;
+}
+
+const vk::PhysicalDeviceDescriptorBufferPropertiesEXT& Vulkan::GetDescriptorBufferProperties(vk::Device device) {
+	return descriptorBufferProperties[device];
+}
+
+vk::DeviceSize Vulkan::GetDescriptorBindingOffset(vk::Device device, vk::DescriptorSetLayout layout, uint32_t binding) {
+	if (DescriptorSetLayoutCache* cache = GetDescriptorSetLayoutCache(device)) {
+		return cache->GetBindingOffset(layout, binding);
+	}
+	return device.getDescriptorSetLayoutBindingOffsetEXT(layout, binding);
+}
+
+vk::DeviceSize Vulkan::GetDescriptorSetLayoutSize(vk::Device device, vk::DescriptorSetLayout layout) {
+	if (DescriptorSetLayoutCache* cache = GetDescriptorSetLayoutCache(device)) {
+		return cache->GetLayoutSize(layout);
+	}
+	return device.getDescriptorSetLayoutSizeEXT(layout);
+}
+
 vk::AccessFlags Vulkan::DefaultAccessFlags(vk::ImageLayout forLayout) {
 	if (forLayout == vk::ImageLayout::eTransferDstOptimal) {
 		return vk::AccessFlagBits::eTransferWrite;
@@ -403,7 +448,7 @@ void Vulkan::WriteBufferDescriptor(vk::Device device,
 		.data = &address
 	};
 	
-	vk::DeviceSize offset = device.getDescriptorSetLayoutBindingOffsetEXT(layout, layoutIndex);
+	vk::DeviceSize offset = GetDescriptorBindingOffset(device, layout, (uint32_t)layoutIndex);
 
 	device.getDescriptorEXT(&getInfo, props.uniformBufferDescriptorSize, ((char*)descriptorBufferMemory) + offset);
 }
@@ -9,13 +9,26 @@ License: MIT (see LICENSE file at the top of the source tree)
 
 namespace NCL::Rendering::Vulkan {
 	class VulkanTexture;
+	class DescriptorSetLayoutCache;
 
 	extern vk::DynamicLoader dynamicLoader;
 
 	void SetNullDescriptor(vk::Device device, vk::DescriptorSetLayout layout);
 	vk::DescriptorSetLayout GetNullDescriptor(vk::Device device);
 
+	//Used by every pipeline builder that isn't given a cache of its own
+	void SetDefaultPipelineCache(vk::Device device, vk::PipelineCache cache);
+	vk::PipelineCache GetDefaultPipelineCache(vk::Device device);
+
+	void SetDescriptorSetLayoutCache(vk::Device device, DescriptorSetLayoutCache* cache);
+	DescriptorSetLayoutCache* GetDescriptorSetLayoutCache(vk::Device device);
+
 	void SetDescriptorSizes(vk::Device, vk::PhysicalDeviceDescriptorBufferPropertiesEXT& props);
+	const vk::PhysicalDeviceDescriptorBufferPropertiesEXT& GetDescriptorBufferProperties(vk::Device device);
+
+	//Cached by the device's DescriptorSetLayoutCache, if the layout came from there
+	vk::DeviceSize GetDescriptorBindingOffset(vk::Device device, vk::DescriptorSetLayout layout, uint32_t binding);
+	vk::DeviceSize GetDescriptorSetLayoutSize(vk::Device device, vk::DescriptorSetLayout layout);
 
 	template <typename T>
 	uint64_t GetVulkanHandle(T const& cppHandle) {